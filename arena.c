@@ -0,0 +1,118 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Bump allocator for Simple Humane Shell (shush).
+ *
+ * Everything belonging to one command line (tokens, AST nodes, expanded
+ * words) is carved out of a chain of large blocks and given back in one
+ * step, instead of a malloc/free pair per string.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "arena.h"
+
+#define ARENA_BLOCK_SIZE (16 * 1024)
+#define ARENA_ALIGN      16
+
+static arena_block_t *
+new_block(size_t size, arena_block_t *next)
+{
+    arena_block_t *b;
+
+    if (size < ARENA_BLOCK_SIZE)
+        size = ARENA_BLOCK_SIZE;
+    b = malloc(sizeof(*b) + size);
+    if (!b) {
+        perror("malloc");
+        exit(1);
+    }
+    b->next = next;
+    b->size = size;
+    b->used = 0;
+    return b;
+}
+
+void *
+arena_alloc(arena_t *a, size_t size)
+{
+    arena_block_t *b = a->head;
+    size_t off;
+
+    size = (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+
+    if (!b || b->used + size > b->size)
+        a->head = b = new_block(size, b);
+
+    off = b->used;
+    b->used += size;
+    return b->data + off;
+}
+
+void *
+arena_zalloc(arena_t *a, size_t size)
+{
+    return memset(arena_alloc(a, size), 0, size);
+}
+
+char *
+arena_strndup(arena_t *a, const char *s, size_t n)
+{
+    char *p = arena_alloc(a, n + 1);
+
+    memcpy(p, s, n);
+    p[n] = '\0';
+    return p;
+}
+
+arena_mark_t
+arena_mark(arena_t *a)
+{
+    arena_mark_t m = { a->head, a->head ? a->head->used : 0 };
+
+    return m;
+}
+
+/* Free everything allocated after mark was taken */
+void
+arena_release(arena_t *a, arena_mark_t mark)
+{
+    while (a->head && a->head != mark.block) {
+        arena_block_t *b = a->head;
+
+        a->head = b->next;
+        free(b);
+    }
+    if (a->head)
+        a->head->used = mark.used;
+}
+
+/* Free everything but keep one block around for the next user */
+void
+arena_reset(arena_t *a)
+{
+    if (!a->head)
+        return;
+
+    while (a->head->next) {
+        arena_block_t *b = a->head->next;
+
+        a->head->next = b->next;
+        free(b);
+    }
+    a->head->used = 0;
+}
+
+void
+arena_free(arena_t *a)
+{
+    while (a->head) {
+        arena_block_t *b = a->head;
+
+        a->head = b->next;
+        free(b);
+    }
+}
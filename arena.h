@@ -0,0 +1,39 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Bump allocator for Simple Humane Shell (shush).
+ */
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stddef.h>
+
+typedef struct arena_block {
+    struct arena_block *next;
+    size_t size;
+    size_t used;
+    char data[];
+} arena_block_t;
+
+/* An empty arena is all zeroes, the first block is allocated on demand */
+typedef struct {
+    arena_block_t *head;
+} arena_t;
+
+/* Position to roll an arena back to with arena_release */
+typedef struct {
+    arena_block_t *block;
+    size_t used;
+} arena_mark_t;
+
+void *arena_alloc(arena_t *a, size_t size);
+void *arena_zalloc(arena_t *a, size_t size);
+char *arena_strndup(arena_t *a, const char *s, size_t n);
+arena_mark_t arena_mark(arena_t *a);
+void arena_release(arena_t *a, arena_mark_t mark);
+void arena_reset(arena_t *a);
+void arena_free(arena_t *a);
+
+#endif /* ARENA_H */
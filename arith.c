@@ -0,0 +1,676 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Arithmetic expressions for Simple Humane Shell (shush).
+ *
+ * $(( )) and (( )) are parsed the first time they are evaluated into a
+ * small tree kept in the AST's arena next to their text, so evaluating
+ * them again in a loop only walks that tree. The operators are those of C
+ * on long long, plus ** and the assignment forms, as in other shells.
+ */
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "arith.h"
+#include "exec.h"
+#include "var.h"
+
+/* Variables holding expressions are evaluated, but only this deep */
+#define MAX_ARITH_DEPTH 32
+
+/* Node operators, binary ones in order of increasing precedence */
+enum {
+    A_NUM,
+    A_VAR,
+    A_COMMA,
+    A_ASSIGN,
+    A_COND,
+    A_OR,
+    A_AND,
+    A_BOR,
+    A_BXOR,
+    A_BAND,
+    A_EQ, A_NE,
+    A_LT, A_LE, A_GT, A_GE,
+    A_SHL, A_SHR,
+    A_ADD, A_SUB,
+    A_MUL, A_DIV, A_MOD,
+    A_POW,
+    A_NEG,
+    A_NOT,
+    A_BNOT,
+    A_PREINC, A_PREDEC,
+    A_POSTINC, A_POSTDEC,
+};
+
+struct arith {
+    int op;
+    int assign_op;          /* A_ASSIGN: operator of +=, -=, ..., or A_NUM */
+    long long num;
+    const char *name;       /* the variable of A_VAR, A_ASSIGN and ++ -- */
+    const char *key;        /* the subscript of name[subscript], or NULL */
+    struct arith *sub;      /* and that parsed, NULL if it is no expression */
+    struct arith *a, *b, *c;
+};
+
+typedef struct {
+    arena_t *arena;
+    const char *s;
+    size_t len;
+    size_t pos;
+    const char *err;
+} aparser_t;
+
+/* Binary operators, longer spellings first so they win */
+static const struct {
+    const char *text;
+    int op;
+    int prec;
+} binops[] = {
+    { "**", A_POW, 11 },
+    { "<<", A_SHL, 8 }, { ">>", A_SHR, 8 },
+    { "<=", A_LE, 7 }, { ">=", A_GE, 7 },
+    { "==", A_EQ, 6 }, { "!=", A_NE, 6 },
+    { "&&", A_AND, 2 }, { "||", A_OR, 1 },
+    { "*", A_MUL, 10 }, { "/", A_DIV, 10 }, { "%", A_MOD, 10 },
+    { "+", A_ADD, 9 }, { "-", A_SUB, 9 },
+    { "<", A_LT, 7 }, { ">", A_GT, 7 },
+    { "&", A_BAND, 5 }, { "^", A_BXOR, 4 }, { "|", A_BOR, 3 },
+    { NULL, 0, 0 },
+};
+
+/* Assignment operators, again longest first */
+static const struct {
+    const char *text;
+    int op;
+} assignops[] = {
+    { "<<=", A_SHL }, { ">>=", A_SHR },
+    { "+=", A_ADD }, { "-=", A_SUB }, { "*=", A_MUL }, { "/=", A_DIV },
+    { "%=", A_MOD }, { "&=", A_BAND }, { "^=", A_BXOR }, { "|=", A_BOR },
+    { "=", A_NUM },
+    { NULL, 0 },
+};
+
+static int depth = 0;
+
+/* Function Prototypes */
+static arith_t *new_arith(aparser_t *p, int op);
+static void skip_space(aparser_t *p);
+static bool accept(aparser_t *p, const char *text);
+static bool looking_at(aparser_t *p, const char *text);
+static const char *parse_name(aparser_t *p);
+static bool parse_ref(aparser_t *p, arith_t *e);
+static bool parse_number(const char *s, size_t len, long long *val);
+static arith_t *parse_comma(aparser_t *p);
+static arith_t *parse_assign(aparser_t *p);
+static arith_t *parse_cond(aparser_t *p);
+static arith_t *parse_binary(aparser_t *p, int min_prec);
+static arith_t *parse_unary(aparser_t *p);
+static arith_t *parse_primary(aparser_t *p);
+static bool eval(const arith_t *e, long long *v);
+static bool ref_key(const arith_t *e, char *buf, size_t size, const char **key);
+static bool get_var(const arith_t *e, const char *key, long long *v);
+static bool set_var(const arith_t *e, const char *key, long long v);
+static bool apply(int op, long long a, long long b, long long *v);
+
+static arith_t *
+new_arith(aparser_t *p, int op)
+{
+    arith_t *e = arena_zalloc(p->arena, sizeof(*e));
+
+    e->op = op;
+    return e;
+}
+
+static void
+skip_space(aparser_t *p)
+{
+    while (p->pos < p->len && isspace((unsigned char)p->s[p->pos]))
+        p->pos++;
+}
+
+static bool
+looking_at(aparser_t *p, const char *text)
+{
+    size_t n = strlen(text);
+
+    skip_space(p);
+    return p->pos + n <= p->len && !memcmp(p->s + p->pos, text, n);
+}
+
+static bool
+accept(aparser_t *p, const char *text)
+{
+    if (!looking_at(p, text))
+        return false;
+    p->pos += strlen(text);
+    return true;
+}
+
+/* A variable name at pos, copied into the arena, or NULL */
+static const char *
+parse_name(aparser_t *p)
+{
+    size_t start;
+
+    skip_space(p);
+    start = p->pos;
+    if (p->pos >= p->len || !(isalpha((unsigned char)p->s[p->pos]) || p->s[p->pos] == '_'))
+        return NULL;
+    while (p->pos < p->len && (isalnum((unsigned char)p->s[p->pos]) || p->s[p->pos] == '_'))
+        p->pos++;
+    return arena_strndup(p->arena, p->s + start, p->pos - start);
+}
+
+/*
+ * NAME or NAME[subscript] at pos into e. False if there is none, with
+ * p->err set if there was one but it was not right.
+ */
+static bool
+parse_ref(aparser_t *p, arith_t *e)
+{
+    aparser_t sub = { .arena = p->arena };
+    size_t start, end;
+    int depth = 0;
+
+    if (!(e->name = parse_name(p)))
+        return false;
+    if (p->pos >= p->len || p->s[p->pos] != '[')
+        return true;
+
+    start = p->pos + 1;
+    for (end = start; end < p->len; end++) {
+        if (p->s[end] == '[')
+            depth++;
+        else if (p->s[end] == ']' && depth-- == 0)
+            break;
+    }
+    if (end >= p->len) {
+        p->err = "`]' expected";
+        return false;
+    }
+    e->key = arena_strndup(p->arena, p->s + start, end - start);
+    p->pos = end + 1;
+
+    /* The key of an associative array need not be an expression */
+    sub.s = e->key;
+    sub.len = end - start;
+    e->sub = parse_comma(&sub);
+    skip_space(&sub);
+    if (sub.pos < sub.len)
+        e->sub = NULL;
+    return true;
+}
+
+/* Decimal, 0x hex, 0 octal or base#digits with bases up to 64 */
+static bool
+parse_number(const char *s, size_t len, long long *val)
+{
+    const char *end = s + len, *hash;
+    long long base = 10, v = 0;
+    int d;
+
+    while (s < end && isspace((unsigned char)*s))
+        s++;
+    while (end > s && isspace((unsigned char)end[-1]))
+        end--;
+    if (s == end)
+        return false;
+
+    if ((hash = memchr(s, '#', end - s))) {
+        base = 0;
+        for (; s < hash; s++) {
+            if (!isdigit((unsigned char)*s))
+                return false;
+            base = base * 10 + (*s - '0');
+        }
+        s++;
+        if (base < 2 || base > 64 || s == end)
+            return false;
+    } else if (end - s > 2 && s[0] == '0' && (s[1] == 'x' || s[1] == 'X')) {
+        base = 16;
+        s += 2;
+    } else if (end - s > 1 && s[0] == '0') {
+        base = 8;
+        s++;
+    }
+
+    for (; s < end; s++) {
+        if (isdigit((unsigned char)*s))
+            d = *s - '0';
+        else if (islower((unsigned char)*s))
+            d = *s - 'a' + 10;
+        else if (isupper((unsigned char)*s))
+            d = *s - 'A' + (base > 36 ? 36 : 10);
+        else if (*s == '@')
+            d = 62;
+        else if (*s == '_')
+            d = 63;
+        else
+            return false;
+        if (d >= base)
+            return false;
+        v = v * base + d;
+    }
+    *val = v;
+    return true;
+}
+
+/* expr (',' expr)* */
+static arith_t *
+parse_comma(aparser_t *p)
+{
+    arith_t *left, *e;
+
+    if (!(left = parse_assign(p)))
+        return NULL;
+    while (accept(p, ",")) {
+        e = new_arith(p, A_COMMA);
+        e->a = left;
+        if (!(e->b = parse_assign(p)))
+            return NULL;
+        left = e;
+    }
+    return left;
+}
+
+/* ref assign_op assign | cond */
+static arith_t *
+parse_assign(aparser_t *p)
+{
+    size_t start = p->pos;
+    arith_t *e = new_arith(p, A_ASSIGN);
+
+    if (parse_ref(p, e) && !looking_at(p, "==")) {
+        for (int i = 0; assignops[i].text; i++) {
+            if (accept(p, assignops[i].text)) {
+                e->assign_op = assignops[i].op;
+                return (e->a = parse_assign(p)) ? e : NULL;
+            }
+        }
+    }
+    if (p->err)
+        return NULL;
+    p->pos = start;
+    return parse_cond(p);
+}
+
+/* binary ['?' comma ':' cond] */
+static arith_t *
+parse_cond(aparser_t *p)
+{
+    arith_t *cond, *e;
+
+    if (!(cond = parse_binary(p, 1)))
+        return NULL;
+    if (!accept(p, "?"))
+        return cond;
+
+    e = new_arith(p, A_COND);
+    e->a = cond;
+    if (!(e->b = parse_comma(p)))
+        return NULL;
+    if (!accept(p, ":")) {
+        p->err = "`:' expected";
+        return NULL;
+    }
+    return (e->c = parse_cond(p)) ? e : NULL;
+}
+
+/* Precedence climbing, ** is the only right associative operator */
+static arith_t *
+parse_binary(aparser_t *p, int min_prec)
+{
+    arith_t *left, *e;
+    int i;
+
+    if (!(left = parse_unary(p)))
+        return NULL;
+
+    for (;;) {
+        for (i = 0; binops[i].text; i++)
+            if (looking_at(p, binops[i].text))
+                break;
+        if (!binops[i].text || binops[i].prec < min_prec)
+            return left;
+        /* "a & = b" style leftovers belong to an assignment, not to us */
+        if (p->pos + strlen(binops[i].text) < p->len &&
+            p->s[p->pos + strlen(binops[i].text)] == '=' &&
+            binops[i].op != A_EQ && binops[i].op != A_NE &&
+            binops[i].op != A_LE && binops[i].op != A_GE) {
+            p->err = "attempted assignment to non-variable";
+            return NULL;
+        }
+        p->pos += strlen(binops[i].text);
+
+        e = new_arith(p, binops[i].op);
+        e->a = left;
+        e->b = parse_binary(p, binops[i].op == A_POW ? binops[i].prec : binops[i].prec + 1);
+        if (!e->b)
+            return NULL;
+        left = e;
+    }
+}
+
+/* ('+' | '-' | '!' | '~' | '++' | '--') unary | primary ['++' | '--'] */
+static arith_t *
+parse_unary(aparser_t *p)
+{
+    arith_t *e;
+
+    if (accept(p, "++") || accept(p, "--")) {
+        e = new_arith(p, p->s[p->pos - 1] == '+' ? A_PREINC : A_PREDEC);
+        if (!parse_ref(p, e)) {
+            if (!p->err)
+                p->err = "variable expected after ++ or --";
+            return NULL;
+        }
+        return e;
+    }
+    if (accept(p, "-") || accept(p, "+") || accept(p, "!") || accept(p, "~")) {
+        char c = p->s[p->pos - 1];
+
+        if (c == '+')
+            return parse_unary(p);
+        e = new_arith(p, c == '-' ? A_NEG : c == '!' ? A_NOT : A_BNOT);
+        return (e->a = parse_unary(p)) ? e : NULL;
+    }
+
+    if (!(e = parse_primary(p)))
+        return NULL;
+    if (e->op == A_VAR && (looking_at(p, "++") || looking_at(p, "--"))) {
+        e->op = p->s[p->pos] == '+' ? A_POSTINC : A_POSTDEC;
+        p->pos += 2;
+    }
+    return e;
+}
+
+/* NUMBER | ref | '$' NAME | '$' DIGIT | '$((' comma '))' | '(' comma ')' */
+static arith_t *
+parse_primary(aparser_t *p)
+{
+    arith_t *e;
+    size_t start;
+
+    skip_space(p);
+    if (p->pos >= p->len) {
+        p->err = "operand expected";
+        return NULL;
+    }
+
+    /*
+     * $((e)) inside an expression is just (e). ${ } and $( ) are expanded
+     * before the text gets here, any left came from a value.
+     */
+    if (p->s[p->pos] == '$') {
+        p->pos++;
+        if (p->pos < p->len && (p->s[p->pos] == '{' || (p->s[p->pos] == '(' &&
+            (p->pos + 1 >= p->len || p->s[p->pos + 1] != '(')))) {
+            p->err = "bad substitution";
+            return NULL;
+        }
+        if (p->pos < p->len && (isdigit((unsigned char)p->s[p->pos]) ||
+            strchr("#?$!", p->s[p->pos]))) {
+            e = new_arith(p, A_VAR);
+            e->name = arena_strndup(p->arena, p->s + p->pos, 1);
+            p->pos++;
+            return e;
+        }
+        if (p->pos >= p->len || p->s[p->pos] != '(')
+            goto name;
+    }
+
+    if (accept(p, "(")) {
+        if (!(e = parse_comma(p)))
+            return NULL;
+        if (!accept(p, ")")) {
+            p->err = "`)' expected";
+            return NULL;
+        }
+        return e;
+    }
+
+    if (isdigit((unsigned char)p->s[p->pos])) {
+        start = p->pos;
+        while (p->pos < p->len && (isalnum((unsigned char)p->s[p->pos]) ||
+               strchr("#@_", p->s[p->pos])))
+            p->pos++;
+        e = new_arith(p, A_NUM);
+        if (!parse_number(p->s + start, p->pos - start, &e->num)) {
+            p->err = "invalid number";
+            return NULL;
+        }
+        return e;
+    }
+
+name:
+    e = new_arith(p, A_VAR);
+    if (!parse_ref(p, e)) {
+        if (!p->err)
+            p->err = "operand expected";
+        return NULL;
+    }
+    return e;
+}
+
+/*
+ * Parse src into a tree allocated from a. Returns NULL with *err set
+ * to a message when src is not a valid expression.
+ */
+arith_t *
+arith_parse(arena_t *a, const char *src, size_t len, const char **err)
+{
+    aparser_t p = { .arena = a, .s = src, .len = len };
+    arith_t *e;
+
+    skip_space(&p);
+    /* An empty expression is 0 */
+    if (p.pos == len)
+        return new_arith(&p, A_NUM);
+
+    e = parse_comma(&p);
+    skip_space(&p);
+    if (e && p.pos < len) {
+        p.err = "syntax error in expression";
+        e = NULL;
+    }
+    if (!e)
+        *err = p.err ? p.err : "syntax error in expression";
+    return e;
+}
+
+/*
+ * The key of the element e refers to into *key, the subscript itself for
+ * an associative array, NULL for no element.
+ */
+static bool
+ref_key(const arith_t *e, char *buf, size_t size, const char **key)
+{
+    long long i;
+
+    *key = e->key;
+    if (!e->key || !e->sub || (var_flags(e->name) & VAR_ASSOC))
+        return true;
+    if (!eval(e->sub, &i))
+        return false;
+    snprintf(buf, size, "%lld", i);
+    *key = buf;
+    return true;
+}
+
+/* Unset and empty variables are 0, others are numbers or expressions */
+static bool
+get_var(const arith_t *e, const char *key, long long *v)
+{
+    char num[32];
+    const char *name = e->name;
+    const char *val = key ? var_element(name, key) : param_value(name, num, sizeof(num));
+    bool ok;
+
+    if (!val || !*val) {
+        *v = 0;
+        return true;
+    }
+    if (parse_number(val, strlen(val), v))
+        return true;
+
+    if (depth >= MAX_ARITH_DEPTH) {
+        fprintf(stderr, "shush: %s: expression recursion level exceeded\n", name);
+        return false;
+    }
+    depth++;
+    ok = arith_eval_string(val, v);
+    depth--;
+    return ok;
+}
+
+static bool
+set_var(const arith_t *e, const char *key, long long v)
+{
+    char num[32];
+
+    snprintf(num, sizeof(num), "%lld", v);
+    if (key)
+        return var_set_element(e->name, key, num, strlen(num));
+    return var_set(e->name, num, 0);
+}
+
+static bool
+apply(int op, long long a, long long b, long long *v)
+{
+    switch (op) {
+    case A_NUM: *v = b; break;
+    case A_BOR: *v = a | b; break;
+    case A_BXOR: *v = a ^ b; break;
+    case A_BAND: *v = a & b; break;
+    case A_EQ: *v = a == b; break;
+    case A_NE: *v = a != b; break;
+    case A_LT: *v = a < b; break;
+    case A_LE: *v = a <= b; break;
+    case A_GT: *v = a > b; break;
+    case A_GE: *v = a >= b; break;
+    case A_SHL: *v = (unsigned long long)a << (b & 63); break;
+    case A_SHR: *v = a >> (b & 63); break;
+    case A_ADD: *v = (unsigned long long)a + b; break;
+    case A_SUB: *v = (unsigned long long)a - b; break;
+    case A_MUL: *v = (unsigned long long)a * b; break;
+    case A_DIV:
+    case A_MOD:
+        if (b == 0) {
+            fprintf(stderr, "shush: division by 0\n");
+            return false;
+        }
+        /* The one quotient that does not fit */
+        if (b == -1)
+            *v = op == A_DIV ? (long long)(0 - (unsigned long long)a) : 0;
+        else
+            *v = op == A_DIV ? a / b : a % b;
+        break;
+    case A_POW:
+        if (b < 0) {
+            fprintf(stderr, "shush: exponent less than 0\n");
+            return false;
+        }
+        for (*v = 1; b; b >>= 1, a = (unsigned long long)a * a)
+            if (b & 1)
+                *v = (unsigned long long)*v * a;
+        break;
+    }
+    return true;
+}
+
+static bool
+eval(const arith_t *e, long long *v)
+{
+    char buf[32];
+    const char *key;
+    long long a, b;
+
+    switch (e->op) {
+    case A_NUM:
+        *v = e->num;
+        return true;
+    case A_VAR:
+        return ref_key(e, buf, sizeof(buf), &key) && get_var(e, key, v);
+    case A_COMMA:
+        return eval(e->a, &a) && eval(e->b, v);
+    case A_ASSIGN:
+        if (!eval(e->a, &b) || !ref_key(e, buf, sizeof(buf), &key))
+            return false;
+        if (e->assign_op != A_NUM && !get_var(e, key, &a))
+            return false;
+        if (!apply(e->assign_op, a, b, v))
+            return false;
+        return set_var(e, key, *v);
+    case A_COND:
+        if (!eval(e->a, &a))
+            return false;
+        return eval(a ? e->b : e->c, v);
+    case A_OR:
+    case A_AND:
+        if (!eval(e->a, &a))
+            return false;
+        if ((e->op == A_OR) == (a != 0)) {
+            *v = e->op == A_OR;
+            return true;
+        }
+        if (!eval(e->b, &b))
+            return false;
+        *v = b != 0;
+        return true;
+    case A_NEG:
+        if (!eval(e->a, &a))
+            return false;
+        *v = 0 - (unsigned long long)a;
+        return true;
+    case A_NOT:
+        if (!eval(e->a, &a))
+            return false;
+        *v = !a;
+        return true;
+    case A_BNOT:
+        if (!eval(e->a, &a))
+            return false;
+        *v = ~a;
+        return true;
+    case A_PREINC:
+    case A_PREDEC:
+    case A_POSTINC:
+    case A_POSTDEC:
+        if (!ref_key(e, buf, sizeof(buf), &key) || !get_var(e, key, &a))
+            return false;
+        b = e->op == A_PREINC || e->op == A_POSTINC ? a + 1 : a - 1;
+        *v = e->op == A_PREINC || e->op == A_PREDEC ? b : a;
+        return set_var(e, key, b);
+    default:
+        return eval(e->a, &a) && eval(e->b, &b) && apply(e->op, a, b, v);
+    }
+}
+
+bool
+arith_eval(const arith_t *e, long long *result)
+{
+    return eval(e, result);
+}
+
+/* Parse and evaluate in one go, for let and for variables */
+bool
+arith_eval_string(const char *src, long long *result)
+{
+    arena_t arena = { 0 };
+    const char *err = NULL;
+    arith_t *e = arith_parse(&arena, src, strlen(src), &err);
+    bool ok = false;
+
+    if (!e)
+        fprintf(stderr, "shush: %s: %s\n", src, err);
+    else
+        ok = eval(e, result);
+    arena_free(&arena);
+    return ok;
+}
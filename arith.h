@@ -0,0 +1,22 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Arithmetic expressions for Simple Humane Shell (shush).
+ */
+
+#ifndef ARITH_H
+#define ARITH_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+typedef struct arith arith_t;
+
+arith_t *arith_parse(arena_t *a, const char *src, size_t len, const char **err);
+bool arith_eval(const arith_t *e, long long *result);
+bool arith_eval_string(const char *src, long long *result);
+
+#endif /* ARITH_H */
@@ -0,0 +1,71 @@
+#!/bin/sh
+#
+# MIT/X Consortium License
+# Copyright © 2024 Milán Atanáz Major
+#
+# Parameter expansion benchmark for Simple Humane Shell (shush).
+#
+# Runs string-munging loops under each shell and prints the time they
+# took. The ${ } operators stand in for basename, dirname, sed and tr, so
+# nothing forks, next to the same work done with forks for comparison.
+#
+#   paths    200000 runs of ${p##*/} ${p%/*} ${b%.*} ${b#*.} on a path
+#   replace  200000 runs of ${s//_/ } ${s/#the/a} ${s^^} ${s:4:5}
+#   forks    2000 runs of $(basename) and $(dirname) on the same path
+#
+# usage: bench/expand.sh [shell...]    (default: ./shush bash)
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/paths" <<'LOOP'
+p=/usr/local/share/doc/shush/README.md
+i=0
+while [ "$i" -lt 200000 ]; do
+  b=${p##*/}
+  d=${p%/*}
+  stem=${b%.*}
+  ext=${b#*.}
+  i=$((i + 1))
+done
+[ "$b $d $stem $ext" = "README.md /usr/local/share/doc/shush README md" ]
+LOOP
+
+cat > "$dir/replace" <<'LOOP'
+s=the_quick_brown_fox_jumps_over_the_lazy_dog
+i=0
+while [ "$i" -lt 200000 ]; do
+  a=${s//_/ }
+  b=${s/#the/a}
+  c=${s^^}
+  d=${s:4:5}
+  i=$((i + 1))
+done
+[ "$a" = "the quick brown fox jumps over the lazy dog" ] && [ "$d" = quick ]
+LOOP
+
+cat > "$dir/forks" <<'LOOP'
+p=/usr/local/share/doc/shush/README.md
+i=0
+while [ "$i" -lt 2000 ]; do
+  b=$(basename "$p")
+  d=$(dirname "$p")
+  i=$((i + 1))
+done
+[ "$b $d" = "README.md /usr/local/share/doc/shush" ]
+LOOP
+
+[ $# -eq 0 ] && set -- ./shush bash
+
+for shell; do
+	if ! command -v "$shell" > /dev/null 2>&1; then
+		printf '%-12s not found\n' "$shell"
+		continue
+	fi
+	for script in paths replace forks; do
+		start=$(date +%s%N)
+		"$shell" "$dir/$script" || printf '%s: exit status %d\n' "$shell" $?
+		end=$(date +%s%N)
+		printf '%-12s %-8s %6d ms\n' "$shell" "$script" $(( (end - start) / 1000000 ))
+	done
+done
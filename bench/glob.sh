@@ -0,0 +1,63 @@
+#!/bin/sh
+#
+# MIT/X Consortium License
+# Copyright © 2024 Milán Atanáz Major
+#
+# Pathname expansion benchmark for Simple Humane Shell (shush).
+#
+# Builds a tree of 50 x 50 directories with 200 files each, 50 .c and
+# 150 .h, 500000 in all. Then it times **/*.c, which matches 125000 of
+# them, under each shell, and under shush once more with GLOB_THREADS
+# set to the number of processors.
+#
+# usage: bench/glob.sh [shell...]    (default: ./shush bash)
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+echo "building the tree in $dir"
+(
+	cd "$dir" || exit 1
+	for a in $(seq 0 49); do
+		for b in $(seq 0 49); do
+			mkdir -p "d$a/e$b"
+			(cd "d$a/e$b" && seq -f 'f%g.c' 0 49 | xargs touch &&
+			 seq -f 'f%g.h' 0 149 | xargs touch)
+		done
+	done
+)
+
+[ $# -eq 0 ] && set -- ./shush bash
+threads=$(nproc 2> /dev/null || echo 4)
+
+# run label [env...] shell [option...]
+run() {
+	label=$1
+	shift
+	start=$(date +%s%N)
+	n=$(cd "$dir" && env "$@" -c 'count() { echo $#; }; count **/*.c') ||
+		printf '%s: exit status %d\n' "$label" $?
+	end=$(date +%s%N)
+	printf '%-20s %7s paths %6d ms\n' "$label" "$n" $(( (end - start) / 1000000 ))
+}
+
+for shell; do
+	if ! command -v "$shell" > /dev/null 2>&1; then
+		printf '%-20s not found\n' "$shell"
+		continue
+	fi
+	# The tree is the working directory while it runs
+	case $shell in
+	*/*) path=$(cd "${shell%/*}" && pwd)/${shell##*/} ;;
+	*) path=$shell ;;
+	esac
+	case $shell in
+	*bash)
+		run "$shell" "$path" -O globstar ;;
+	*shush)
+		run "$shell" "$path"
+		run "$shell x$threads" GLOB_THREADS="$threads" "$path" ;;
+	*)
+		run "$shell" "$path" ;;
+	esac
+done
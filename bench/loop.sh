@@ -0,0 +1,78 @@
+#!/bin/sh
+#
+# MIT/X Consortium License
+# Copyright © 2024 Milán Atanáz Major
+#
+# Loop benchmark for Simple Humane Shell (shush).
+#
+# Runs the same loop-heavy scripts under each shell and prints the time
+# they took. Only builtins run, so the time is the shell's own overhead.
+#
+#   nested   six nested for loops of ten words each, a million runs of
+#            a body with an if and a case
+#   counter  a while loop counting to a million with [ and $(( ))
+#   output   the six loops again with an echo as the body, into a file
+#
+# usage: bench/loop.sh [shell...]    (default: ./shush dash bash)
+
+dir=$(mktemp -d) || exit 1
+trap 'rm -rf "$dir"' EXIT
+
+cat > "$dir/nested" <<'LOOP'
+for a in 0 1 2 3 4 5 6 7 8 9; do
+  for b in 0 1 2 3 4 5 6 7 8 9; do
+    for c in 0 1 2 3 4 5 6 7 8 9; do
+      for e in 0 1 2 3 4 5 6 7 8 9; do
+        for f in 0 1 2 3 4 5 6 7 8 9; do
+          for g in 0 1 2 3 4 5 6 7 8 9; do
+            if true; then
+              case $g in
+                [0-4]) : ;;
+                *) : ;;
+              esac
+            fi
+          done
+        done
+      done
+    done
+  done
+done
+LOOP
+
+cat > "$dir/counter" <<'LOOP'
+: $((i = 0))
+while [ "$i" -lt 1000000 ]; do
+  : $((i += 1))
+done
+LOOP
+
+cat > "$dir/output" <<'LOOP'
+for a in 0 1 2 3 4 5 6 7 8 9; do
+  for b in 0 1 2 3 4 5 6 7 8 9; do
+    for c in 0 1 2 3 4 5 6 7 8 9; do
+      for e in 0 1 2 3 4 5 6 7 8 9; do
+        for f in 0 1 2 3 4 5 6 7 8 9; do
+          for g in 0 1 2 3 4 5 6 7 8 9; do
+            echo line $a$b$c$e$f$g
+          done
+        done
+      done
+    done
+  done
+done > "${0%/*}/out"
+LOOP
+
+[ $# -eq 0 ] && set -- ./shush dash bash
+
+for shell; do
+	if ! command -v "$shell" > /dev/null 2>&1; then
+		printf '%-12s not found\n' "$shell"
+		continue
+	fi
+	for script in nested counter output; do
+		start=$(date +%s%N)
+		"$shell" "$dir/$script" || printf '%s: exit status %d\n' "$shell" $?
+		end=$(date +%s%N)
+		printf '%-12s %-8s %6d ms\n' "$shell" "$script" $(( (end - start) / 1000000 ))
+	done
+done
@@ -0,0 +1,90 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Parser throughput benchmark for Simple Humane Shell (shush).
+ *
+ * Builds a synthetic script of the given size out of typical command
+ * lines and parses it into ASTs the way execute_buffer does, one
+ * command at a time with the arena reset in between.
+ *
+ * usage: parse [script-MiB] [rounds]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "arena.h"
+#include "parse.h"
+
+static const char *lines[] = {
+    "echo hello world\n",
+    "grep -v '^#' \"$HOME/.config/app.conf\" | sort | uniq -c | sort -rn\n",
+    "cd ~/src/project && make -j4 CFLAGS=\"-O2 -g\" || echo \"build failed: $?\"\n",
+    "printf '%s\\n' $PATH | tr : '\\n' | while_read_stub dir\n",
+    "export PATH=/usr/local/bin:$PATH; hash -r\n",
+    "# a comment line describing the next step\n",
+    "tar -czf /tmp/backup-$USER.tar.gz --exclude=\"*.o\" ~/work ; ls -l /tmp\n",
+    "awk '{ s += $3 } END { print s }' /var/log/app/*.log | tee -a summary.txt\n",
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t size = (argc > 1 ? strtoul(argv[1], NULL, 10) : 8) << 20;
+    int rounds = argc > 2 ? atoi(argv[2]) : 5;
+    size_t len = 0, nlines = sizeof(lines) / sizeof(lines[0]);
+    char *script = malloc(size + 256);
+    arena_t arena = { 0 };
+    long commands = 0;
+    double best = 0;
+
+    if (!script) {
+        perror("malloc");
+        return 1;
+    }
+    for (size_t i = 0; len < size; i++) {
+        size_t n = strlen(lines[i % nlines]);
+
+        memcpy(script + len, lines[i % nlines], n);
+        len += n;
+    }
+
+    for (int r = 0; r < rounds; r++) {
+        parser_t p;
+        double start = now(), elapsed;
+
+        commands = 0;
+        parser_init(&p, &arena, script, len, true);
+        while (parse_next(&p)) {
+            commands++;
+            arena_reset(&arena);
+        }
+        if (p.error) {
+            fprintf(stderr, "parse error at offset %zu\n", p.pos);
+            return 1;
+        }
+
+        elapsed = now() - start;
+        if (!best || elapsed < best)
+            best = elapsed;
+    }
+
+    printf("%.1f MiB, %ld commands: %.1f MiB/s, %.0f commands/s\n",
+           len / 1048576.0, commands, len / 1048576.0 / best, commands / best);
+
+    arena_free(&arena);
+    free(script);
+    return 0;
+}
@@ -0,0 +1,98 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Spawn microbenchmark for Simple Humane Shell (shush).
+ *
+ * Measures spawns per second of /bin/true with fork+execve (the old
+ * exec_external) and vfork+execve (spawn_external) while the process
+ * holds a heap of the given size, like a long-lived interactive shell.
+ *
+ * usage: spawn [heap-MiB] [iterations]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+static char *const child_argv[] = { "/bin/true", NULL };
+extern char **environ;
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+run(const char *name, pid_t (*spawn)(void), int iterations)
+{
+    double start = now(), elapsed;
+    int status;
+
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = spawn();
+
+        if (pid < 0) {
+            perror(name);
+            exit(1);
+        }
+        waitpid(pid, &status, 0);
+    }
+
+    elapsed = now() - start;
+    printf("%-12s %8.0f spawns/s\n", name, iterations / elapsed);
+    return elapsed;
+}
+
+static pid_t
+spawn_fork(void)
+{
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        execve(child_argv[0], child_argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+static pid_t
+spawn_vfork(void)
+{
+    pid_t pid = vfork();
+
+    if (pid == 0) {
+        execve(child_argv[0], child_argv, environ);
+        _exit(127);
+    }
+    return pid;
+}
+
+int
+main(int argc, char *argv[])
+{
+    size_t heap = (argc > 1 ? strtoul(argv[1], NULL, 10) : 256) << 20;
+    int iterations = argc > 2 ? atoi(argv[2]) : 2000;
+    char *mem = malloc(heap);
+
+    if (!mem) {
+        perror("malloc");
+        return 1;
+    }
+    /* Touch every page so it is mapped and must be copied by fork */
+    memset(mem, 1, heap);
+
+    printf("heap %zu MiB, %d iterations\n", heap >> 20, iterations);
+    run("fork+exec", spawn_fork, iterations);
+    run("vfork+exec", spawn_vfork, iterations);
+
+    free(mem);
+    return 0;
+}
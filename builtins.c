@@ -6,23 +6,32 @@
  */
 
 #include <ctype.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "arena.h"
+#include "arith.h"
 #include "builtins.h"
+#include "exec.h"
+#include "hash.h"
+#include "history.h"
 #include "init.h"
+#include "jobs.h"
+#include "out.h"
 #include "parse.h"
+#include "terminal.h"
+#include "var.h"
 
 /* Shell variables */
-#define MAX_HISTORY 100
 #define MAX_ALIASES 100
 #define MAX_ARGS 128
-
-/* History array and count */
-char *history[MAX_HISTORY];
-int history_count = 0;
+#define MAX_SOURCE_DEPTH 256
+#define MAPFILE_BLOCK 65536
 
 /* Alias storage */
 typedef struct {
@@ -33,8 +42,31 @@ typedef struct {
 static alias_t aliases[MAX_ALIASES];
 static int alias_count = 0;
 
+/*
+ * Parsed files kept by source. An entry is reused as long as the file
+ * has the same device, inode, size and times, so sourcing the same rc
+ * file or library again costs a stat instead of a read and a parse.
+ */
+typedef struct source_entry {
+    char *path;
+    dev_t dev;
+    ino_t ino;
+    off_t size;
+    struct timespec mtime;
+    struct timespec ctime;
+    arena_t arena;
+    node_t *script;     /* N_LIST of the file's commands */
+    unsigned hits;
+    int users;          /* nested sources running this entry */
+    bool stale;         /* replaced, free once users drops to 0 */
+    struct source_entry *next;
+} source_entry_t;
+
+static source_entry_t *source_cache = NULL;
+static unsigned source_hits = 0, source_misses = 0;
+static int source_depth = 0;
+
 /* Function declarations */
-void add_to_history(const char *command);
 bool is_builtin(const char *command);
 void run_builtin(char *args[]);
 void builtin_echo(char *args[]);
@@ -46,10 +78,20 @@ void builtin_pwd(char *args[]);
 void builtin_set(char *args[]);
 void builtin_unset(char *args[]);
 void builtin_export(char *args[]);
+void builtin_readonly(char *args[]);
+void builtin_declare(char *args[]);
+void builtin_mapfile(char *args[]);
 void builtin_kill(char *args[]);
 void builtin_alias(char *args[]);
 void builtin_unalias(char *args[]);
 void builtin_source(char *args[]);
+void builtin_hash(char *args[]);
+void builtin_true(char *args[]);
+void builtin_false(char *args[]);
+void builtin_break(char *args[]);
+void builtin_return(char *args[]);
+void builtin_let(char *args[]);
+void builtin_printf(char *args[]);
 
 const char *custom_strsignal(int sig) {
     static const char *signals[] = {
@@ -91,17 +133,6 @@ const char *custom_strsignal(int sig) {
     return "Unknown signal";
 }
 
-/* Add a command to history */
-void add_to_history(const char *command) {
-    if (history_count < MAX_HISTORY) {
-        history[history_count++] = strdup(command);
-    } else {
-        free(history[0]);
-        memmove(history, history + 1, (MAX_HISTORY - 1) * sizeof(char *));
-        history[MAX_HISTORY - 1] = strdup(command);
-    }
-}
-
 /* Check if a command is a built-in */
 bool is_builtin(const char *command) {
     for (int i = 0; command_table[i].name; i++) {
@@ -137,12 +168,12 @@ void builtin_echo(char *args[]) {
         } else if (!strcmp(args[i], "-E")) {
             interpret_escapes = 0;
         } else if (!strcmp(args[i], "--help")) {
-            printf("echo: echo [-neE] [string ...]\n");
-            printf("    Write arguments to the standard output.\n\n");
-            printf("    Options:\n");
-            printf("      -n    do not output the trailing newline\n");
-            printf("      -e    enable interpretation of backslash escapes\n");
-            printf("      -E    disable interpretation of backslash escapes (default)\n");
+            out_str("echo: echo [-neE] [string ...]\n");
+            out_str("    Write arguments to the standard output.\n\n");
+            out_str("    Options:\n");
+            out_str("      -n    do not output the trailing newline\n");
+            out_str("      -e    enable interpretation of backslash escapes\n");
+            out_str("      -E    disable interpretation of backslash escapes (default)\n");
             last_exit_status = 0;
             return;
         } else {
@@ -154,37 +185,33 @@ void builtin_echo(char *args[]) {
     }
 
     for (; args[i]; i++) {
-        char *expanded_arg = expand_variables(args[i]);
-
         if (interpret_escapes) {
-            for (char *p = expanded_arg; *p; p++) {
+            for (char *p = args[i]; *p; p++) {
                 if (*p == '\\') {
                     switch (*(++p)) {
-                        case 'n': putchar('\n'); break;
-                        case 't': putchar('\t'); break;
-                        case 'r': putchar('\r'); break;
-                        case 'b': putchar('\b'); break;
-                        case '\\': putchar('\\'); break;
-                        case '\"': putchar('\"'); break;
-                        case '\'': putchar('\''); break;
-                        default: putchar('\\'); putchar(*p); break;
+                        case 'n': out_char('\n'); break;
+                        case 't': out_char('\t'); break;
+                        case 'r': out_char('\r'); break;
+                        case 'b': out_char('\b'); break;
+                        case '\\': out_char('\\'); break;
+                        case '\"': out_char('\"'); break;
+                        case '\'': out_char('\''); break;
+                        default: out_char('\\'); out_char(*p); break;
                     }
                 } else {
-                    putchar(*p);
+                    out_char(*p);
                 }
             }
         } else {
-            fputs(expanded_arg, stdout);
+            out_str(args[i]);
         }
 
-        free(expanded_arg);
-
         if (args[i + 1])
-            putchar(' ');
+            out_char(' ');
     }
 
     if (newline)
-        putchar('\n');
+        out_char('\n');
 
     last_exit_status = 0;
 }
@@ -193,16 +220,11 @@ void builtin_echo(char *args[]) {
 void builtin_history(char *args[]) {
     if (args[1]) {
         if (!strcmp(args[1], "-c")) {
-            for (int i = 0; i < history_count; i++)
-                free(history[i]);
-            history_count = 0;
+            history_clear();
             last_exit_status = 0;
         } else if (!strcmp(args[1], "-d") && args[2]) {
-            int index = atoi(args[2]) - 1;
-            if (index >= 0 && index < history_count) {
-                free(history[index]);
-                memmove(&history[index], &history[index + 1], (history_count - index - 1) * sizeof(char *));
-                history_count--;
+            long index = atol(args[2]) - 1;
+            if (index >= 0 && history_delete(index)) {
                 last_exit_status = 0;
             } else {
                 fprintf(stderr, "history: %s: history position out of range\n", args[2]);
@@ -213,15 +235,17 @@ void builtin_history(char *args[]) {
             last_exit_status = 1;
         }
     } else {
-        for (int i = 0; i < history_count; i++)
-            printf("%d %s\n", i + 1, history[i]);
+        size_t count = history_count();
+        for (size_t i = 0; i < count; i++)
+            out_printf("%zu %s\n", i + 1, history_entry(i, NULL));
+        last_exit_status = 0;
     }
 }
 
 /* Built-in cd command */
 void builtin_cd(char *args[]) {
     char cwd[1024];
-    char *target_dir = args[1] ? (strcmp(args[1], "-") == 0 ? getenv("OLDPWD") : args[1]) : home_directory;
+    const char *target_dir = args[1] ? (strcmp(args[1], "-") == 0 ? var_get("OLDPWD") : args[1]) : home_directory;
 
     if (!target_dir) {
         fprintf(stderr, "shush: cd: OLDPWD not set\n");
@@ -242,14 +266,16 @@ void builtin_cd(char *args[]) {
         return;
     }
 
-    setenv("OLDPWD", getenv("PWD"), 1);
-    setenv("PWD", pwd, 1);
+    if (var_get("PWD"))
+        var_set("OLDPWD", var_get("PWD"), 0);
+    var_set("PWD", pwd, 0);
+    prompt_invalidate();
     last_exit_status = 0;
 }
 
 /* Built-in ver command */
 void builtin_ver(char *args[]) {
-    printf("shush version 1.0\n");
+    out_str("shush version 1.0\n");
     last_exit_status = 0;
 }
 
@@ -273,15 +299,15 @@ void builtin_pwd(char *args[]) {
     if (logical) {
         char cwd[1024];
         if (getcwd(cwd, sizeof(cwd)))
-            printf("%s\n", cwd);
+            out_printf("%s\n", cwd);
         else {
             perror("pwd");
             last_exit_status = 1;
         }
     } else {
-        char *pwd = getenv("PWD");
+        const char *pwd = var_get("PWD");
         if (pwd)
-            printf("%s\n", pwd);
+            out_printf("%s\n", pwd);
         else {
             perror("pwd");
             last_exit_status = 1;
@@ -295,53 +321,223 @@ void builtin_set(char *args[]) {
         fprintf(stderr, "set: Invalid usage\n");
         last_exit_status = 1;
     } else {
-        extern char **environ;
-        for (char **env = environ; *env; ++env)
-            printf("%s\n", *env);
+        var_print(0, "");
         last_exit_status = 0;
     }
 }
 
 /* Built-in unset command */
 void builtin_unset(char *args[]) {
-    for (int i = 1; args[i]; i++) {
-        if (unsetenv(args[i])) {
-            fprintf(stderr, "unset: %s: cannot unset\n", args[i]);
+    int i = 1;
+    bool functions = false;
+
+    last_exit_status = 0;
+    if (args[1] && (!strcmp(args[1], "-f") || !strcmp(args[1], "-v"))) {
+        functions = args[1][1] == 'f';
+        i++;
+    }
+    for (; args[i]; i++) {
+        char *open = strchr(args[i], '[');
+        size_t len = strlen(args[i]);
+
+        if (functions) {
+            unset_function(args[i]);
+            continue;
+        }
+        /* name[key] unsets one element of an array */
+        if (open && args[i][len - 1] == ']') {
+            *open = '\0';
+            args[i][len - 1] = '\0';
+            if (!var_unset_element(args[i], open + 1))
+                last_exit_status = 1;
+        } else if (!var_unset(args[i])) {
+            last_exit_status = 1;
+        }
+    }
+}
+
+/*
+ * Give each name[=value] in args the flags. The words of a name=( )
+ * are assigned before the name is made read-only.
+ */
+static void set_names(char *args[], int flags, const char *who) {
+    for (int i = 0; args[i]; i++) {
+        char *equal_sign = strchr(args[i], '=');
+        if (equal_sign)
+            *equal_sign = '\0';
+        if (!var_valid_name(args[i], strlen(args[i]))) {
+            fprintf(stderr, "%s: `%s': not a valid identifier\n", who, args[i]);
+            last_exit_status = 1;
+        } else if (!var_set(args[i], equal_sign ? equal_sign + 1 : NULL, flags & ~VAR_READONLY) ||
+                   !assign_array(args[i]) || !var_set(args[i], NULL, flags)) {
             last_exit_status = 1;
         }
     }
+}
+
+/* Give each name[=value] the flag, or list those that have it */
+static void set_flag(char *args[], int flag, const char *who, const char *list) {
+    int i = 1;
+
     last_exit_status = 0;
+    if (args[1] && !strcmp(args[1], "-p"))
+        i++;
+    if (!args[i]) {
+        var_print(flag, list);
+        return;
+    }
+    set_names(args + i, flag, who);
 }
 
 /* Built-in export command */
 void builtin_export(char *args[]) {
-    if (!args[1]) {
-        extern char **environ;
-        for (char **env = environ; *env; ++env)
-            printf("declare -x %s\n", *env);
-        last_exit_status = 0;
+    set_flag(args, VAR_EXPORT, "export", "declare -x ");
+}
+
+/* Built-in readonly command */
+void builtin_readonly(char *args[]) {
+    set_flag(args, VAR_READONLY, "readonly", "declare -r ");
+}
+
+/*
+ * Built-in declare command: -a and -A make indexed and associative
+ * arrays, -x and -r export and make read-only. -p prints the names,
+ * and without names it lists the variables that have the flags.
+ */
+void builtin_declare(char *args[]) {
+    bool print = false;
+    int i, flags = 0;
+
+    last_exit_status = 0;
+    for (i = 1; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        for (const char *o = args[i] + 1; *o; o++) {
+            switch (*o) {
+            case 'a': flags |= VAR_ARRAY; break;
+            case 'A': flags |= VAR_ASSOC; break;
+            case 'x': flags |= VAR_EXPORT; break;
+            case 'r': flags |= VAR_READONLY; break;
+            case 'p': print = true; break;
+            default:
+                fprintf(stderr, "declare: -%c: invalid option\n", *o);
+                last_exit_status = 2;
+                return;
+            }
+        }
+    }
+    if (!args[i]) {
+        var_print(flags, NULL);
+        return;
+    }
+    if (!print) {
+        set_names(args + i, flags, "declare");
         return;
     }
+    for (; args[i]; i++) {
+        if (!var_print_name(args[i])) {
+            fprintf(stderr, "declare: %s: not found\n", args[i]);
+            last_exit_status = 1;
+        }
+    }
+}
 
-    for (int i = 1; args[i]; i++) {
-        char *equal_sign = strchr(args[i], '=');
-        if (equal_sign) {
-            *equal_sign = '\0';
-            if (setenv(args[i], equal_sign + 1, 1)) {
-                perror("export");
-                last_exit_status = 1;
-            }
+/* One line for mapfile, unless it is still skipping them */
+static void mapfile_line(const char *name, const char *s, size_t len, long *skip, long *lines) {
+    if (*skip > 0) {
+        (*skip)--;
+        return;
+    }
+    var_set_element(name, NULL, s, len);
+    (*lines)++;
+}
+
+/* Keep the start of a line that goes on in the next block */
+static void mapfile_carry(char **carry, size_t *len, size_t *size, const char *s, size_t n) {
+    if (*len + n > *size) {
+        *size = (*len + n) * 2;
+        if (!(*carry = realloc(*carry, *size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(*carry + *len, s, n);
+    *len += n;
+}
+
+/*
+ * Built-in mapfile command, also readarray: the lines of standard input
+ * into an indexed array, MAPFILE unless one is named. The input is read
+ * a block at a time and cut at each delimiter, where a while read loop
+ * would take a read per line. -t drops the delimiters, -n stops after
+ * count lines, -s skips lines first, -d sets the delimiter and -u reads
+ * another descriptor.
+ */
+void builtin_mapfile(char *args[]) {
+    static char *buf = NULL;
+    const char *name = "MAPFILE";
+    char delim = '\n', *carry = NULL, *p, *nl, *end;
+    size_t carry_len = 0, carry_size = 0, len;
+    long count = 0, skip = 0, lines = 0;
+    bool strip = false;
+    int fd = STDIN_FILENO, i;
+    ssize_t n = 0;
+
+    last_exit_status = 1;
+    for (i = 1; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (!strcmp(args[i], "-t")) {
+            strip = true;
+        } else if (args[i + 1] && !strcmp(args[i], "-n")) {
+            count = atol(args[++i]);
+        } else if (args[i + 1] && !strcmp(args[i], "-s")) {
+            skip = atol(args[++i]);
+        } else if (args[i + 1] && !strcmp(args[i], "-u")) {
+            fd = atoi(args[++i]);
+        } else if (args[i + 1] && !strcmp(args[i], "-d")) {
+            delim = args[++i][0];
         } else {
-            const char *env_val = getenv(args[i]);
-            if (env_val) {
-                printf("declare -x %s=\"%s\"\n", args[i], env_val);
-            } else if (setenv(args[i], "", 1)) {
-                perror("export");
-                last_exit_status = 1;
+            fprintf(stderr, "%s: invalid option -- '%s'\n", args[0], args[i]);
+            return;
+        }
+    }
+    if (args[i])
+        name = args[i];
+    if (!var_valid_name(name, strlen(name))) {
+        fprintf(stderr, "%s: `%s': not a valid identifier\n", args[0], name);
+        return;
+    }
+    if (!var_clear(name, VAR_ARRAY))
+        return;
+    if (!buf && !(buf = malloc(MAPFILE_BLOCK))) {
+        perror("malloc");
+        exit(1);
+    }
+
+    while ((!count || lines < count) && (n = read(fd, buf, MAPFILE_BLOCK)) > 0) {
+        for (p = buf, end = buf + n; p < end && (!count || lines < count); p = nl + 1) {
+            /* The end of a block waits for the rest of its line */
+            if (!(nl = memchr(p, delim, end - p))) {
+                mapfile_carry(&carry, &carry_len, &carry_size, p, end - p);
+                p = end;
+                break;
+            }
+            len = nl - p + !strip;
+            if (carry_len) {
+                mapfile_carry(&carry, &carry_len, &carry_size, p, len);
+                mapfile_line(name, carry, carry_len, &skip, &lines);
+                carry_len = 0;
+            } else {
+                mapfile_line(name, p, len, &skip, &lines);
             }
         }
+        /* What was read past the last line wanted is left for the next reader */
+        if (count && lines >= count && p < end)
+            lseek(fd, p - end, SEEK_CUR);
     }
-    last_exit_status = 0;
+    if (n < 0)
+        perror(args[0]);
+    if (carry_len && (!count || lines < count))
+        mapfile_line(name, carry, carry_len, &skip, &lines);
+    free(carry);
+    last_exit_status = n < 0;
 }
 
 /* Built-in kill command */
@@ -350,8 +546,8 @@ void builtin_kill(char *args[]) {
 
     if (args[1] && !strcmp(args[1], "-l")) {
         for (int i = 1; i < NSIG; i++)
-            printf("%s ", custom_strsignal(i));
-        printf("\n");
+            out_printf("%s ", custom_strsignal(i));
+        out_char('\n');
         last_exit_status = 0;
         return;
     }
@@ -368,7 +564,9 @@ void builtin_kill(char *args[]) {
     }
 
     for (int i = arg_index; args[i]; i++) {
-        pid_t pid = atoi(args[i]);
+        pid_t pid = args[i][0] == '%' ? job_target(args[i]) : atoi(args[i]);
+        if (!pid)
+            continue;
         if (kill(pid, signal)) {
             perror("kill");
             last_exit_status = 1;
@@ -382,7 +580,7 @@ void builtin_kill(char *args[]) {
 void builtin_alias(char *args[]) {
     if (!args[1]) {
         for (int i = 0; i < alias_count; i++)
-            printf("alias %s='%s'\n", aliases[i].name, aliases[i].value);
+            out_printf("alias %s='%s'\n", aliases[i].name, aliases[i].value);
         last_exit_status = 0;
         return;
     }
@@ -404,7 +602,7 @@ void builtin_alias(char *args[]) {
         } else {
             for (int j = 0; j < alias_count; j++) {
                 if (!strcmp(aliases[j].name, args[i])) {
-                    printf("alias %s='%s'\n", aliases[j].name, aliases[j].value);
+                    out_printf("alias %s='%s'\n", aliases[j].name, aliases[j].value);
                 }
             }
         }
@@ -414,6 +612,12 @@ void builtin_alias(char *args[]) {
     last_exit_status = 0;
 }
 
+/* Call visit with the name of every alias */
+void for_each_alias(void (*visit)(const char *name)) {
+    for (int i = 0; i < alias_count; i++)
+        visit(aliases[i].name);
+}
+
 /* Built-in unalias command */
 void builtin_unalias(char *args[]) {
     if (!args[1]) {
@@ -437,28 +641,454 @@ void builtin_unalias(char *args[]) {
     last_exit_status = 0;
 }
 
+/* Parse a whole file into e->script, false on a syntax error */
+static bool source_parse(source_entry_t *e, const char *buf, size_t len) {
+    parser_t p;
+    node_t *n, **tail;
+
+    e->script = arena_zalloc(&e->arena, sizeof(node_t));
+    e->script->type = N_LIST;
+    e->script->arena = &e->arena;
+    tail = &e->script->body;
+
+    parser_init(&p, &e->arena, buf, len, true);
+    while ((n = parse_next(&p))) {
+        *tail = n;
+        tail = &n->next;
+        e->script->n++;
+    }
+    return !p.error;
+}
+
+/* Times compare to the nanosecond, a file rewritten within a second is a new one */
+static bool same_time(const struct timespec *a, const struct timespec *b) {
+    return a->tv_sec == b->tv_sec && a->tv_nsec == b->tv_nsec;
+}
+
+/* Read and parse a file, regular files are mapped instead of read */
+static bool source_load(source_entry_t *e, int fd, const struct stat *st) {
+    char *buf = NULL;
+    size_t len = 0, size = 0;
+    bool ok;
+
+    if (S_ISREG(st->st_mode) && st->st_size > 0) {
+        buf = mmap(NULL, st->st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (buf != MAP_FAILED) {
+            ok = source_parse(e, buf, st->st_size);
+            munmap(buf, st->st_size);
+            return ok;
+        }
+        buf = NULL;
+    }
+
+    for (;;) {
+        if (len == size) {
+            size = size ? size * 2 : 65536;
+            if (!(buf = realloc(buf, size))) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        ssize_t n = read(fd, buf + len, size - len);
+        if (n <= 0)
+            break;
+        len += n;
+    }
+    ok = source_parse(e, buf ? buf : "", len);
+    free(buf);
+    return ok;
+}
+
+static void source_free(source_entry_t *e) {
+    arena_free(&e->arena);
+    free(e->path);
+    free(e);
+}
+
+static void source_stats(void) {
+    unsigned count = 0;
+
+    for (source_entry_t *e = source_cache; e; e = e->next)
+        count++;
+    out_printf("source cache: %u files, %u hits, %u misses\n", count, source_hits, source_misses);
+    if (count)
+        out_str("hits\tpath\n");
+    for (source_entry_t *e = source_cache; e; e = e->next)
+        out_printf("%4u\t%s\n", e->hits, e->path);
+}
+
 /* Built-in source command */
 void builtin_source(char *args[]) {
+    source_entry_t *e, **pp;
+    struct stat st;
+    bool ok = true;
+    int fd;
+
+    if (!args[1]) {
+        fprintf(stderr, "Usage: source <file>\n");
+        last_exit_status = 1;
+        return;
+    }
+    if (!strcmp(args[1], "--stats")) {
+        source_stats();
+        last_exit_status = 0;
+        return;
+    }
+
+    if (source_depth >= MAX_SOURCE_DEPTH) {
+        fprintf(stderr, "source: %s: maximum nesting level exceeded\n", args[1]);
+        last_exit_status = 1;
+        return;
+    }
+
+    fd = open(args[1], O_RDONLY | O_CLOEXEC);
+    if (fd < 0 || fstat(fd, &st) < 0) {
+        perror("source");
+        if (fd >= 0)
+            close(fd);
+        last_exit_status = 1;
+        return;
+    }
+
+    for (e = source_cache; e; e = e->next)
+        if (!e->stale && e->dev == st.st_dev && e->ino == st.st_ino)
+            break;
+
+    if (e && e->size == st.st_size && same_time(&e->mtime, &st.st_mtim) &&
+        same_time(&e->ctime, &st.st_ctim)) {
+        e->hits++;
+        source_hits++;
+    } else {
+        /* A running copy of the old version stays alive until it is done */
+        if (e)
+            e->stale = true;
+
+        source_misses++;
+        e = calloc(1, sizeof(*e));
+        if (!e || !(e->path = strdup(args[1]))) {
+            perror("calloc");
+            exit(1);
+        }
+        e->dev = st.st_dev;
+        e->ino = st.st_ino;
+        e->size = st.st_size;
+        e->mtime = st.st_mtim;
+        e->ctime = st.st_ctim;
+
+        ok = source_load(e, fd, &st);
+        e->next = source_cache;
+        source_cache = e;
+    }
+    close(fd);
+
+    /* Whatever parsed before a syntax error still runs, like line by line */
+    e->users++;
+    source_depth++;
+    execute(e->script);
+    source_depth--;
+    returning = false;
+    e->users--;
+
+    if (!ok) {
+        e->stale = true;
+        last_exit_status = 2;
+    }
+
+    for (pp = &source_cache; *pp;) {
+        if ((*pp)->stale && !(*pp)->users) {
+            source_entry_t *dead = *pp;
+            *pp = dead->next;
+            source_free(dead);
+        } else {
+            pp = &(*pp)->next;
+        }
+    }
+}
+
+/* Built-in hash command */
+void builtin_hash(char *args[]) {
+    last_exit_status = 0;
+
+    if (!args[1]) {
+        hash_print();
+        return;
+    }
+
+    if (!strcmp(args[1], "-r")) {
+        hash_clear();
+    } else if (!strcmp(args[1], "-p")) {
+        if (!args[2] || !args[3]) {
+            fprintf(stderr, "hash: usage: hash -p pathname name\n");
+            last_exit_status = 1;
+            return;
+        }
+        hash_add(args[3], args[2]);
+    } else if (!strcmp(args[1], "-d")) {
+        for (int i = 2; args[i]; i++)
+            hash_remove(args[i]);
+    } else if (args[1][0] == '-') {
+        fprintf(stderr, "hash: invalid option -- '%s'\n", args[1]);
+        last_exit_status = 1;
+    } else {
+        for (int i = 1; args[i]; i++) {
+            if (is_builtin(args[i]))
+                continue;
+            hash_remove(args[i]);
+            if (!hash_lookup(args[i])) {
+                fprintf(stderr, "hash: %s: not found\n", args[i]);
+                last_exit_status = 1;
+            }
+        }
+    }
+}
+
+/* Built-in true and : commands */
+void builtin_true(char *args[]) {
+    last_exit_status = 0;
+}
+
+/* Built-in false command */
+void builtin_false(char *args[]) {
+    last_exit_status = 1;
+}
+
+/* Built-in break and continue commands */
+void builtin_break(char *args[]) {
+    long levels = 1;
+    char *endptr;
+
+    last_exit_status = 0;
+    if (!loop_depth) {
+        fprintf(stderr, "%s: only meaningful in a loop\n", args[0]);
+        return;
+    }
     if (args[1]) {
-        FILE *file = fopen(args[1], "r");
-        if (!file) {
-            perror("source");
+        levels = strtol(args[1], &endptr, 10);
+        if (*endptr || levels < 1) {
+            fprintf(stderr, "%s: %s: loop count out of range\n", args[0], args[1]);
             last_exit_status = 1;
             return;
         }
+    }
+    /* Naming more loops than are running leaves all of them */
+    if (levels > loop_depth)
+        levels = loop_depth;
+    if (args[0][0] == 'b')
+        breaking = levels;
+    else
+        continuing = levels;
+}
 
-        char line[1024];
-        while (fgets(line, sizeof(line), file)) {
-            line[strcspn(line, "\n")] = '\0';
-            parse_and_execute(line);
+/* Built-in return command */
+void builtin_return(char *args[]) {
+    char *endptr;
+
+    if (!function_depth && !source_depth) {
+        fprintf(stderr, "return: can only return from a function or sourced script\n");
+        last_exit_status = 1;
+        return;
+    }
+    if (args[1]) {
+        long status = strtol(args[1], &endptr, 10);
+
+        if (*endptr) {
+            fprintf(stderr, "return: %s: numeric argument required\n", args[1]);
+            status = 2;
         }
+        last_exit_status = status & 0xff;
+    }
+    returning = true;
+}
 
-        fclose(file);
-        last_exit_status = 0;
-    } else {
-        fprintf(stderr, "Usage: source <file>\n");
+/* Built-in let command */
+void builtin_let(char *args[]) {
+    long long value = 0;
+
+    if (!args[1]) {
+        fprintf(stderr, "let: expression expected\n");
         last_exit_status = 1;
+        return;
+    }
+    for (int i = 1; args[i]; i++) {
+        if (!arith_eval_string(args[i], &value)) {
+            last_exit_status = 1;
+            return;
+        }
+    }
+    last_exit_status = value == 0;
+}
+
+/* Print the escape at s, just past a backslash. Returns its length, or -1 for \c in %b */
+static int printf_escape(const char *s, bool in_arg) {
+    static const char codes[] = "a\ab\be\033f\fn\nr\rt\tv\v\\\\\"\"''";
+    int value = 0, n = 0;
+
+    if (*s == 'c' && in_arg)
+        return -1;
+    for (int i = 0; codes[i]; i += 2) {
+        if (*s == codes[i]) {
+            out_char(codes[i + 1]);
+            return 1;
+        }
+    }
+    if (*s >= '0' && *s <= '7') {
+        /* %b arguments write octal as \0nnn, formats as \nnn */
+        if (in_arg && *s == '0')
+            n++;
+        while (n < 3 + (in_arg && *s == '0') && s[n] >= '0' && s[n] <= '7')
+            value = value * 8 + s[n++] - '0';
+        out_char(value);
+        return n;
+    }
+    out_char('\\');
+    return 0;
+}
+
+/* A numeric argument of printf, 'c gives the code of c */
+static long long printf_number(const char *s) {
+    char *end;
+    long long value;
+
+    if (*s == '\'' || *s == '"')
+        return (unsigned char)s[1];
+    value = strtoll(s, &end, 0);
+    if (end == s || *end) {
+        fprintf(stderr, "printf: %s: invalid number\n", s);
+        last_exit_status = 1;
+    }
+    return value;
+}
+
+/*
+ * Print format once, taking arguments from *argp as conversions need
+ * them. Missing arguments are empty strings or 0. False after \c.
+ */
+static bool printf_once(const char *format, char ***argp) {
+    char spec[64], *arg;
+    const char *f, *start;
+    size_t n;
+    int len;
+
+    for (f = format; *f; f++) {
+        if (*f == '\\') {
+            if ((len = printf_escape(f + 1, false)) < 0)
+                return false;
+            f += len;
+            continue;
+        }
+        if (*f != '%') {
+            out_char(*f);
+            continue;
+        }
+        if (f[1] == '%') {
+            out_char('%');
+            f++;
+            continue;
+        }
+
+        /* Copy flags, width and precision, taking * from the arguments */
+        start = f++;
+        n = 0;
+        spec[n++] = '%';
+        while (*f && strchr("-+ #0123456789.*", *f) && n < sizeof(spec) - 24) {
+            if (*f == '*') {
+                arg = **argp ? *(*argp)++ : "0";
+                n += snprintf(spec + n, sizeof(spec) - n, "%d", (int)printf_number(arg));
+            } else {
+                spec[n++] = *f;
+            }
+            f++;
+        }
+        arg = **argp ? *(*argp)++ : NULL;
+
+        switch (*f) {
+            case 'd':
+            case 'i':
+            case 'o':
+            case 'u':
+            case 'x':
+            case 'X':
+                spec[n++] = 'l';
+                spec[n++] = 'l';
+                spec[n++] = *f;
+                spec[n] = '\0';
+                out_printf(spec, arg ? printf_number(arg) : 0LL);
+                break;
+            case 'e':
+            case 'E':
+            case 'f':
+            case 'F':
+            case 'g':
+            case 'G':
+                spec[n++] = *f;
+                spec[n] = '\0';
+                out_printf(spec, arg ? strtod(arg, NULL) : 0.0);
+                break;
+            case 'c':
+                spec[n++] = 'c';
+                spec[n] = '\0';
+                out_printf(spec, arg && *arg ? *arg : '\0');
+                break;
+            case 's':
+                spec[n++] = 's';
+                spec[n] = '\0';
+                out_printf(spec, arg ? arg : "");
+                break;
+            case 'b':
+                for (const char *a = arg ? arg : ""; *a; a++) {
+                    if (*a != '\\') {
+                        out_char(*a);
+                    } else if ((len = printf_escape(a + 1, true)) < 0) {
+                        return false;
+                    } else {
+                        a += len;
+                    }
+                }
+                break;
+            default:
+                fprintf(stderr, "printf: %.*s: invalid format\n", (int)(f - start + (*f != '\0')), start);
+                last_exit_status = 1;
+                return false;
+        }
     }
+    return true;
+}
+
+/* Built-in printf command */
+void builtin_printf(char *args[]) {
+    char **arg;
+
+    if (!args[1]) {
+        fprintf(stderr, "printf: usage: printf format [arguments]\n");
+        last_exit_status = 2;
+        return;
+    }
+
+    /* The format is reused while arguments are left over */
+    last_exit_status = 0;
+    arg = args + 2;
+    for (;;) {
+        char **before = arg;
+
+        if (!printf_once(args[1], &arg) || !*arg || arg == before)
+            break;
+    }
+}
+
+/*
+ * Built-ins that only write output and leave the shell as it was, so a
+ * command substitution may run them without a subshell.
+ */
+bool is_pure_builtin(const char *command) {
+    static const char *const pure[] = {
+        "echo", "printf", "pwd", "true", "false", ":", "test", "[", "[[", NULL
+    };
+
+    for (int i = 0; pure[i]; i++) {
+        if (!strcmp(command, pure[i]))
+            return true;
+    }
+    return false;
 }
 
 /* Command table */
@@ -473,8 +1103,29 @@ const builtin_command_t command_table[] = {
     {"unset", builtin_unset},
     {"export", builtin_export},
     {"kill", builtin_kill},
+    {"readonly", builtin_readonly},
+    {"declare", builtin_declare},
+    {"mapfile", builtin_mapfile},
+    {"readarray", builtin_mapfile},
     {"alias", builtin_alias},
     {"unalias", builtin_unalias},
     {"source", builtin_source},
+    {"hash", builtin_hash},
+    {":", builtin_true},
+    {"true", builtin_true},
+    {"false", builtin_false},
+    {"break", builtin_break},
+    {"continue", builtin_break},
+    {"return", builtin_return},
+    {"test", builtin_test},
+    {"[", builtin_test},
+    {"[[", builtin_cond},
+    {"let", builtin_let},
+    {"printf", builtin_printf},
+    {"jobs", builtin_jobs},
+    {"wait", builtin_wait},
+    {"fg", builtin_fg},
+    {"bg", builtin_bg},
+    {"parallel", builtin_parallel},
     {NULL, NULL} /* Sentinel value to mark the end of the table */
 };
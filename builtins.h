@@ -15,17 +15,19 @@ extern int last_exit_status;
 
 /* Built-in command structure */
 typedef struct {
-	const char *name;
-	void (*func)(char *args[]);
+    const char *name;
+    void (*func)(char *args[]);
 } builtin_command_t;
 
 /* Built-in command table */
 extern const builtin_command_t command_table[];
 
 /* Function declarations */
-void add_to_history(const char *command);
+const char *custom_strsignal(int sig);
 bool is_builtin(const char *command);
+bool is_pure_builtin(const char *command);
 void run_builtin(char *args[]);
+void for_each_alias(void (*visit)(const char *name));
 void builtin_echo(char *args[]);
 void builtin_history(char *args[]);
 void builtin_cd(char *args[]);
@@ -35,10 +37,27 @@ void builtin_pwd(char *args[]);
 void builtin_set(char *args[]);
 void builtin_unset(char *args[]);
 void builtin_export(char *args[]);
+void builtin_readonly(char *args[]);
+void builtin_declare(char *args[]);
+void builtin_mapfile(char *args[]);
 void builtin_kill(char *args[]);
 void builtin_alias(char *args[]);
 void builtin_unalias(char *args[]);
 void builtin_source(char *args[]);
+void builtin_hash(char *args[]);
+void builtin_true(char *args[]);
+void builtin_false(char *args[]);
+void builtin_break(char *args[]);
+void builtin_return(char *args[]);
+void builtin_test(char *args[]);
+void builtin_cond(char *args[]);
+void builtin_let(char *args[]);
+void builtin_printf(char *args[]);
+void builtin_jobs(char *args[]);
+void builtin_wait(char *args[]);
+void builtin_fg(char *args[]);
+void builtin_bg(char *args[]);
+void builtin_parallel(char *args[]);
 
 #endif /* BUILTINS_H */
 
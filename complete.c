@@ -0,0 +1,352 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Tab completion for Simple Humane Shell (shush).
+ *
+ * The first word of a command completes to built-ins, aliases, functions
+ * and the executables in $PATH, any other word or one with a slash in it
+ * to a path. The executables are kept in a prefix trie, built on the
+ * first Tab that needs it. Every PATH directory has an inotify watch, and
+ * the events waiting at each Tab update the trie a name at a time, so the
+ * directories are read once instead of at every key. The trie is built
+ * again only when PATH changes or the kernel drops events.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include "arena.h"
+#include "builtins.h"
+#include "complete.h"
+#include "exec.h"
+#include "hash.h"
+#include "libtline/readline.h"
+#include "var.h"
+
+/* Where a word ends, unless a backslash is in front */
+#define WORD_BREAKS " \t\n;|&()<>`"
+/* What a backslash goes in front of in a completed word */
+#define SPECIAL " \t\n\\'\"$`;&|()<>*?[]#"
+#define WATCH_EVENTS (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | \
+                      IN_ATTRIB | IN_DELETE_SELF | IN_MOVE_SELF | IN_ONLYDIR)
+
+/*
+ * A node stands for the bytes on the way down to it. Nodes are never
+ * taken out, a command that goes away only clears its flag.
+ */
+typedef struct trie_node {
+    struct trie_node *child;        /* the first of those one byte longer */
+    struct trie_node *next;         /* the next with the same parent */
+    unsigned char c;
+    bool command;
+} trie_node_t;
+
+static arena_t trie_arena;
+static trie_node_t *root = NULL;        /* NULL until a Tab needs it */
+static char *trie_path = NULL;          /* PATH the trie is of */
+static int inotify_fd = -1;
+
+/* The word being completed, without its backslashes */
+static char word[PATH_MAX];
+static size_t word_len;
+
+/* Function Prototypes */
+static trie_node_t *trie_find(const char *s, bool create);
+static void trie_offer(trie_node_t *n, char *name, size_t depth);
+static void forget_commands(void);
+static void read_dir(const char *dir);
+static void load_commands(void);
+static void catch_up(void);
+static void offer(const char *s, size_t n, bool dir);
+static void offer_name(const char *name);
+static void complete_command(void);
+static void complete_path(void);
+static bool command_position(const char *line, size_t start);
+static size_t complete(const char *line, size_t cursor);
+
+/* The node for s, added with the nodes on the way when create is set */
+static trie_node_t *
+trie_find(const char *s, bool create)
+{
+    trie_node_t *n = root, **pp;
+
+    for (; *s; s++) {
+        for (pp = &n->child; *pp && (*pp)->c != (unsigned char)*s; pp = &(*pp)->next)
+            ;
+        if (!*pp) {
+            if (!create)
+                return NULL;
+            *pp = arena_zalloc(&trie_arena, sizeof(**pp));
+            (*pp)->c = *s;
+        }
+        n = *pp;
+    }
+    return n;
+}
+
+/* Offer every command at or under n, name holds the depth bytes above it */
+static void
+trie_offer(trie_node_t *n, char *name, size_t depth)
+{
+    if (n->command)
+        offer(name, depth, false);
+    if (depth == NAME_MAX)
+        return;
+    for (n = n->child; n; n = n->next) {
+        name[depth] = n->c;
+        trie_offer(n, name, depth + 1);
+    }
+}
+
+static void
+forget_commands(void)
+{
+    arena_free(&trie_arena);
+    root = NULL;
+    free(trie_path);
+    trie_path = NULL;
+    if (inotify_fd >= 0)
+        close(inotify_fd);
+    inotify_fd = -1;
+}
+
+/* Watch dir, then put its executables in the trie */
+static void
+read_dir(const char *dir)
+{
+    struct dirent *d;
+    struct stat st;
+    DIR *dp;
+
+    if (inotify_fd >= 0)
+        inotify_add_watch(inotify_fd, dir, WATCH_EVENTS);
+    if (!(dp = opendir(dir)))
+        return;
+    while ((d = readdir(dp))) {
+        if (d->d_name[0] == '.' || (d->d_type != DT_REG && d->d_type != DT_LNK && d->d_type != DT_UNKNOWN))
+            continue;
+        if (!fstatat(dirfd(dp), d->d_name, &st, 0) && S_ISREG(st.st_mode) &&
+            !faccessat(dirfd(dp), d->d_name, X_OK, 0))
+            trie_find(d->d_name, true)->command = true;
+    }
+    closedir(dp);
+}
+
+/* Build the trie of what is in PATH, or bring it up to date */
+static void
+load_commands(void)
+{
+    const char *path = var_get("PATH"), *dir, *end;
+    char buf[PATH_MAX];
+
+    if (!path)
+        path = "";
+    if (root && strcmp(path, trie_path))
+        forget_commands();
+    if (root) {
+        catch_up();
+        if (root)
+            return;
+    }
+
+    if (!(trie_path = strdup(path))) {
+        perror("strdup");
+        exit(1);
+    }
+    inotify_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+    root = arena_zalloc(&trie_arena, sizeof(*root));
+
+    /* An empty element is whatever directory we are in, it is left out */
+    for (dir = path; *dir; dir = *end ? end + 1 : end) {
+        if (!(end = strchr(dir, ':')))
+            end = dir + strlen(dir);
+        if (end > dir && (size_t)(end - dir) < sizeof(buf)) {
+            memcpy(buf, dir, end - dir);
+            buf[end - dir] = '\0';
+            read_dir(buf);
+        }
+    }
+}
+
+/*
+ * Apply the inotify events that came since the last Tab. A name that
+ * changed is looked up in PATH again, as it may still be found in
+ * another directory. Losing events or a directory means reading all of
+ * them again.
+ */
+static void
+catch_up(void)
+{
+    char buf[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+    const struct inotify_event *ev;
+    char *found;
+    ssize_t n;
+
+    if (inotify_fd < 0)
+        return;
+    while ((n = read(inotify_fd, buf, sizeof(buf))) > 0) {
+        for (char *p = buf; p < buf + n; p += sizeof(*ev) + ev->len) {
+            ev = (const struct inotify_event *)p;
+            if (ev->mask & (IN_Q_OVERFLOW | IN_DELETE_SELF | IN_MOVE_SELF | IN_IGNORED)) {
+                forget_commands();
+                return;
+            }
+            if (!ev->len || ev->name[0] == '.')
+                continue;
+            found = search_path(ev->name);
+            trie_find(ev->name, true)->command = found != NULL;
+            free(found);
+        }
+    }
+}
+
+/* Offer s, with backslashes added, and a slash after a directory */
+static void
+offer(const char *s, size_t n, bool dir)
+{
+    char buf[2 * PATH_MAX + 1];
+    size_t len = 0;
+
+    for (size_t i = 0; i < n && len + 3 < sizeof(buf); i++) {
+        if (strchr(SPECIAL, s[i]) && s[i])
+            buf[len++] = '\\';
+        buf[len++] = s[i];
+    }
+    if (dir)
+        buf[len++] = '/';
+    readline_add_completion(buf, len);
+}
+
+static void
+offer_name(const char *name)
+{
+    if (!strncmp(name, word, word_len))
+        offer(name, strlen(name), false);
+}
+
+static void
+complete_command(void)
+{
+    char name[NAME_MAX + 1];
+    trie_node_t *n;
+
+    for (int i = 0; command_table[i].name; i++)
+        offer_name(command_table[i].name);
+    for_each_alias(offer_name);
+    for_each_function(offer_name);
+
+    load_commands();
+    if (word_len <= NAME_MAX && (n = trie_find(word, false))) {
+        memcpy(name, word, word_len);
+        trie_offer(n, name, word_len);
+    }
+}
+
+static void
+complete_path(void)
+{
+    char dir[PATH_MAX], path[2 * PATH_MAX + 1];
+    const char *base, *home = var_get("HOME");
+    size_t dir_len, base_len, name_len;
+    struct dirent *d;
+    struct stat st;
+    bool is_dir;
+    DIR *dp;
+
+    /* dir is the word up to its last slash, as typed */
+    base = strrchr(word, '/');
+    base = base ? base + 1 : word;
+    dir_len = base - word;
+    base_len = word_len - dir_len;
+    memcpy(path, word, dir_len);
+
+    if (dir_len == 0)
+        strcpy(dir, ".");
+    else if (word[0] == '~' && word[1] == '/' && home)
+        snprintf(dir, sizeof(dir), "%s%.*s", home, (int)dir_len - 1, word + 1);
+    else
+        snprintf(dir, sizeof(dir), "%.*s", (int)dir_len, word);
+
+    if (!(dp = opendir(dir)))
+        return;
+    while ((d = readdir(dp))) {
+        /* Hidden files only when the word asks for them */
+        if (d->d_name[0] == '.' && base[0] != '.')
+            continue;
+        if (!strcmp(d->d_name, ".") || !strcmp(d->d_name, "..") ||
+            strncmp(d->d_name, base, base_len))
+            continue;
+        is_dir = d->d_type == DT_DIR;
+        if (d->d_type == DT_LNK || d->d_type == DT_UNKNOWN)
+            is_dir = !fstatat(dirfd(dp), d->d_name, &st, 0) && S_ISDIR(st.st_mode);
+        name_len = strlen(d->d_name);
+        memcpy(path + dir_len, d->d_name, name_len);
+        offer(path, dir_len + name_len, is_dir);
+    }
+    closedir(dp);
+}
+
+/* Whether the word at start is the first one of a command */
+static bool
+command_position(const char *line, size_t start)
+{
+    static const char *const keywords[] = {
+        "if", "then", "else", "elif", "do", "while", "until", "!", "{", NULL,
+    };
+    size_t end, i;
+
+    while (start > 0 && strchr(" \t", line[start - 1]))
+        start--;
+    if (start == 0 || strchr(";|&(`\n", line[start - 1]))
+        return true;
+
+    /* Or one of the keywords a command follows */
+    for (end = start; start > 0 && !strchr(" \t\n;|&(`", line[start - 1]); start--)
+        ;
+    for (i = 0; keywords[i]; i++)
+        if (strlen(keywords[i]) == end - start && !strncmp(line + start, keywords[i], end - start))
+            return true;
+    return false;
+}
+
+/* The completer readline calls on Tab */
+static size_t
+complete(const char *line, size_t cursor)
+{
+    size_t start = cursor, i;
+
+    while (start > 0 && !(strchr(WORD_BREAKS, line[start - 1]) &&
+                  !(start > 1 && line[start - 2] == '\\')))
+        start--;
+    if (cursor - start >= sizeof(word))
+        return cursor;
+
+    word_len = 0;
+    for (i = start; i < cursor; i++) {
+        if (line[i] == '\\' && i + 1 < cursor)
+            i++;
+        word[word_len++] = line[i];
+    }
+    word[word_len] = '\0';
+
+    if (!strchr(word, '/') && word[0] != '~' && command_position(line, start))
+        complete_command();
+    else
+        complete_path();
+    return start;
+}
+
+void
+complete_init(void)
+{
+    readline_set_completer(complete);
+}
@@ -0,0 +1,13 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Tab completion for Simple Humane Shell (shush).
+ */
+
+#ifndef COMPLETE_H
+#define COMPLETE_H
+
+void complete_init(void);
+
+#endif /* COMPLETE_H */
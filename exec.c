@@ -0,0 +1,2117 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Executing commands for Simple Humane Shell (shush).
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "arith.h"
+#include "builtins.h"
+#include "exec.h"
+#include "glob.h"
+#include "hash.h"
+#include "jobs.h"
+#include "out.h"
+#include "parse.h"
+#include "pattern.h"
+#include "var.h"
+#include "vm.h"
+
+#define MAX_PIPELINE 64
+#define MAX_FUNCTION_DEPTH 1000
+#define FUNCTION_BUCKETS 64
+#define MAX_REDIRS 10
+#define FIRST_SHELL_FD 10       /* our own descriptors stay out of the way of 0-9 */
+
+#ifndef F_SETPIPE_SZ
+#define F_SETPIPE_SZ 1031
+#endif
+#ifndef F_DUPFD_CLOEXEC
+#define F_DUPFD_CLOEXEC 1030
+#endif
+#ifndef MFD_CLOEXEC
+#define MFD_CLOEXEC 1
+#endif
+
+/* Growable string, starts out in the caller's stack buffer */
+typedef struct {
+    char *buf;
+    size_t len;
+    size_t size;
+    bool heap;
+} strbuf_t;
+
+/* Field list built while expanding the words of one command */
+typedef struct field {
+    char *text;
+    struct field *next;
+} field_t;
+
+typedef struct {
+    strbuf_t sb;
+    bool have;              /* the current field exists, even if empty */
+    field_t *head;
+    field_t **tail;
+    int count;
+    const char *ifs;
+    bool split;             /* split unquoted expansions into fields */
+    bool pattern;           /* escape quoted glob characters */
+    bool globbing;          /* expand fields that are patterns into paths */
+    bool magic;             /* the field has an unquoted * ? or [ */
+    bool escaped;           /* it has quoted ones too, glob has its pattern */
+    strbuf_t glob;
+    bool failed;            /* an expansion reported an error */
+    arena_t *ast;           /* arena of the words, for what they cache */
+} expand_t;
+
+/* One step in setting up the descriptors of a command: dup2(src, fd) */
+typedef struct {
+    int fd;
+    int src;                /* -1 closes fd */
+    bool owned;             /* src was opened for this command */
+    int saved;              /* the shell's own fd while a built-in runs, -1 if closed */
+} move_t;
+
+/* The redirections of one command, opened and ready to apply */
+typedef struct {
+    move_t moves[MAX_REDIRS];
+    int count;
+} redirs_t;
+
+/* A NAME=value word, expanded */
+typedef struct {
+    const char *name;
+    char *key;              /* NAME[key]=value, or NULL */
+    char *value;
+    bool compound;          /* NAME=( words ) */
+    bool append;            /* NAME+=( words ), the old elements stay */
+    char **values;          /* its elements */
+    char **keys;            /* and the [key]= of each, NULL where none */
+    int count;
+    int size;
+} assign_t;
+
+/* Shell functions, each body copied into an arena of its own */
+typedef struct function {
+    char *name;
+    node_t *body;
+    arena_t arena;
+    int users;              /* calls of it that are running */
+    bool dead;              /* redefined or unset, free once users drops to 0 */
+    struct function *next;
+} function_t;
+
+static bool debug = false;
+static volatile int spawn_errno;
+
+/* Output of command substitutions, one buffer reused by all of them */
+static char *capture_buf = NULL;
+static size_t capture_size = 0;
+static int capture_fd = -1;     /* memory file for built-ins run in the shell */
+static bool capturing = false;  /* capture_fd is taken by an outer substitution */
+
+/* Result of ${name op word}, one buffer reused by all of them */
+static char *op_buf = NULL;
+static size_t op_size = 0;
+static size_t op_len = 0;
+
+/* The words of the built-in that runs, for the NAME=( ) of declare */
+static word_t *declaring = NULL;
+static arena_t *declaring_ast = NULL;
+
+/* Positional parameters, positional[0] is $0 */
+static char **positional = NULL;
+static int positional_count = 0;
+
+arena_t scratch;
+
+int breaking = 0;
+int continuing = 0;
+bool returning = false;
+volatile sig_atomic_t interrupted = 0;
+int loop_depth = 0;
+int function_depth = 0;
+bool interactive = false;
+
+static function_t *functions[FUNCTION_BUCKETS];
+
+#define unwinding() (breaking || continuing || returning || interrupted)
+
+/* Function Prototypes */
+static int exec_node(node_t *n);
+static int exec_simple(node_t *n);
+static assign_t *expand_assigns(node_t *n, word_t **words, bool *subst);
+static bool expand_assign(arena_t *ast, const assignment_t *as, assign_t *a);
+static void add_element(assign_t *a, char *key, char *value);
+static int assign(const assign_t *a, int count, bool subst);
+static int exec_pipeline(node_t *n);
+static int exec_subshell(node_t *n);
+static function_t *find_function(const char *name);
+static void define_function(node_t *n);
+static void drop_function(function_t **pp);
+static int call_function(function_t *f, int argc, char *args[]);
+static int run_command(function_t *f, int argc, char *args[]);
+static int exec_external(char *args[], const redirs_t *r);
+static pid_t spawn_external(char *args[], int in, int out, const redirs_t *r, pid_t group);
+static bool redir_open(node_t *n, redirs_t *r);
+static bool add_move(redirs_t *r, int fd, int src, bool owned);
+static bool fd_open(const redirs_t *r, int fd);
+static int open_high(int fd);
+static void redir_apply(const redirs_t *r);
+static void redir_push(redirs_t *r);
+static void redir_pop(redirs_t *r);
+static void redir_close(redirs_t *r);
+static void set_pipe_size(int fd, long size);
+static int exec_arith(node_t *n);
+static void expand_init(expand_t *e, arena_t *ast, char *buf, size_t size);
+static void add_parts(expand_t *e, word_t *w);
+static void expand_word(expand_t *e, word_t *w);
+static char *expand_one(arena_t *ast, word_t *w, bool pattern);
+static char **expand_cond(arena_t *ast, word_t *words, int *argc);
+static bool arith_value(word_part_t *wp, arena_t *ast, long long *v);
+static const char *command_output(node_t *n, size_t *len);
+static bool runs_in_shell(node_t *n);
+static bool has_effects(word_t *w);
+static const char *read_capture(int fd, size_t *len);
+static void capture_reserve(size_t size);
+static void sb_append(strbuf_t *sb, const char *s, size_t n);
+static void add_text(expand_t *e, const char *s, size_t n, bool quoted);
+static void add_glob(expand_t *e, const char *s, size_t n, bool quoted);
+static bool field_paths(expand_t *e);
+static void field_end(expand_t *e);
+static void add_split(expand_t *e, const char *s, size_t n);
+static void add_list(expand_t *e, bool quoted, const char *const *values, size_t n, bool at);
+static const char *param_element(expand_t *e, word_part_t *wp, char *num, size_t num_size);
+static bool use_value(expand_t *e, word_part_t *wp, const char **val, bool set);
+static void op_add(const char *s, size_t n);
+static bool substring(word_part_t *wp, arena_t *ast, size_t len, size_t *start, size_t *n);
+static const char *replace(expand_t *e, word_part_t *wp, const pattern_t *pat,
+                           const char *val, size_t len, size_t *n);
+static const char *apply_op(expand_t *e, word_part_t *wp, const char *val, size_t len, size_t *n);
+static void add_param(expand_t *e, word_part_t *wp);
+static bool operand_value(word_t *w, arena_t *ast, long long *v);
+
+void
+set_debug(bool mode)
+{
+    debug = mode;
+}
+
+void
+set_positional_params(int argc, char *argv[])
+{
+    positional = argv;
+    positional_count = argc;
+}
+
+void
+parse_and_execute(char *line)
+{
+    execute_buffer(line, strlen(line), true, -1, 0);
+}
+
+/*
+ * Parse and run the complete commands in src one after another, each
+ * one parsed into a fresh arena. Returns how much of src was used, which
+ * is less than len when src ends in the middle of a command and more
+ * input may follow (eof is false). When sync_fd is a seekable stdin that
+ * src was read from (starting at file offset sync_base), its offset is
+ * kept just past the running command so that the command can read the
+ * rest of the input, like in other shells.
+ */
+size_t
+execute_buffer(const char *src, size_t len, bool eof, int sync_fd, off_t sync_base)
+{
+    arena_t arena = { 0 };
+    parser_t p;
+    node_t *n;
+    size_t done = 0;
+
+    parser_init(&p, &arena, src, len, eof);
+    while ((n = parse_next(&p))) {
+        done = p.pos;
+        if (sync_fd >= 0)
+            lseek(sync_fd, sync_base + done, SEEK_SET);
+
+        execute(n);
+        if (interrupted)
+            break;
+
+        if (sync_fd >= 0) {
+            off_t off = lseek(sync_fd, 0, SEEK_CUR) - sync_base;
+
+            if (off > (off_t)done && (size_t)off <= len)
+                p.pos = done = off;
+        }
+        arena_reset(&arena);
+    }
+    arena_free(&arena);
+
+    if (p.error) {
+        last_exit_status = 2;
+        return len;
+    }
+    return p.incomplete ? done : len;
+}
+
+int
+execute(node_t *n)
+{
+    arena_mark_t mark;
+    redirs_t r;
+    int status;
+
+    if (n->flags & NODE_BG) {
+        last_exit_status = job_start(n);
+        return last_exit_status;
+    }
+
+    /* Redirections of a compound command hold while all of it runs */
+    if (n->redirs && n->type != N_CMD) {
+        mark = arena_mark(&scratch);
+        if (redir_open(n, &r)) {
+            redir_push(&r);
+            status = exec_node(n);
+            redir_pop(&r);
+        } else {
+            status = 1;
+        }
+        arena_release(&scratch, mark);
+    } else {
+        status = exec_node(n);
+    }
+
+    if (n->flags & NODE_NEGATE)
+        status = !status;
+    last_exit_status = status;
+    return status;
+}
+
+static int
+exec_node(node_t *n)
+{
+    int status = 0;
+
+    switch (n->type) {
+    case N_CMD:
+        status = exec_simple(n);
+        break;
+    case N_PIPE:
+        /* A lone '!' command needs no pipe and no fork */
+        status = n->n == 1 ? execute(n->body) : exec_pipeline(n);
+        break;
+    case N_AND:
+        if ((status = execute(n->left)) == 0 && !unwinding())
+            status = execute(n->right);
+        break;
+    case N_OR:
+        if ((status = execute(n->left)) != 0 && !unwinding())
+            status = execute(n->right);
+        break;
+    case N_LIST:
+        for (node_t *c = n->body; c; c = c->next) {
+            status = execute(c);
+            if (unwinding())
+                break;
+        }
+        break;
+    case N_GROUP:
+    case N_IF:
+    case N_WHILE:
+    case N_UNTIL:
+    case N_FOR:
+    case N_CASE:
+        if (debug && !n->code)
+            vm_dump(n);
+        status = vm_execute(n);
+        break;
+    case N_SUBSHELL:
+        status = exec_subshell(n);
+        break;
+    case N_FUNC:
+        define_function(n);
+        break;
+    case N_ARITH:
+        status = exec_arith(n);
+        break;
+    }
+    return status;
+}
+
+/*
+ * Expand the NAME=value words n starts with. *words is left at the
+ * first word after them, and *subst tells whether a value had a command
+ * substitution.
+ */
+static assign_t *
+expand_assigns(node_t *n, word_t **words, bool *subst)
+{
+    assign_t *a = arena_alloc(&scratch, n->assigns * sizeof(*a));
+    word_t *w = n->words;
+
+    *subst = false;
+    for (int i = 0; i < n->assigns; i++, w = w->next) {
+        if (!expand_assign(n->arena, w->assign, &a[i]))
+            return NULL;
+        for (word_t *v = w->assign->compound ? w->assign->array : w; v; v = v->next)
+            for (word_part_t *wp = v->parts; wp; wp = wp->next)
+                if (wp->type == WP_CMDSUB)
+                    *subst = true;
+    }
+    *words = w;
+    return a;
+}
+
+/*
+ * Expand one assignment: the value into a single string, the words of
+ * NAME=( ) into fields. += puts the old value in front of a new one.
+ */
+static bool
+expand_assign(arena_t *ast, const assignment_t *as, assign_t *a)
+{
+    const char *old;
+    char *key, *value, **fields;
+    word_t one;
+    int count;
+
+    memset(a, 0, sizeof(*a));
+    a->name = as->name;
+    if (as->subscript && !(a->key = expand_one(ast, as->subscript, false)))
+        return false;
+    if (!as->compound) {
+        if (!(a->value = expand_one(ast, as->value, false)))
+            return false;
+        if (as->append && (old = a->key ? var_element(a->name, a->key) : var_get(a->name))) {
+            value = arena_alloc(&scratch, strlen(old) + strlen(a->value) + 1);
+            strcpy(stpcpy(value, old), a->value);
+            a->value = value;
+        }
+        return true;
+    }
+
+    a->compound = true;
+    a->append = as->append;
+    for (word_t *w = as->array; w; w = w->next) {
+        if (w->assign) {
+            if (!(key = expand_one(ast, w->assign->subscript, false)) ||
+                !(value = expand_one(ast, w->assign->value, false)))
+                return false;
+            add_element(a, key, value);
+            continue;
+        }
+        one = *w;
+        one.next = NULL;
+        if (!(fields = expand_words(ast, &one, &count)))
+            return false;
+        for (int i = 0; i < count; i++)
+            add_element(a, NULL, fields[i]);
+    }
+    return true;
+}
+
+static void
+add_element(assign_t *a, char *key, char *value)
+{
+    char **values, **keys;
+
+    if (a->count == a->size) {
+        a->size = a->size ? a->size * 2 : 16;
+        values = arena_alloc(&scratch, a->size * sizeof(*values));
+        keys = arena_alloc(&scratch, a->size * sizeof(*keys));
+        if (a->count) {
+            memcpy(values, a->values, a->count * sizeof(*values));
+            memcpy(keys, a->keys, a->count * sizeof(*keys));
+        }
+        a->values = values;
+        a->keys = keys;
+    }
+    a->keys[a->count] = key;
+    a->values[a->count++] = value;
+}
+
+/* Assignments on their own set shell variables */
+static int
+assign(const assign_t *a, int count, bool subst)
+{
+    for (int i = 0; i < count; i++) {
+        if (a[i].compound) {
+            if (!a[i].append && !var_clear(a[i].name, VAR_ARRAY))
+                return 1;
+            for (int j = 0; j < a[i].count; j++)
+                if (!var_set_element(a[i].name, a[i].keys[j], a[i].values[j],
+                                     strlen(a[i].values[j])))
+                    return 1;
+        } else if (a[i].key) {
+            if (!var_set_element(a[i].name, a[i].key, a[i].value, strlen(a[i].value)))
+                return 1;
+        } else if (!var_set(a[i].name, a[i].value, 0)) {
+            return 1;
+        }
+    }
+    /* The status is that of the last command substitution, if any */
+    return subst ? last_exit_status : 0;
+}
+
+/*
+ * Assign the NAME=( ) argument for name of the declare, export or
+ * readonly that runs, if it has one.
+ */
+bool
+assign_array(const char *name)
+{
+    assign_t a;
+
+    for (word_t *w = declaring; w; w = w->next)
+        if (w->assign && w->assign->compound && !strcmp(w->assign->name, name))
+            return expand_assign(declaring_ast, w->assign, &a) && !assign(&a, 1, false);
+    return true;
+}
+
+static int
+exec_simple(node_t *n)
+{
+    arena_mark_t mark = arena_mark(&scratch);
+    word_t *words = n->words;
+    assign_t *assigns = NULL;
+    int argc, status, i;
+    char **args;
+    bool subst = false;
+    function_t *f;
+    redirs_t r;
+
+    if (n->assigns && !(assigns = expand_assigns(n, &words, &subst))) {
+        arena_release(&scratch, mark);
+        return 1;
+    }
+    args = n->flags & NODE_COND ? expand_cond(n->arena, words, &argc) :
+           expand_words(n->arena, words, &argc);
+    r.count = 0;
+    if (!args || (n->redirs && !redir_open(n, &r))) {
+        arena_release(&scratch, mark);
+        return 1;
+    }
+    /* Only assignments and redirections, the files are created and closed again */
+    if (!argc) {
+        redir_close(&r);
+        status = assign(assigns, n->assigns, subst);
+        arena_release(&scratch, mark);
+        return status;
+    }
+
+    /* Assignments before a command are in its environment while it runs */
+    for (i = 0; i < n->assigns; i++) {
+        if (assigns[i].key || assigns[i].compound) {
+            fprintf(stderr, "shush: %s: arrays cannot be assigned for a command\n",
+                    assigns[i].name);
+            redir_close(&r);
+            arena_release(&scratch, mark);
+            return 1;
+        }
+        if (var_flags(assigns[i].name) & VAR_READONLY) {
+            fprintf(stderr, "shush: %s: readonly variable\n", assigns[i].name);
+            redir_close(&r);
+            arena_release(&scratch, mark);
+            return 1;
+        }
+    }
+    for (i = 0; i < n->assigns; i++)
+        var_push(assigns[i].name, assigns[i].value);
+
+    if (debug) {
+        printf("Executing: %s\n", args[0]);
+        for (int j = 0; j < argc; j++)
+            printf("arg[%d]: %s\n", j, args[j]);
+    }
+
+    if ((f = find_function(args[0]))) {
+        redir_push(&r);
+        status = call_function(f, argc, args);
+        redir_pop(&r);
+    } else if (is_builtin(args[0])) {
+        redir_push(&r);
+        declaring = words;
+        declaring_ast = n->arena;
+        run_builtin(args);
+        declaring = NULL;
+        if (!out_done()) {
+            fprintf(stderr, "shush: %s: write error: %s\n", args[0], strerror(errno));
+            last_exit_status = 1;
+        }
+        status = last_exit_status;
+        redir_pop(&r);
+    } else {
+        status = exec_external(args, &r);
+        redir_close(&r);
+    }
+
+    for (i = 0; i < n->assigns; i++)
+        var_pop();
+    arena_release(&scratch, mark);
+    return status;
+}
+
+/*
+ * Run all stages of a pipeline concurrently. Every stage is started up
+ * front: external commands with spawn_external, everything that runs
+ * shell code in a forked child. The status is that of the last stage.
+ * With job control all stages share a process group, the first one
+ * started leads it and takes the terminal.
+ */
+static int
+exec_pipeline(node_t *n)
+{
+    arena_mark_t mark = arena_mark(&scratch);
+    char **argv[MAX_PIPELINE];
+    redirs_t redirs[MAX_PIPELINE];
+    node_t *stage;
+    function_t *f;
+    pid_t pids[MAX_PIPELINE], pgrp = 0;
+    int argcs[MAX_PIPELINE], fds[2], in = -1, i, started = 0, status = 0;
+    const char *size_env = var_get("SHUSH_PIPE_SIZE");
+    long pipe_size = size_env ? strtol(size_env, NULL, 10) : 0;
+
+    if (n->n > MAX_PIPELINE) {
+        fprintf(stderr, "shush: pipeline too long\n");
+        return 1;
+    }
+
+    for (i = 0, stage = n->body; stage; stage = stage->next, i++) {
+        argv[i] = NULL;
+        redirs[i].count = 0;
+        /* Assignments need the stage to run as shell code */
+        if (stage->type != N_CMD || stage->assigns)
+            continue;
+        if (!(argv[i] = expand_words(stage->arena, stage->words, &argcs[i])) ||
+            (stage->redirs && !redir_open(stage, &redirs[i]))) {
+            while (i--)
+                redir_close(&redirs[i]);
+            arena_release(&scratch, mark);
+            return 1;
+        }
+    }
+
+    /* Children must not inherit pending output */
+    out_flush();
+    fflush(stderr);
+
+    for (i = 0, stage = n->body; stage; stage = stage->next, i++) {
+        bool last = !stage->next;
+
+        if (!last) {
+            if (pipe(fds) < 0) {
+                perror("shush: pipe");
+                status = 1;
+                break;
+            }
+            fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+            fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+            if (pipe_size > 0)
+                set_pipe_size(fds[1], pipe_size);
+        }
+
+        /* Only shell code needs a full fork */
+        if (argv[i] && argv[i][0] && !find_function(argv[i][0]) &&
+            !is_builtin(argv[i][0])) {
+            pids[i] = spawn_external(argv[i], in, last ? -1 : fds[1], &redirs[i],
+                                     job_control ? pgrp : -1);
+        } else if ((pids[i] = fork()) == 0) {
+            signal(SIGINT, SIG_DFL);
+            if (job_control) {
+                setpgid(0, pgrp);
+                if (!pgrp)
+                    tcsetpgrp(STDIN_FILENO, getpid());
+                job_child();
+            }
+            job_control = false;
+            interactive = false;
+            if (in != -1) {
+                dup2(in, STDIN_FILENO);
+                close(in);
+            }
+            if (!last) {
+                close(fds[0]);
+                dup2(fds[1], STDOUT_FILENO);
+                close(fds[1]);
+            }
+            redir_apply(&redirs[i]);
+            if (!argv[i]) {
+                status = execute(stage);
+            } else if (argv[i][0] && (f = find_function(argv[i][0]))) {
+                status = call_function(f, argcs[i], argv[i]);
+            } else if (argv[i][0]) {
+                run_builtin(argv[i]);
+                status = last_exit_status;
+            }
+            out_flush();
+            _exit(status);
+        } else if (pids[i] < 0) {
+            perror("shush: fork failed");
+        }
+
+        redir_close(&redirs[i]);
+        if (pids[i] < 0) {
+            if (!last) {
+                close(fds[0]);
+                close(fds[1]);
+            }
+            status = 1;
+            break;
+        }
+        started++;
+        /* Both sides set the group, whichever runs first wins the race */
+        if (job_control && pids[i] > 0) {
+            setpgid(pids[i], pgrp ? pgrp : pids[i]);
+            if (!pgrp)
+                pgrp = pids[i];
+        }
+
+        if (in != -1)
+            close(in);
+        if (!last) {
+            close(fds[1]);
+            in = fds[0];
+        }
+    }
+    if (in != -1 && started < n->n)
+        close(in);
+    for (i = started; i < n->n; i++)
+        redir_close(&redirs[i]);
+
+    if (job_control) {
+        if (started)
+            status = job_wait_group(n, pids, started);
+        arena_release(&scratch, mark);
+        return status;
+    }
+    for (i = 0; i < started; i++) {
+        int wstatus;
+
+        /* A stage whose command was not found was never started */
+        if (pids[i] == 0)
+            wstatus = 127 << 8;
+        else
+            waitpid(pids[i], &wstatus, 0);
+        if (i == n->n - 1)
+            status = WIFEXITED(wstatus) ? WEXITSTATUS(wstatus) : 1;
+    }
+
+    arena_release(&scratch, mark);
+    return status;
+}
+
+static void
+set_pipe_size(int fd, long size)
+{
+    if (fcntl(fd, F_SETPIPE_SZ, (int)size) < 0)
+        perror("shush: F_SETPIPE_SZ");
+}
+
+/* ( list ) runs in a forked copy of the shell */
+static int
+exec_subshell(node_t *n)
+{
+    pid_t pid;
+    int status;
+
+    out_flush();
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        signal(SIGINT, SIG_DFL);
+        if (job_control) {
+            setpgid(0, 0);
+            tcsetpgrp(STDIN_FILENO, getpid());
+            job_child();
+        }
+        job_control = false;
+        interactive = false;
+        status = execute(n->body);
+        out_flush();
+        _exit(status);
+    } else if (pid < 0) {
+        perror("shush: fork failed");
+        return 1;
+    }
+    if (job_control) {
+        setpgid(pid, pid);
+        return job_wait_group(n, &pid, 1);
+    }
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/* (( expression )) is true when the expression is not 0 */
+static int
+exec_arith(node_t *n)
+{
+    long long v;
+
+    if (!arith_value(n->words->parts, n->arena, &v))
+        return 1;
+    return v == 0;
+}
+
+static function_t *
+find_function(const char *name)
+{
+    function_t *f;
+
+    for (f = functions[hash_bytes(name, strlen(name)) % FUNCTION_BUCKETS]; f; f = f->next)
+        if (!strcmp(f->name, name))
+            return f;
+    return NULL;
+}
+
+/* Unlink *pp, it is freed now or when its last running call returns */
+static void
+drop_function(function_t **pp)
+{
+    function_t *f = *pp;
+
+    *pp = f->next;
+    if (f->users) {
+        f->dead = true;
+        return;
+    }
+    arena_free(&f->arena);
+    free(f);
+}
+
+/*
+ * The body is copied out of the arena of the line that defined it, and
+ * keeps the bytecode compiled on its first call for as long as it lives.
+ */
+static void
+define_function(node_t *n)
+{
+    function_t **pp = &functions[hash_bytes(n->name, strlen(n->name)) % FUNCTION_BUCKETS], *f;
+
+    for (; *pp; pp = &(*pp)->next) {
+        if (!strcmp((*pp)->name, n->name)) {
+            drop_function(pp);
+            break;
+        }
+    }
+
+    if (!(f = calloc(1, sizeof(*f)))) {
+        perror("calloc");
+        exit(1);
+    }
+    f->name = arena_strndup(&f->arena, n->name, strlen(n->name));
+    f->body = node_copy(&f->arena, n->body);
+    pp = &functions[hash_bytes(n->name, strlen(n->name)) % FUNCTION_BUCKETS];
+    f->next = *pp;
+    *pp = f;
+}
+
+bool
+unset_function(const char *name)
+{
+    function_t **pp = &functions[hash_bytes(name, strlen(name)) % FUNCTION_BUCKETS];
+
+    for (; *pp; pp = &(*pp)->next) {
+        if (!strcmp((*pp)->name, name)) {
+            drop_function(pp);
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Call visit with the name of every function */
+void
+for_each_function(void (*visit)(const char *name))
+{
+    function_t *f;
+
+    for (int i = 0; i < FUNCTION_BUCKETS; i++)
+        for (f = functions[i]; f; f = f->next)
+            visit(f->name);
+}
+
+/* Run f with args[1..] as its positional parameters, $0 stays the same */
+static int
+call_function(function_t *f, int argc, char *args[])
+{
+    char **saved = positional;
+    int saved_count = positional_count, saved_loops = loop_depth, status;
+
+    if (function_depth >= MAX_FUNCTION_DEPTH) {
+        fprintf(stderr, "shush: %s: maximum function nesting level exceeded\n", args[0]);
+        return 1;
+    }
+
+    args[0] = positional ? positional[0] : "shush";
+    positional = args;
+    positional_count = argc;
+    loop_depth = 0;
+    function_depth++;
+    f->users++;
+
+    status = execute(f->body);
+
+    /* break and continue do not reach the loops of the caller */
+    returning = false;
+    breaking = continuing = 0;
+    f->users--;
+    function_depth--;
+    loop_depth = saved_loops;
+    positional = saved;
+    positional_count = saved_count;
+
+    if (f->dead && !f->users) {
+        arena_free(&f->arena);
+        free(f);
+    }
+    return status;
+}
+
+/*
+ * Start args without waiting for it, reading in and writing out and err
+ * (-1 to inherit). External commands are spawned, shell code runs in a
+ * forked child. Returns the pid, 0 when the command was not found.
+ */
+pid_t
+exec_async(int argc, char *args[], int in, int out, int err)
+{
+    function_t *f = find_function(args[0]);
+    redirs_t r;
+    pid_t pid;
+
+    r.count = 0;
+    if (err != -1)
+        add_move(&r, STDERR_FILENO, err, false);
+    if (!f && !is_builtin(args[0]))
+        return spawn_external(args, in, out, &r, -1);
+
+    out_flush();
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        signal(SIGINT, SIG_DFL);
+        job_control = false;
+        interactive = false;
+        if (in != -1)
+            dup2(in, STDIN_FILENO);
+        if (out != -1)
+            dup2(out, STDOUT_FILENO);
+        redir_apply(&r);
+        _exit(run_command(f, argc, args));
+    } else if (pid < 0) {
+        perror("shush: fork failed");
+    }
+    return pid;
+}
+
+/* Shell code of a simple command, in a child that exits with its status */
+static int
+run_command(function_t *f, int argc, char *args[])
+{
+    int status;
+
+    if (f) {
+        status = call_function(f, argc, args);
+    } else {
+        run_builtin(args);
+        status = last_exit_status;
+    }
+    out_flush();
+    return status;
+}
+
+static int
+exec_external(char *args[], const redirs_t *r)
+{
+    pid_t pid = spawn_external(args, -1, -1, r, job_control ? 0 : -1);
+    int status;
+
+    if (pid < 0)
+        return -1;
+    if (pid == 0)
+        return 127;
+    if (job_control)
+        return job_wait(pid, args);
+
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+}
+
+/*
+ * Start an external command with vfork, so spawning does not have to
+ * copy the page tables of a large shell heap. The child borrows our
+ * memory until execve: it only moves descriptors into place, everything
+ * its redirections and environment need was made beforehand, and it leaves the exec
+ * error in spawn_errno for the parent to report. Signals stay
+ * blocked so no handler of ours can run on the borrowed stack. With
+ * job control it joins the process group group, or leads a new one
+ * with the terminal when that is 0; -1 leaves it in ours.
+ * Returns 0 without starting anything when the command is not found.
+ */
+static pid_t
+spawn_external(char *args[], int in, int out, const redirs_t *r, pid_t group)
+{
+    const char *path = hash_lookup(args[0]);
+    char **envp = var_environ();
+    sigset_t all, old;
+    pid_t pid;
+
+    if (!path) {
+        fprintf(stderr, "shush: %s: command not found\n", args[0]);
+        return 0;
+    }
+
+    out_flush();
+    sigfillset(&all);
+    sigprocmask(SIG_BLOCK, &all, &old);
+    spawn_errno = 0;
+
+    pid = vfork();
+    if (pid == 0) {
+        signal(SIGINT, SIG_DFL);
+        /* With job control the command gets a group and the terminal */
+        if (group >= 0) {
+            setpgid(0, group);
+            if (!group)
+                tcsetpgrp(STDIN_FILENO, getpid());
+            job_child();
+        }
+        sigprocmask(SIG_SETMASK, &old, NULL);
+        if (in != -1)
+            dup2(in, STDIN_FILENO);
+        if (out != -1)
+            dup2(out, STDOUT_FILENO);
+        redir_apply(r);
+        execve(path, args, envp);
+        spawn_errno = errno;
+        _exit(127);
+    }
+
+    sigprocmask(SIG_SETMASK, &old, NULL);
+    if (pid < 0) {
+        perror("shush: vfork failed");
+    } else if (spawn_errno) {
+        fprintf(stderr, "shush: %s: %s\n", args[0], strerror(spawn_errno));
+        /* The hashed binary went away, search PATH again next time */
+        if (spawn_errno == ENOENT && path != args[0])
+            hash_remove(args[0]);
+    }
+    return pid;
+}
+
+/*
+ * Open everything the redirections of n need, in order. Nothing is
+ * applied yet, so a failure leaves the shell's descriptors untouched.
+ */
+static bool
+redir_open(node_t *n, redirs_t *r)
+{
+    static const int flags[] = {
+        [R_IN] = O_RDONLY,
+        [R_OUT] = O_WRONLY | O_CREAT | O_TRUNC,
+        [R_APPEND] = O_WRONLY | O_CREAT | O_APPEND,
+        [R_RDWR] = O_RDWR | O_CREAT,
+        [R_BOTH] = O_WRONLY | O_CREAT | O_TRUNC,
+        [R_BOTHAPPEND] = O_WRONLY | O_CREAT | O_APPEND,
+    };
+    redir_t *rd;
+    char *text, *end;
+    long target;
+    int type, fd;
+
+    r->count = 0;
+    for (rd = n->redirs; rd; rd = rd->next) {
+        if (!(text = expand_string(n->arena, rd->word)))
+            goto fail;
+        type = rd->type;
+
+        if (type == R_DUPIN || type == R_DUPOUT) {
+            if (!strcmp(text, "-")) {
+                if (!add_move(r, rd->fd, -1, false))
+                    goto fail;
+                continue;
+            }
+            target = strtol(text, &end, 10);
+            if (*text && !*end) {
+                if (!fd_open(r, target)) {
+                    fprintf(stderr, "shush: %s: %s\n", text, strerror(errno));
+                    goto fail;
+                }
+                if (!add_move(r, rd->fd, target, false))
+                    goto fail;
+                continue;
+            }
+            /* >&file is &>file */
+            if (type == R_DUPIN || rd->fd != 1) {
+                fprintf(stderr, "shush: %s: ambiguous redirect\n", text);
+                goto fail;
+            }
+            type = R_BOTH;
+        }
+
+        if (type == R_HERESTR) {
+            size_t len = strlen(text);
+
+            text[len] = '\n';
+            fd = memory_fd(text, len + 1);
+            text[len] = '\0';
+        } else if (type == R_HEREDOC || type == R_HEREDOCTAB) {
+            fd = memory_fd(text, strlen(text));
+        } else if ((fd = open(text, flags[type] | O_CLOEXEC, 0666)) < 0) {
+            fprintf(stderr, "shush: %s: %s\n", text, strerror(errno));
+        }
+        if (fd < 0 || (fd = open_high(fd)) < 0 || !add_move(r, rd->fd, fd, true))
+            goto fail;
+        if ((type == R_BOTH || type == R_BOTHAPPEND) && !add_move(r, STDERR_FILENO, rd->fd, false))
+            goto fail;
+    }
+    return true;
+
+fail:
+    redir_close(r);
+    return false;
+}
+
+static bool
+add_move(redirs_t *r, int fd, int src, bool owned)
+{
+    if (r->count == MAX_REDIRS) {
+        fprintf(stderr, "shush: too many redirections\n");
+        if (owned)
+            close(src);
+        return false;
+    }
+    r->moves[r->count].fd = fd;
+    r->moves[r->count].src = src;
+    r->moves[r->count].owned = owned;
+    r->moves[r->count].saved = -1;
+    r->count++;
+    return true;
+}
+
+/* Will fd be open once the moves so far are applied? */
+static bool
+fd_open(const redirs_t *r, int fd)
+{
+    for (int i = r->count - 1; i >= 0; i--)
+        if (r->moves[i].fd == fd)
+            return r->moves[i].src >= 0;
+    if (fcntl(fd, F_GETFD) >= 0)
+        return true;
+    errno = EBADF;
+    return false;
+}
+
+/* Move fd up to FIRST_SHELL_FD or above, so no redirection overwrites it */
+static int
+open_high(int fd)
+{
+    int high;
+
+    if (fd >= FIRST_SHELL_FD)
+        return fd;
+    high = fcntl(fd, F_DUPFD_CLOEXEC, FIRST_SHELL_FD);
+    if (high < 0)
+        perror("shush: fcntl");
+    close(fd);
+    return high;
+}
+
+/*
+ * A descriptor holding a copy of text, for here-documents, here-strings
+ * and output kept for later. The text goes into an anonymous file in
+ * memory, or an unnamed file on kernels without memfd_create, never to
+ * a named file on disk or into a pipe that would need a writer process
+ * for large bodies.
+ */
+int
+memory_fd(const char *text, size_t len)
+{
+    ssize_t w;
+    int fd = -1;
+
+#ifdef SYS_memfd_create
+    fd = syscall(SYS_memfd_create, "shush-heredoc", MFD_CLOEXEC);
+#endif
+#ifdef O_TMPFILE
+    if (fd < 0) {
+        const char *dir = var_get("TMPDIR");
+
+        fd = open(dir && *dir ? dir : "/tmp", O_TMPFILE | O_RDWR | O_CLOEXEC, 0600);
+    }
+#endif
+    if (fd < 0) {
+        char path[] = "/tmp/shush-heredoc-XXXXXX";
+
+        if ((fd = mkstemp(path)) >= 0) {
+            unlink(path);
+            fcntl(fd, F_SETFD, FD_CLOEXEC);
+        }
+    }
+    if (fd < 0) {
+        perror("shush: here-document");
+        return -1;
+    }
+
+    while (len > 0) {
+        if ((w = write(fd, text, len)) < 0) {
+            if (errno == EINTR)
+                continue;
+            perror("shush: here-document");
+            close(fd);
+            return -1;
+        }
+        text += w;
+        len -= w;
+    }
+    lseek(fd, 0, SEEK_SET);
+    return fd;
+}
+
+/* Put the descriptors in place for good, in a child about to run the command */
+static void
+redir_apply(const redirs_t *r)
+{
+    for (int i = 0; i < r->count; i++) {
+        if (r->moves[i].src < 0)
+            close(r->moves[i].fd);
+        else
+            dup2(r->moves[i].src, r->moves[i].fd);
+    }
+}
+
+/* Apply the redirections in the shell itself, keeping copies to restore */
+static void
+redir_push(redirs_t *r)
+{
+    move_t *m;
+
+    if (!r->count)
+        return;
+    out_flush();
+    fflush(stderr);
+    for (m = r->moves; m < r->moves + r->count; m++) {
+        m->saved = fcntl(m->fd, F_DUPFD_CLOEXEC, FIRST_SHELL_FD);
+        if (m->src < 0)
+            close(m->fd);
+        else
+            dup2(m->src, m->fd);
+    }
+}
+
+/* Undo redir_push, last move first */
+static void
+redir_pop(redirs_t *r)
+{
+    move_t *m;
+
+    if (!r->count)
+        return;
+    out_flush();
+    fflush(stderr);
+    for (m = r->moves + r->count - 1; m >= r->moves; m--) {
+        if (m->saved >= 0) {
+            dup2(m->saved, m->fd);
+            close(m->saved);
+        } else {
+            close(m->fd);
+        }
+    }
+    redir_close(r);
+}
+
+/* Close what redir_open opened */
+static void
+redir_close(redirs_t *r)
+{
+    for (int i = 0; i < r->count; i++)
+        if (r->moves[i].owned)
+            close(r->moves[i].src);
+    r->count = 0;
+}
+
+/*
+ * Run the command of a substitution and return what it wrote to stdout,
+ * valid until the next substitution. NULL if it could not be run.
+ */
+static const char *
+command_output(node_t *n, size_t *len)
+{
+    const char *out;
+    pid_t pid;
+    bool outer = capturing;
+    int fds[2], fd, saved, status;
+
+    *len = 0;
+    if (!n)
+        return "";
+
+    /*
+     * A built-in that only prints, like x=$(pwd), runs right here with its
+     * stdout pointed at a memory file, which is cheaper than fork and pipe
+     * and never blocks however much it writes.
+     */
+    if (runs_in_shell(n)) {
+        if (outer || capture_fd < 0) {
+            if ((fd = memory_fd("", 0)) < 0 || (fd = open_high(fd)) < 0)
+                return NULL;
+            if (!outer)
+                capture_fd = fd;
+        } else {
+            fd = capture_fd;
+        }
+
+        out_flush();
+        saved = fcntl(STDOUT_FILENO, F_DUPFD_CLOEXEC, FIRST_SHELL_FD);
+        dup2(fd, STDOUT_FILENO);
+        capturing = true;
+        execute(n);
+        capturing = outer;
+        out_flush();
+        if (saved >= 0) {
+            dup2(saved, STDOUT_FILENO);
+            close(saved);
+        } else {
+            close(STDOUT_FILENO);
+        }
+
+        out = read_capture(fd, len);
+        if (fd == capture_fd) {
+            ftruncate(fd, 0);
+            lseek(fd, 0, SEEK_SET);
+        } else {
+            close(fd);
+        }
+        return out;
+    }
+
+    if (pipe(fds) < 0) {
+        perror("shush: pipe");
+        return NULL;
+    }
+    fcntl(fds[0], F_SETFD, FD_CLOEXEC);
+    fcntl(fds[1], F_SETFD, FD_CLOEXEC);
+    out_flush();
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        signal(SIGINT, SIG_DFL);
+        job_control = false;
+        interactive = false;
+        dup2(fds[1], STDOUT_FILENO);
+        status = execute(n);
+        out_flush();
+        _exit(status);
+    }
+    close(fds[1]);
+    if (pid < 0) {
+        perror("shush: fork failed");
+        close(fds[0]);
+        return NULL;
+    }
+
+    /* Read in large chunks straight into the buffer, growing it as needed */
+    for (;;) {
+        ssize_t r;
+
+        capture_reserve(*len + 65536);
+        if ((r = read(fds[0], capture_buf + *len, capture_size - *len)) < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        *len += r;
+    }
+    close(fds[0]);
+
+    waitpid(pid, &status, 0);
+    last_exit_status = WIFEXITED(status) ? WEXITSTATUS(status) : 1;
+    return capture_buf;
+}
+
+/*
+ * Can a substitution run n without a subshell? Only a simple command
+ * naming a built-in that leaves no trace in the shell, whose words have
+ * no $(( )), ${name=word} or ${name?word} that could assign to a
+ * variable or exit.
+ */
+static bool
+runs_in_shell(node_t *n)
+{
+    const char *name;
+
+    if (n->type != N_CMD || (n->flags & NODE_BG) || !n->words ||
+        !(name = word_literal(n->words)) || !is_pure_builtin(name) || find_function(name))
+        return false;
+    for (word_t *w = n->words; w; w = w->next)
+        if (has_effects(w))
+            return false;
+    return true;
+}
+
+/* Does expanding w, or a word nested in one of its ${ }, touch the shell? */
+static bool
+has_effects(word_t *w)
+{
+    for (; w; w = w->next) {
+        for (word_part_t *wp = w->parts; wp; wp = wp->next) {
+            if (wp->type == WP_ARITH)
+                return true;
+            if (wp->type != WP_PARAM)
+                continue;
+            if (wp->op == PO_ASSIGN || wp->op == PO_ERROR ||
+                has_effects(wp->subscript) || has_effects(wp->word) || has_effects(wp->word2))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Everything written to the memory file fd, read with one pread */
+static const char *
+read_capture(int fd, size_t *len)
+{
+    off_t size = lseek(fd, 0, SEEK_CUR);
+    ssize_t r;
+
+    *len = 0;
+    if (size <= 0)
+        return "";
+    capture_reserve(size);
+    while (*len < (size_t)size) {
+        if ((r = pread(fd, capture_buf + *len, size - *len, *len)) < 0 && errno == EINTR)
+            continue;
+        if (r <= 0)
+            break;
+        *len += r;
+    }
+    return capture_buf;
+}
+
+static void
+capture_reserve(size_t size)
+{
+    if (size <= capture_size)
+        return;
+    capture_size = capture_size ? capture_size : 65536;
+    while (capture_size < size)
+        capture_size *= 2;
+    if (!(capture_buf = realloc(capture_buf, capture_size))) {
+        perror("realloc");
+        exit(1);
+    }
+}
+
+static void
+sb_append(strbuf_t *sb, const char *s, size_t n)
+{
+    if (sb->len + n + 1 > sb->size) {
+        size_t size = sb->size * 2;
+        char *buf;
+
+        while (size < sb->len + n + 1)
+            size *= 2;
+        buf = sb->heap ? realloc(sb->buf, size) : malloc(size);
+        if (!buf) {
+            perror("malloc");
+            exit(1);
+        }
+        if (!sb->heap)
+            memcpy(buf, sb->buf, sb->len);
+        sb->buf = buf;
+        sb->size = size;
+        sb->heap = true;
+    }
+    memcpy(sb->buf + sb->len, s, n);
+    sb->len += n;
+}
+
+/* Finish the current field, if there is one, and start a new one */
+static void
+field_end(expand_t *e)
+{
+    field_t *f;
+
+    if (!e->have && !e->sb.len)
+        return;
+    if (e->magic && field_paths(e))
+        return;
+
+    f = arena_alloc(&scratch, sizeof(*f));
+    f->text = arena_strndup(&scratch, e->sb.buf, e->sb.len);
+    f->next = NULL;
+    *e->tail = f;
+    e->tail = &f->next;
+    e->count++;
+
+    e->sb.len = 0;
+    e->have = false;
+}
+
+/*
+ * A field that is a pattern becomes the paths it matches, sorted, one
+ * field each. False when none match and it stays as it is.
+ */
+static bool
+field_paths(expand_t *e)
+{
+    strbuf_t *pattern = e->escaped ? &e->glob : &e->sb;
+    char **paths = NULL;
+    size_t n;
+    field_t *f;
+
+    pattern->buf[pattern->len] = '\0';
+    if (glob_magic(pattern->buf, pattern->len))
+        paths = glob_expand(&scratch, pattern->buf, &n);
+    e->magic = e->escaped = false;
+    e->glob.len = 0;
+    if (!paths)
+        return false;
+
+    for (size_t i = 0; i < n; i++) {
+        f = arena_alloc(&scratch, sizeof(*f));
+        f->text = paths[i];
+        f->next = NULL;
+        *e->tail = f;
+        e->tail = &f->next;
+        e->count++;
+    }
+    e->sb.len = 0;
+    e->have = false;
+    return true;
+}
+
+/*
+ * Note text about to go in the field: whether it makes the field a
+ * pattern, and its pattern form once quoted characters need escaping.
+ * Until one does the field is its own pattern.
+ */
+static void
+add_glob(expand_t *e, const char *s, size_t n, bool quoted)
+{
+    size_t i, run;
+
+    if (!quoted) {
+        e->magic = e->magic || memchr(s, '*', n) || memchr(s, '?', n) || memchr(s, '[', n);
+        if (e->escaped)
+            sb_append(&e->glob, s, n);
+        return;
+    }
+    if (!e->escaped) {
+        for (i = 0; i < n && !(s[i] && strchr("*?[]\\", s[i])); i++)
+            ;
+        if (i == n)
+            return;
+        sb_append(&e->glob, e->sb.buf, e->sb.len);
+        e->escaped = true;
+    }
+    for (i = 0; i < n; i = run) {
+        for (run = i; run < n && !(s[run] && strchr("*?[]\\", s[run])); run++)
+            ;
+        sb_append(&e->glob, s + i, run - i);
+        if (run < n) {
+            sb_append(&e->glob, "\\", 1);
+            sb_append(&e->glob, s + run++, 1);
+        }
+    }
+}
+
+/* Append text that is not subject to splitting */
+static void
+add_text(expand_t *e, const char *s, size_t n, bool quoted)
+{
+    e->have = true;
+    if (e->globbing)
+        add_glob(e, s, n, quoted);
+    if (!quoted || !e->pattern) {
+        sb_append(&e->sb, s, n);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (strchr("*?[]\\.+^$(){}|", s[i]))
+            sb_append(&e->sb, "\\", 1);
+        sb_append(&e->sb, s + i, 1);
+    }
+}
+
+/* Append an unquoted expansion, splitting it into fields on IFS */
+static void
+add_split(expand_t *e, const char *s, size_t n)
+{
+    if (!e->split) {
+        add_text(e, s, n, false);
+        return;
+    }
+    for (size_t i = 0; i < n; i++) {
+        if (!strchr(e->ifs, s[i])) {
+            size_t run = i;
+
+            while (run < n && !strchr(e->ifs, s[run]))
+                run++;
+            if (e->globbing)
+                add_glob(e, s + i, run - i, false);
+            sb_append(&e->sb, s + i, run - i);
+            e->have = true;
+            i = run - 1;
+        } else if (isspace((unsigned char)s[i])) {
+            field_end(e);
+        } else {
+            /* A non-blank IFS character always ends a field */
+            e->have = true;
+            field_end(e);
+        }
+    }
+}
+
+/* Value of $name, NULL when unset. num is scratch space for numbers */
+const char *
+param_value(const char *name, char *num, size_t num_size)
+{
+    if (isdigit((unsigned char)name[0])) {
+        int i = atoi(name);
+
+        return i < positional_count ? positional[i] : NULL;
+    }
+
+    if (!name[1]) {
+        switch (name[0]) {
+        case '#':
+            snprintf(num, num_size, "%d", positional_count > 0 ? positional_count - 1 : 0);
+            return num;
+        case '?':
+            snprintf(num, num_size, "%d", last_exit_status);
+            return num;
+        case '$':
+            snprintf(num, num_size, "%d", (int)getpid());
+            return num;
+        case '!':
+            if (!job_last_pid())
+                return NULL;
+            snprintf(num, num_size, "%d", (int)job_last_pid());
+            return num;
+        case '-':
+            return NULL;
+        }
+    }
+
+    return var_get(name);
+}
+
+/*
+ * Append the values of "$@" or "${name[@]}", with at each a field of its
+ * own in quotes, else joined by the first character of IFS.
+ */
+static void
+add_list(expand_t *e, bool quoted, const char *const *values, size_t n, bool at)
+{
+    for (size_t i = 0; i < n; i++) {
+        if (!quoted && e->split) {
+            if (i > 0)
+                field_end(e);
+            add_split(e, values[i], strlen(values[i]));
+            continue;
+        }
+        if (i > 0) {
+            if (at && e->split) {
+                e->have = true;
+                field_end(e);
+            } else if (*e->ifs) {
+                if (e->globbing)
+                    add_glob(e, e->ifs, 1, quoted);
+                sb_append(&e->sb, e->ifs, 1);
+            }
+        }
+        add_text(e, values[i], strlen(values[i]), quoted);
+    }
+}
+
+/* Value of the parameter of wp or of its element, NULL when unset */
+static const char *
+param_element(expand_t *e, word_part_t *wp, char *num, size_t num_size)
+{
+    const char *key;
+
+    if (!wp->subscript)
+        return param_value(wp->text, num, num_size);
+    if (!(key = expand_one(e->ast, wp->subscript, false))) {
+        e->failed = true;
+        return NULL;
+    }
+    return var_element(wp->text, key);
+}
+
+/*
+ * The -, =, ? and + operators, set when the parameter has a value that
+ * counts. Returns whether its value expands, possibly the one = gave it,
+ * or false when the word was added in its place or there was an error.
+ */
+static bool
+use_value(expand_t *e, word_part_t *wp, const char **val, bool set)
+{
+    const char *key = NULL;
+    char *word;
+
+    if (wp->op == PO_ALTERNATE) {
+        if (wp->quoted)
+            add_text(e, "", 0, true);
+        if (set)
+            add_parts(e, wp->word);
+        return false;
+    }
+    if (set)
+        return true;
+
+    switch (wp->op) {
+    case PO_DEFAULT:
+        if (wp->quoted)
+            add_text(e, "", 0, true);
+        add_parts(e, wp->word);
+        return false;
+    case PO_ASSIGN:
+        if (!var_valid_name(wp->text, strlen(wp->text)) || (wp->flags & (PARAM_ALL | PARAM_JOIN))) {
+            fprintf(stderr, "shush: $%s: cannot assign in this way\n", wp->text);
+            break;
+        }
+        if (!(word = expand_one(e->ast, wp->word, false)) ||
+            (wp->subscript && !(key = expand_one(e->ast, wp->subscript, false))))
+            break;
+        if (!(key ? var_set_element(wp->text, key, word, strlen(word)) : var_set(wp->text, word, 0)))
+            break;
+        *val = word;
+        return true;
+    case PO_ERROR:
+        if (!wp->word->parts)
+            word = "parameter null or not set";
+        else if (!(word = expand_one(e->ast, wp->word, false)))
+            break;
+        fprintf(stderr, "shush: %s: %s\n", wp->text, word);
+        /* Only an interactive shell goes on with the next command */
+        if (!interactive)
+            exit(1);
+        break;
+    }
+    e->failed = true;
+    return false;
+}
+
+static void
+op_add(const char *s, size_t n)
+{
+    if (op_len + n > op_size) {
+        op_size = op_size ? op_size : 256;
+        while (op_size < op_len + n)
+            op_size *= 2;
+        if (!(op_buf = realloc(op_buf, op_size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    memcpy(op_buf + op_len, s, n);
+    op_len += n;
+}
+
+/* The part of len bytes or elements that :offset:length takes */
+static bool
+substring(word_part_t *wp, arena_t *ast, size_t len, size_t *start, size_t *n)
+{
+    long long off, count;
+
+    if (!operand_value(wp->word, ast, &off) || (wp->word2 && !operand_value(wp->word2, ast, &count)))
+        return false;
+    /* Negative numbers count from the end */
+    if (off < 0)
+        off += len;
+    if (off < 0 || (size_t)off > len)
+        off = len;
+    if (!wp->word2 || count > (long long)(len - off))
+        count = len - off;
+    else if (count < 0 && (count += len - off) < 0) {
+        fprintf(stderr, "shush: %s: substring expression < 0\n", wp->text);
+        return false;
+    }
+    *start = off;
+    *n = count;
+    return true;
+}
+
+/* /pattern/string of the len bytes of val, built in op_buf */
+static const char *
+replace(expand_t *e, word_part_t *wp, const pattern_t *pat, const char *val, size_t len, size_t *n)
+{
+    const char *with = "";
+    size_t with_len, i = 0, start, m;
+
+    if (wp->word2 && !(with = expand_one(e->ast, wp->word2, false)))
+        return NULL;
+    with_len = strlen(with);
+
+    op_len = 0;
+    if (wp->flags & PARAM_START) {
+        if ((m = pattern_prefix(pat, val, len, true)) != PATTERN_NONE) {
+            op_add(with, with_len);
+            i = m;
+        }
+    } else if (wp->flags & PARAM_END) {
+        if ((start = pattern_suffix(pat, val, len, true)) != PATTERN_NONE) {
+            op_add(val, start);
+            op_add(with, with_len);
+            i = len;
+        }
+    } else {
+        /* An empty match replaces nothing, or it would never end */
+        while ((m = pattern_find(pat, val + i, len - i, &start)) != PATTERN_NONE && m > 0) {
+            op_add(val + i, start);
+            op_add(with, with_len);
+            i += start + m;
+            if (!(wp->flags & PARAM_DOUBLE))
+                break;
+        }
+    }
+    op_add(val + i, len - i);
+    *n = op_len;
+    return op_buf;
+}
+
+/*
+ * The pattern and substring operators on the len bytes of val. Returns
+ * the result, with its length in n, or NULL when an expansion failed.
+ * What is not a part of val is in op_buf, until the next operator.
+ */
+static const char *
+apply_op(expand_t *e, word_part_t *wp, const char *val, size_t len, size_t *n)
+{
+    bool twice = wp->flags & PARAM_DOUBLE;
+    pattern_t *pat = NULL;
+    size_t i;
+
+    if (wp->op == PO_SUBSTRING)
+        return substring(wp, e->ast, len, &i, n) ? val + i : NULL;
+    /* ${name^} and ${name,} without a pattern take any character */
+    if ((wp->word->parts || wp->op < PO_UPPER) && !(pat = compile_pattern(e->ast, wp->word)))
+        return NULL;
+
+    switch (wp->op) {
+    case PO_PREFIX:
+        i = pattern_prefix(pat, val, len, twice);
+        *n = i == PATTERN_NONE ? len : len - i;
+        return i == PATTERN_NONE ? val : val + i;
+    case PO_SUFFIX:
+        i = pattern_suffix(pat, val, len, twice);
+        *n = i == PATTERN_NONE ? len : i;
+        return val;
+    case PO_REPLACE:
+        return replace(e, wp, pat, val, len, n);
+    }
+
+    op_len = 0;
+    op_add(val, len);
+    for (i = 0; i < len && (twice || i == 0); i++)
+        if (!pat || pattern_match(pat, val + i, 1))
+            op_buf[i] = wp->op == PO_UPPER ? toupper((unsigned char)val[i]) :
+                        tolower((unsigned char)val[i]);
+    *n = len;
+    return op_buf;
+}
+
+static void
+add_param(expand_t *e, word_part_t *wp)
+{
+    bool params = (wp->text[0] == '@' || wp->text[0] == '*') && !wp->text[1];
+    const char *val, *key, **values;
+    size_t n, len, start, pos = 0;
+    char num[32];
+
+    if (wp->flags & PARAM_LENGTH) {
+        if (params)
+            n = positional_count > 1 ? positional_count - 1 : 0;
+        else if (wp->flags & (PARAM_ALL | PARAM_JOIN))
+            n = var_count(wp->text);
+        else
+            n = (val = param_element(e, wp, num, sizeof(num))) ? strlen(val) : 0;
+        snprintf(num, sizeof(num), "%zu", n);
+        if (wp->quoted)
+            add_text(e, num, strlen(num), true);
+        else
+            add_split(e, num, strlen(num));
+        return;
+    }
+
+    /* "$@" and "${name[@]}" keep every value a separate field */
+    if (params || (wp->flags & (PARAM_ALL | PARAM_JOIN))) {
+        if (params) {
+            /* ${@:offset} counts $0 as the first */
+            start = wp->op == PO_SUBSTRING ? 0 : 1;
+            values = (const char **)positional + start;
+            n = positional_count > (int)start ? positional_count - start : 0;
+        } else {
+            values = arena_alloc(&scratch, (var_count(wp->text) + 1) * sizeof(*values));
+            for (n = 0; (val = var_next(wp->text, &pos, &key)); n++)
+                values[n] = wp->flags & PARAM_KEYS ? arena_strndup(&scratch, key, strlen(key)) : val;
+        }
+
+        if (wp->op == PO_SUBSTRING) {
+            if (!substring(wp, e->ast, n, &start, &n)) {
+                e->failed = true;
+                return;
+            }
+            values += start;
+        } else if (wp->op >= PO_PREFIX) {
+            /* Each value on its own */
+            const char **copy = arena_alloc(&scratch, (n + 1) * sizeof(*copy));
+
+            for (size_t i = 0; i < n; i++) {
+                if (!(val = apply_op(e, wp, values[i], strlen(values[i]), &len))) {
+                    e->failed = true;
+                    return;
+                }
+                copy[i] = arena_strndup(&scratch, val, len);
+            }
+            values = copy;
+        } else if (wp->op && !use_value(e, wp, &val, n > 1 ||
+                   (n == 1 && (!(wp->flags & PARAM_COLON) || *values[0])))) {
+            return;
+        }
+        add_list(e, wp->quoted, values, n, params ? wp->text[0] == '@' : wp->flags & PARAM_ALL);
+        return;
+    }
+
+    val = param_element(e, wp, num, sizeof(num));
+    if (wp->op && wp->op < PO_PREFIX &&
+        !use_value(e, wp, &val, val && (!(wp->flags & PARAM_COLON) || *val)))
+        return;
+    len = val ? strlen(val) : 0;
+    if (val && wp->op >= PO_PREFIX && !(val = apply_op(e, wp, val, len, &len))) {
+        e->failed = true;
+        return;
+    }
+    if (wp->quoted)
+        add_text(e, val ? val : "", len, true);
+    else if (val)
+        add_split(e, val, len);
+}
+
+/*
+ * Evaluate $(( )), parsing it into the arena of its AST the first time.
+ * One with expansions is expanded and parsed again each time.
+ */
+static bool
+arith_value(word_part_t *wp, arena_t *ast, long long *v)
+{
+    const char *err;
+    char *text;
+
+    if (wp->type == WP_ARITH && wp->word) {
+        if (!(text = expand_one(ast, wp->word, false)))
+            return false;
+        return arith_eval_string(text, v);
+    }
+    if (!wp->arith && !(wp->arith = arith_parse(ast, wp->text, wp->len, &err))) {
+        fprintf(stderr, "shush: %s: %s\n", wp->text, err);
+        return false;
+    }
+    return arith_eval(wp->arith, v);
+}
+
+/* Append the parts of w, without ending the field */
+static void
+add_parts(expand_t *e, word_t *w)
+{
+    char num[32];
+    const char *val;
+    long long v;
+    size_t len;
+
+    for (word_part_t *wp = w->parts; wp; wp = wp->next) {
+        switch (wp->type) {
+        case WP_LITERAL:
+            add_text(e, wp->text, wp->len, wp->quoted);
+            break;
+        case WP_TILDE:
+            val = home_directory ? home_directory : "";
+            add_text(e, val, strlen(val), true);
+            break;
+        case WP_ARITH:
+            if (!arith_value(wp, e->ast, &v)) {
+                e->failed = true;
+                break;
+            }
+            snprintf(num, sizeof(num), "%lld", v);
+            if (wp->quoted)
+                add_text(e, num, strlen(num), true);
+            else
+                add_split(e, num, strlen(num));
+            break;
+        case WP_CMDSUB:
+            if (!(val = command_output(wp->node, &len))) {
+                e->failed = true;
+                break;
+            }
+            while (len > 0 && val[len - 1] == '\n')
+                len--;
+            if (wp->quoted)
+                add_text(e, val, len, true);
+            else
+                add_split(e, val, len);
+            break;
+        case WP_PARAM:
+            add_param(e, wp);
+            break;
+        }
+    }
+}
+
+static void
+expand_word(expand_t *e, word_t *w)
+{
+    add_parts(e, w);
+    field_end(e);
+}
+
+/*
+ * The offset or length of ${name:offset:length}. Without expansions it
+ * is parsed into the arena of its AST once, like $(( )).
+ */
+static bool
+operand_value(word_t *w, arena_t *ast, long long *v)
+{
+    word_part_t *wp = w->parts;
+    char *text, *end;
+
+    if (!wp) {
+        *v = 0;
+        return true;
+    }
+    if (!wp->next && wp->type == WP_LITERAL)
+        return arith_value(wp, ast, v);
+    if (!(text = expand_one(ast, w, false)))
+        return false;
+    *v = strtoll(text, &end, 10);
+    return (*text && !*end) || arith_eval_string(text, v);
+}
+
+static void
+expand_init(expand_t *e, arena_t *ast, char *buf, size_t size)
+{
+    memset(e, 0, sizeof(*e));
+    e->ast = ast;
+    e->sb.buf = buf;
+    e->sb.size = size;
+    e->tail = &e->head;
+    e->ifs = var_get("IFS");
+    if (!e->ifs)
+        e->ifs = " \t\n";
+}
+
+/*
+ * Expand a list of words into a NULL terminated argument vector, or
+ * NULL when an expansion failed. ast is the arena the words are in.
+ */
+char **
+expand_words(arena_t *ast, word_t *words, int *argc)
+{
+    char stack_buf[256], glob_buf[256];
+    expand_t e;
+    char **argv;
+    int i = 0;
+
+    expand_init(&e, ast, stack_buf, sizeof(stack_buf));
+    e.split = true;
+    e.globbing = true;
+    e.glob.buf = glob_buf;
+    e.glob.size = sizeof(glob_buf);
+
+    for (word_t *w = words; w; w = w->next)
+        expand_word(&e, w);
+
+    if (e.sb.heap)
+        free(e.sb.buf);
+    if (e.glob.heap)
+        free(e.glob.buf);
+    *argc = e.count;
+    if (e.failed)
+        return NULL;
+
+    argv = arena_alloc(&scratch, (e.count + 1) * sizeof(char *));
+    for (field_t *f = e.head; f; f = f->next)
+        argv[i++] = f->text;
+    argv[i] = NULL;
+    return argv;
+}
+
+/* The words of [[ ]]: one argument each, quoted characters escaped */
+static char **
+expand_cond(arena_t *ast, word_t *words, int *argc)
+{
+    char **argv;
+    word_t *w;
+    int i = 0;
+
+    for (w = words; w; w = w->next)
+        i++;
+    argv = arena_alloc(&scratch, (i + 1) * sizeof(char *));
+    argv[0] = "[[";
+    for (i = 1, w = words->next; w; w = w->next)
+        if (!(argv[i++] = expand_pattern(ast, w)))
+            return NULL;
+    argv[i] = NULL;
+    *argc = i;
+    return argv;
+}
+
+/* Expand one word into a single string, without field splitting */
+static char *
+expand_one(arena_t *ast, word_t *w, bool pattern)
+{
+    char stack_buf[256];
+    expand_t e;
+
+    expand_init(&e, ast, stack_buf, sizeof(stack_buf));
+    e.pattern = pattern;
+    e.have = true;
+    expand_word(&e, w);
+    if (e.sb.heap)
+        free(e.sb.buf);
+    return e.failed ? NULL : e.head->text;
+}
+
+char *
+expand_string(arena_t *ast, word_t *w)
+{
+    return expand_one(ast, w, false);
+}
+
+/* Like expand_string, with quoted characters escaped for patterns */
+char *
+expand_pattern(arena_t *ast, word_t *w)
+{
+    return expand_one(ast, w, true);
+}
+
+/*
+ * The compiled pattern of w, NULL when its expansion failed. One with no
+ * expansions is compiled into the arena of its AST once and kept on its
+ * first part, the others come from the pattern cache.
+ */
+pattern_t *
+compile_pattern(arena_t *ast, word_t *w)
+{
+    word_part_t *wp = w->parts;
+    char *src;
+
+    if (wp && wp->pattern)
+        return wp->pattern;
+    if (!(src = expand_pattern(ast, w)))
+        return NULL;
+    for (; wp && wp->type == WP_LITERAL; wp = wp->next)
+        ;
+    if (!w->parts || wp)
+        return pattern_get(src);
+    return w->parts->pattern = pattern_compile(ast, src);
+}
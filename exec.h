@@ -0,0 +1,45 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ */
+#ifndef EXEC_H
+#define EXEC_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <signal.h>
+#include <sys/types.h>
+
+#include "arena.h"
+#include "parse.h"
+#include "pattern.h"
+
+/* Expanded words live here until their command is done */
+extern arena_t scratch;
+
+/* Pending break, continue and return, cleared by whoever they unwind to */
+extern int breaking;
+extern int continuing;
+extern bool returning;
+extern int loop_depth;          /* loops running in the current function */
+extern volatile sig_atomic_t interrupted;       /* ^C, stops all that runs */
+extern int function_depth;
+extern bool interactive;                /* reading commands from a terminal, not a child */
+
+void set_debug(bool mode);
+void set_positional_params(int argc, char *argv[]);
+int execute(node_t *n);
+size_t execute_buffer(const char *src, size_t len, bool eof, int sync_fd, off_t sync_base);
+void parse_and_execute(char *line);
+char **expand_words(arena_t *ast, word_t *words, int *argc);
+char *expand_string(arena_t *ast, word_t *w);
+char *expand_pattern(arena_t *ast, word_t *w);
+pattern_t *compile_pattern(arena_t *ast, word_t *w);
+const char *param_value(const char *name, char *num, size_t num_size);
+bool assign_array(const char *name);
+bool unset_function(const char *name);
+void for_each_function(void (*visit)(const char *name));
+pid_t exec_async(int argc, char *args[], int in, int out, int err);
+int memory_fd(const char *text, size_t len);
+
+#endif /* EXEC_H */
@@ -0,0 +1,470 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Pathname expansion for Simple Humane Shell (shush).
+ *
+ * A pattern is cut at its slashes into components, each compiled once
+ * into a matcher for every entry it is tried on. Directories are read
+ * with getdents64 in large batches, and the d_type of each entry tells
+ * directories apart, so only symlinks, and file systems that leave it
+ * unknown, cost a stat. A ** component stands for any number of
+ * directories, and it is matched in the same pass over each directory
+ * as the component after it.
+ *
+ * The directories left to read wait in a queue. The shell works through
+ * it alone, unless a ** is in the pattern and GLOB_THREADS is set above
+ * one: then that many threads take from the queue at once, which pays
+ * off on big trees.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <stdbool.h>
+
+#include "arena.h"
+#include "exec.h"
+#include "glob.h"
+#include "pattern.h"
+#include "var.h"
+
+#define MAX_COMPONENTS 256
+#define MAX_WALKERS    64
+#define DIRENT_BATCH   131072   /* bytes of entries asked for at a time */
+
+/* What getdents64 fills the buffer with */
+typedef struct {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+} dirent64_t;
+
+typedef struct {
+    const char *name;       /* without backslashes, for a literal one */
+    pattern_t *pattern;     /* NULL for a literal one */
+    bool globstar;          /* ** */
+    bool hidden;            /* may match names that start with '.' */
+} component_t;
+
+/* A directory to go on from, with the component for its entries */
+typedef struct {
+    const char *path;
+    int comp;
+} task_t;
+
+struct walk;
+
+typedef struct {
+    struct walk *w;
+    arena_t arena;          /* of the paths it found and queued */
+    const char **found;
+    size_t count;
+    size_t size;
+    char *batch;            /* DIRENT_BATCH bytes */
+    pthread_t thread;
+} walker_t;
+
+typedef struct walk {
+    component_t comps[MAX_COMPONENTS];
+    int ncomps;
+    bool dir_only;          /* the pattern ends in '/' */
+    task_t *tasks;          /* a stack, so the walk goes deep first */
+    size_t ntasks;
+    size_t tasks_size;
+    int busy;               /* walkers going through a task */
+    pthread_mutex_t lock;
+    pthread_cond_t wake;
+} walk_t;
+
+/* The batch of the shell's own walker, kept from one expansion to the next */
+static char *own_batch = NULL;
+
+/* Function Prototypes */
+static char *unescape(arena_t *a, const char *s, size_t n);
+static bool compile(walk_t *w, arena_t *a, const char *pattern);
+static size_t join(char *path, size_t len, const char *name, size_t n);
+static void push(walker_t *k, const char *path, size_t len, int comp);
+static void found(walker_t *k, const char *path, size_t len, bool slash);
+static bool is_dir(int fd, const dirent64_t *d, bool follow);
+static bool matches(const component_t *c, const char *name, size_t n);
+static void take(walker_t *k, int fd, const dirent64_t *d, char *path, size_t len, int i);
+static void read_dir(walker_t *k, char *path, size_t len, int i);
+static void visit(walker_t *k, const char *dir, int i);
+static void *walk(void *arg);
+static int compare_paths(const void *a, const void *b);
+
+/*
+ * Whether the n bytes of pattern have a * or ?, or a '[' with a ']' to
+ * close it, that a backslash does not quote. [ alone is a command.
+ */
+bool
+glob_magic(const char *s, size_t n)
+{
+    size_t j;
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\\') {
+            i++;
+        } else if (s[i] == '*' || s[i] == '?') {
+            return true;
+        } else if (s[i] == '[') {
+            j = i + 1 < n && (s[i + 1] == '!' || s[i + 1] == '^') ? i + 2 : i + 1;
+            if (j < n && s[j] == ']')
+                j++;
+            if (j < n && memchr(s + j, ']', n - j))
+                return true;
+        }
+    }
+    return false;
+}
+
+/* n bytes of s, without the backslashes that quote */
+static char *
+unescape(arena_t *a, const char *s, size_t n)
+{
+    char *t = arena_alloc(a, n + 1);
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] == '\\' && i + 1 < n)
+            i++;
+        t[len++] = s[i];
+    }
+    t[len] = '\0';
+    return t;
+}
+
+/*
+ * Cut pattern into the components of w. False when it has too many, or
+ * none of them is a pattern and there is nothing to look for.
+ */
+static bool
+compile(walk_t *w, arena_t *a, const char *pattern)
+{
+    const char *s = pattern, *start;
+    bool magic = false;
+    component_t *c;
+    size_t n;
+
+    while (*s == '/')
+        s++;
+    while (*s) {
+        for (start = s; *s && *s != '/'; s++)
+            if (*s == '\\' && s[1] && s[1] != '/')
+                s++;
+        n = s - start;
+        while (*s == '/')
+            s++;
+        w->dir_only = !*s && s[-1] == '/';
+
+        /* ** twice in a row is the same as once */
+        if (n == 2 && !memcmp(start, "**", 2) && w->ncomps && w->comps[w->ncomps - 1].globstar)
+            continue;
+        if (w->ncomps == MAX_COMPONENTS)
+            return false;
+        c = &w->comps[w->ncomps++];
+        memset(c, 0, sizeof(*c));
+        if (n == 2 && !memcmp(start, "**", 2)) {
+            c->globstar = magic = true;
+        } else if (glob_magic(start, n)) {
+            magic = true;
+            c->pattern = pattern_compile(a, arena_strndup(a, start, n));
+            c->hidden = start[0] == '.' || (start[0] == '\\' && start[1] == '.');
+        } else {
+            c->name = unescape(a, start, n);
+        }
+    }
+    return magic;
+}
+
+/* Add name to the path of len bytes, returning the new length, 0 if too long */
+static size_t
+join(char *path, size_t len, const char *name, size_t n)
+{
+    if (len + n + 2 > PATH_MAX)
+        return 0;
+    if (len && path[len - 1] != '/')
+        path[len++] = '/';
+    memcpy(path + len, name, n);
+    path[len + n] = '\0';
+    return len + n;
+}
+
+/* Queue the path of len bytes, to go on from with component comp */
+static void
+push(walker_t *k, const char *path, size_t len, int comp)
+{
+    walk_t *w = k->w;
+    const char *copy = arena_strndup(&k->arena, path, len);
+
+    pthread_mutex_lock(&w->lock);
+    if (w->ntasks == w->tasks_size) {
+        w->tasks_size = w->tasks_size ? w->tasks_size * 2 : 64;
+        if (!(w->tasks = realloc(w->tasks, w->tasks_size * sizeof(*w->tasks)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    w->tasks[w->ntasks++] = (task_t){ copy, comp };
+    pthread_cond_signal(&w->wake);
+    pthread_mutex_unlock(&w->lock);
+}
+
+static void
+found(walker_t *k, const char *path, size_t len, bool slash)
+{
+    char *copy = arena_alloc(&k->arena, len + 2);
+
+    memcpy(copy, path, len);
+    if (slash)
+        copy[len++] = '/';
+    copy[len] = '\0';
+    if (k->count == k->size) {
+        k->size = k->size ? k->size * 2 : 64;
+        if (!(k->found = realloc(k->found, k->size * sizeof(*k->found)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    k->found[k->count++] = copy;
+}
+
+/*
+ * Whether the entry d of the directory fd is one, by its d_type when
+ * that is enough. Symlinks to directories only count with follow.
+ */
+static bool
+is_dir(int fd, const dirent64_t *d, bool follow)
+{
+    struct stat st;
+
+    if (d->d_type == DT_DIR)
+        return true;
+    if (d->d_type != DT_UNKNOWN && (d->d_type != DT_LNK || !follow))
+        return false;
+    return !fstatat(fd, d->d_name, &st, follow ? 0 : AT_SYMLINK_NOFOLLOW) && S_ISDIR(st.st_mode);
+}
+
+/* Whether the name of n bytes matches c, a literal or a pattern */
+static bool
+matches(const component_t *c, const char *name, size_t n)
+{
+    if (!c->pattern)
+        return !strcmp(c->name, name);
+    return (name[0] != '.' || c->hidden) && pattern_match(c->pattern, name, n);
+}
+
+/* The entry d of the directory fd at path matched component i */
+static void
+take(walker_t *k, int fd, const dirent64_t *d, char *path, size_t len, int i)
+{
+    walk_t *w = k->w;
+    size_t n = strlen(d->d_name), end;
+
+    if (!(end = join(path, len, d->d_name, n)))
+        return;
+    if (i + 1 == w->ncomps) {
+        if (!w->dir_only || is_dir(fd, d, true))
+            found(k, path, end, w->dir_only);
+    } else if (is_dir(fd, d, true)) {
+        /* A ** at the end takes the directory it starts from too */
+        if (i + 2 == w->ncomps && w->comps[i + 1].globstar)
+            found(k, path, end, true);
+        push(k, path, end, i + 1);
+    }
+    path[len] = '\0';
+}
+
+/*
+ * Read the directory at path, of len bytes, and match its entries with
+ * component i. For a ** they are matched with the component after it as
+ * well, and the directories among them are queued to read with the **
+ * again.
+ */
+static void
+read_dir(walker_t *k, char *path, size_t len, int i)
+{
+    walk_t *w = k->w;
+    const component_t *c = &w->comps[i], *next = i + 1 < w->ncomps ? c + 1 : NULL;
+    const dirent64_t *d;
+    const char *name;
+    size_t n, end;
+    long got;
+    int fd;
+
+    if ((fd = open(len ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC)) < 0)
+        return;
+    while (!interrupted && (got = syscall(SYS_getdents64, fd, k->batch, DIRENT_BATCH)) > 0) {
+        for (long off = 0; off < got; off += d->d_reclen) {
+            d = (const dirent64_t *)(k->batch + off);
+            name = d->d_name;
+            if (name[0] == '.' && (!name[1] || (name[1] == '.' && !name[2])))
+                continue;
+            n = strlen(name);
+            if (!c->globstar) {
+                if (matches(c, name, n))
+                    take(k, fd, d, path, len, i);
+                continue;
+            }
+            /* ** never goes into hidden directories */
+            if (next && matches(next, name, n))
+                take(k, fd, d, path, len, i + 1);
+            if (name[0] == '.')
+                continue;
+            if (!next && (!w->dir_only || is_dir(fd, d, true)) && (end = join(path, len, name, n)))
+                found(k, path, end, w->dir_only);
+            if (is_dir(fd, d, false) && (end = join(path, len, name, n)))
+                push(k, path, end, i);
+            path[len] = '\0';
+        }
+    }
+    close(fd);
+}
+
+/* Go on from dir with component i, through literal components at once */
+static void
+visit(walker_t *k, const char *dir, int i)
+{
+    walk_t *w = k->w;
+    char path[PATH_MAX];
+    size_t len = strlen(dir);
+    struct stat st;
+    int first = i;
+
+    memcpy(path, dir, len + 1);
+    for (; i < w->ncomps && !w->comps[i].pattern && !w->comps[i].globstar; i++)
+        if (!(len = join(path, len, w->comps[i].name, strlen(w->comps[i].name))))
+            return;
+    if (i > first && i + 1 == w->ncomps && w->comps[i].globstar &&
+        !stat(path, &st) && S_ISDIR(st.st_mode))
+        found(k, path, len, true);
+    if (i < w->ncomps)
+        read_dir(k, path, len, i);
+    else if (w->dir_only ? !stat(path, &st) && S_ISDIR(st.st_mode) : !lstat(path, &st))
+        found(k, path, len, w->dir_only);
+}
+
+/* Take tasks from the queue until it is empty and no walker can add more */
+static void *
+walk(void *arg)
+{
+    walker_t *k = arg;
+    walk_t *w = k->w;
+    task_t t;
+
+    for (;;) {
+        pthread_mutex_lock(&w->lock);
+        while (!w->ntasks && w->busy && !interrupted)
+            pthread_cond_wait(&w->wake, &w->lock);
+        if (!w->ntasks || interrupted) {
+            pthread_cond_broadcast(&w->wake);
+            pthread_mutex_unlock(&w->lock);
+            return NULL;
+        }
+        t = w->tasks[--w->ntasks];
+        w->busy++;
+        pthread_mutex_unlock(&w->lock);
+
+        visit(k, t.path, t.comp);
+
+        pthread_mutex_lock(&w->lock);
+        if (!--w->busy && !w->ntasks)
+            pthread_cond_broadcast(&w->wake);
+        pthread_mutex_unlock(&w->lock);
+    }
+}
+
+static int
+compare_paths(const void *a, const void *b)
+{
+    return strcmp(*(const char *const *)a, *(const char *const *)b);
+}
+
+/*
+ * The paths pattern matches, sorted and allocated in a, or NULL when
+ * there are none. Quoted characters in pattern are escaped.
+ */
+char **
+glob_expand(arena_t *a, const char *pattern, size_t *count)
+{
+    walker_t walkers[MAX_WALKERS];
+    const char *threads;
+    sigset_t all, old;
+    char **paths = NULL;
+    int nwalkers = 1, i, n = 0;
+    arena_t arena = { 0 };
+    walk_t w = { 0 };
+    size_t total = 0;
+
+    *count = 0;
+    if (!compile(&w, &arena, pattern) || !w.ncomps) {
+        arena_free(&arena);
+        return NULL;
+    }
+    for (i = 0; i < w.ncomps; i++)
+        if (w.comps[i].globstar && (threads = var_get("GLOB_THREADS")))
+            nwalkers = atoi(threads) < 1 ? 1 : atoi(threads) > MAX_WALKERS ? MAX_WALKERS : atoi(threads);
+    if (!own_batch && !(own_batch = malloc(DIRENT_BATCH))) {
+        perror("malloc");
+        exit(1);
+    }
+
+    pthread_mutex_init(&w.lock, NULL);
+    pthread_cond_init(&w.wake, NULL);
+    memset(walkers, 0, nwalkers * sizeof(*walkers));
+    for (i = 0; i < nwalkers; i++) {
+        walkers[i].w = &w;
+        walkers[i].batch = i ? malloc(DIRENT_BATCH) : own_batch;
+        if (!walkers[i].batch) {
+            perror("malloc");
+            exit(1);
+        }
+    }
+    push(&walkers[0], pattern[0] == '/' ? "/" : "", pattern[0] == '/', 0);
+
+    /* Signals stay with the shell's thread */
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (n = 1; n < nwalkers; n++)
+        if (pthread_create(&walkers[n].thread, NULL, walk, &walkers[n]))
+            break;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+    walk(&walkers[0]);
+    for (i = 1; i < n; i++)
+        pthread_join(walkers[i].thread, NULL);
+
+    for (i = 0; i < nwalkers; i++)
+        total += walkers[i].count;
+    if (total && !interrupted) {
+        paths = arena_alloc(a, (total + 1) * sizeof(*paths));
+        for (i = 0; i < nwalkers; i++)
+            for (size_t j = 0; j < walkers[i].count; j++)
+                paths[(*count)++] = arena_strndup(a, walkers[i].found[j], strlen(walkers[i].found[j]));
+        paths[*count] = NULL;
+        qsort(paths, *count, sizeof(*paths), compare_paths);
+    }
+
+    for (i = 0; i < nwalkers; i++) {
+        if (i)
+            free(walkers[i].batch);
+        free(walkers[i].found);
+        arena_free(&walkers[i].arena);
+    }
+    free(w.tasks);
+    pthread_mutex_destroy(&w.lock);
+    pthread_cond_destroy(&w.wake);
+    arena_free(&arena);
+    return paths;
+}
@@ -0,0 +1,19 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Pathname expansion for Simple Humane Shell (shush).
+ */
+
+#ifndef GLOB_H
+#define GLOB_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+bool glob_magic(const char *s, size_t n);
+char **glob_expand(arena_t *a, const char *pattern, size_t *count);
+
+#endif /* GLOB_H */
@@ -0,0 +1,203 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Command path hash table for Simple Humane Shell (shush).
+ *
+ * Maps command names to the absolute path found by searching $PATH,
+ * so repeated commands are exec'd directly instead of probing every
+ * PATH directory. The table is emptied whenever PATH changes.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "hash.h"
+#include "out.h"
+#include "var.h"
+
+#define HASH_BUCKETS 64
+
+typedef struct hash_entry {
+    char *name;
+    char *path;
+    unsigned hits;
+    struct hash_entry *next;
+} hash_entry_t;
+
+static hash_entry_t *buckets[HASH_BUCKETS];
+static int entry_count = 0;
+
+/* FNV-1a of the len bytes at s, for every hash table of the shell */
+unsigned
+hash_bytes(const char *s, size_t len)
+{
+    unsigned h = 2166136261u;
+
+    while (len--)
+        h = (h ^ (unsigned char)*s++) * 16777619u;
+    return h;
+}
+
+static hash_entry_t *
+find_entry(const char *name)
+{
+    hash_entry_t *e = buckets[hash_bytes(name, strlen(name)) % HASH_BUCKETS];
+
+    while (e && strcmp(e->name, name))
+        e = e->next;
+    return e;
+}
+
+/* Search $PATH for an executable regular file, returns a malloc'd path */
+char *
+search_path(const char *name)
+{
+    const char *dir = var_get("PATH"), *end;
+    size_t name_len = strlen(name);
+    struct stat st;
+
+    if (!dir)
+        return NULL;
+
+    for (;; dir = end + 1) {
+        if (!(end = strchr(dir, ':')))
+            end = dir + strlen(dir);
+
+        size_t dir_len = end - dir;
+        char *path = malloc(dir_len + name_len + 3);
+
+        if (!path) {
+            perror("malloc");
+            exit(1);
+        }
+        /* An empty PATH element means the current directory */
+        if (dir_len == 0)
+            path[dir_len++] = '.';
+        else
+            memcpy(path, dir, dir_len);
+        path[dir_len] = '/';
+        memcpy(path + dir_len + 1, name, name_len + 1);
+
+        if (!stat(path, &st) && S_ISREG(st.st_mode) && !access(path, X_OK))
+            return path;
+        free(path);
+
+        if (!*end)
+            return NULL;
+    }
+}
+
+static void
+insert_entry(const char *name, char *path)
+{
+    hash_entry_t *e = find_entry(name);
+
+    if (e) {
+        free(e->path);
+        e->path = path;
+        e->hits = 0;
+        return;
+    }
+
+    unsigned b = hash_bytes(name, strlen(name)) % HASH_BUCKETS;
+
+    e = malloc(sizeof(*e));
+    if (!e || !(e->name = strdup(name))) {
+        perror("malloc");
+        exit(1);
+    }
+    e->path = path;
+    e->hits = 0;
+    e->next = buckets[b];
+    buckets[b] = e;
+    entry_count++;
+}
+
+/*
+ * Resolve a command name to the path to exec. Names containing a slash
+ * are returned unchanged. Returns NULL when the command is not in PATH.
+ */
+const char *
+hash_lookup(const char *name)
+{
+    hash_entry_t *e;
+    char *path;
+
+    if (strchr(name, '/'))
+        return name;
+
+    if (!(e = find_entry(name))) {
+        if (!(path = search_path(name)))
+            return NULL;
+        insert_entry(name, path);
+        e = find_entry(name);
+    }
+
+    e->hits++;
+    return e->path;
+}
+
+void
+hash_add(const char *name, const char *path)
+{
+    char *copy = strdup(path);
+
+    if (!copy) {
+        perror("strdup");
+        exit(1);
+    }
+    insert_entry(name, copy);
+}
+
+void
+hash_remove(const char *name)
+{
+    hash_entry_t **p = &buckets[hash_bytes(name, strlen(name)) % HASH_BUCKETS];
+
+    for (; *p; p = &(*p)->next) {
+        if (!strcmp((*p)->name, name)) {
+            hash_entry_t *e = *p;
+
+            *p = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+            entry_count--;
+            return;
+        }
+    }
+}
+
+void
+hash_clear(void)
+{
+    for (int i = 0; i < HASH_BUCKETS; i++) {
+        while (buckets[i]) {
+            hash_entry_t *e = buckets[i];
+
+            buckets[i] = e->next;
+            free(e->name);
+            free(e->path);
+            free(e);
+        }
+    }
+    entry_count = 0;
+}
+
+void
+hash_print(void)
+{
+    if (!entry_count) {
+        out_str("hash: hash table empty\n");
+        return;
+    }
+
+    out_str("hits\tcommand\n");
+    for (int i = 0; i < HASH_BUCKETS; i++)
+        for (hash_entry_t *e = buckets[i]; e; e = e->next)
+            out_printf("%4u\t%s\n", e->hits, e->path);
+}
@@ -0,0 +1,21 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Command path hash table for Simple Humane Shell (shush).
+ */
+
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+
+unsigned hash_bytes(const char *s, size_t len);
+const char *hash_lookup(const char *name);
+void hash_add(const char *name, const char *path);
+void hash_remove(const char *name);
+void hash_clear(void);
+void hash_print(void);
+char *search_path(const char *name);
+
+#endif /* HASH_H */
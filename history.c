@@ -0,0 +1,326 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Command history for Simple Humane Shell (shush).
+ *
+ * History is one file, $HISTFILE or ~/.shush_history, shared by all the
+ * shells of a user. Each command is a record of its text and a NUL,
+ * appended with a single write to an O_APPEND descriptor, so records of
+ * shells running at the same time never mix. The file is mapped rather
+ * than read, and an index of where each record starts makes every entry
+ * one lookup away. What other shells append is indexed at the next
+ * prompt. Each index entry has a mask of the bytes in its record, so a
+ * search passes over most records without touching their text.
+ *
+ * Deleting rewrites the file and renames the new one into place. A shell
+ * with the old file mapped keeps a valid mapping, and moves to the new
+ * file when it sees that the name points elsewhere.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <stdbool.h>
+#include "exec.h"
+#include "history.h"
+#include "libtline/readline.h"
+#include "var.h"
+
+typedef struct {
+    size_t off;             /* of its text in the file */
+    size_t len;
+    uint64_t mask;          /* bit c % 64 set for every byte c in it */
+} record_t;
+
+static char *path = NULL;       /* NULL keeps history in memory only */
+static int fd = -1;
+static dev_t file_dev;
+static ino_t file_ino;
+static char *map = NULL;
+static size_t map_size = 0;
+static size_t indexed = 0;      /* bytes of the file in records */
+static record_t *records = NULL;
+static size_t count = 0, records_size = 0;
+
+static const readline_history_t callbacks = {
+    history_count,
+    history_entry,
+    history_search,
+};
+
+/* Function Prototypes */
+static uint64_t mask_of(const char *s, size_t len);
+static bool contains(const char *s, size_t len, const char *needle, size_t n);
+static void forget(void);
+static bool open_file(void);
+static int new_file(char **tmp);
+static void index_tail(void);
+static bool rewrite(size_t skip);
+
+static uint64_t
+mask_of(const char *s, size_t len)
+{
+    uint64_t mask = 0;
+
+    for (size_t i = 0; i < len; i++)
+        mask |= (uint64_t)1 << ((unsigned char)s[i] & 63);
+    return mask;
+}
+
+static bool
+contains(const char *s, size_t len, const char *needle, size_t n)
+{
+    const char *p, *end = s + len;
+
+    if (n == 0)
+        return true;
+    for (p = s; (size_t)(end - p) >= n && (p = memchr(p, needle[0], end - p - n + 1)); p++)
+        if (!memcmp(p, needle, n))
+            return true;
+    return false;
+}
+
+/* Drop the mapping and the index */
+static void
+forget(void)
+{
+    if (map)
+        munmap(map, map_size);
+    map = NULL;
+    map_size = indexed = count = 0;
+}
+
+static bool
+open_file(void)
+{
+    struct stat st;
+    int new;
+
+    if (path)
+        new = open(path, O_RDWR | O_APPEND | O_CREAT | O_CLOEXEC, 0600);
+    else if ((new = memory_fd("", 0)) >= 0)
+        fcntl(new, F_SETFL, O_APPEND);
+    if (new < 0 || fstat(new, &st) < 0) {
+        if (new >= 0)
+            close(new);
+        return false;
+    }
+    if (fd >= 0)
+        close(fd);
+    fd = new;
+    file_dev = st.st_dev;
+    file_ino = st.st_ino;
+    forget();
+    index_tail();
+    return true;
+}
+
+/* Index the records added to the file since the last look */
+static void
+index_tail(void)
+{
+    struct stat st;
+    char *p, *end, *nul;
+
+    if (fd < 0 || fstat(fd, &st) < 0)
+        return;
+    /* Cut short behind our back, start over */
+    if ((size_t)st.st_size < indexed)
+        forget();
+    if ((size_t)st.st_size <= indexed)
+        return;
+
+    if ((size_t)st.st_size > map_size) {
+        if (map)
+            munmap(map, map_size);
+        map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map == MAP_FAILED) {
+            map = NULL;
+            map_size = indexed = count = 0;
+            return;
+        }
+        map_size = st.st_size;
+    }
+
+    /* A record still being written has no NUL yet */
+    end = map + map_size;
+    for (p = map + indexed; p < end && (nul = memchr(p, '\0', end - p)); p = nul + 1) {
+        if (count == records_size) {
+            records_size = records_size ? records_size * 2 : 1024;
+            if (!(records = realloc(records, records_size * sizeof(*records)))) {
+                perror("realloc");
+                exit(1);
+            }
+        }
+        records[count].off = p - map;
+        records[count].len = nul - p;
+        records[count].mask = mask_of(p, nul - p);
+        count++;
+        indexed = nul + 1 - map;
+    }
+}
+
+void
+history_init(void)
+{
+    const char *file = var_get("HISTFILE"), *home = var_get("HOME");
+
+    if (file && *file)
+        path = strdup(file);
+    else if (!file && home && (path = malloc(strlen(home) + sizeof("/.shush_history"))))
+        sprintf(path, "%s/.shush_history", home);
+    if (!open_file() && path) {
+        fprintf(stderr, "shush: %s: %s, history is not saved\n", path, strerror(errno));
+        free(path);
+        path = NULL;
+        open_file();
+    }
+    readline_set_history(&callbacks);
+}
+
+/* Catch up with what other shells did to the file */
+void
+history_sync(void)
+{
+    struct stat st;
+
+    if (path && stat(path, &st) == 0 && (st.st_dev != file_dev || st.st_ino != file_ino))
+        open_file();
+    else
+        index_tail();
+}
+
+/* Add a command line to history, without its final newline */
+void
+history_add(const char *line)
+{
+    size_t len = strlen(line);
+    struct iovec iov[2] = {
+        { (char *)line, len },
+        { "", 1 },
+    };
+
+    if (len && line[len - 1] == '\n')
+        iov[0].iov_len = --len;
+    if (fd < 0 || !len)
+        return;
+    while (writev(fd, iov, 2) < 0 && errno == EINTR)
+        ;
+    index_tail();
+}
+
+size_t
+history_count(void)
+{
+    return count;
+}
+
+/* Entry i, the oldest first. Its text ends in a NUL */
+const char *
+history_entry(size_t i, size_t *len)
+{
+    if (i >= count)
+        return NULL;
+    if (len)
+        *len = records[i].len;
+    return map + records[i].off;
+}
+
+/* The newest entry from entry from down that has needle in it, -1 if none */
+long
+history_search(const char *needle, size_t len, long from)
+{
+    uint64_t mask = mask_of(needle, len);
+    record_t *r;
+
+    if (from >= (long)count)
+        from = count - 1;
+    for (; from >= 0; from--) {
+        r = &records[from];
+        if ((r->mask & mask) == mask && r->len >= len && contains(map + r->off, r->len, needle, len))
+            return from;
+    }
+    return -1;
+}
+
+/* A file to write the new history to, next to the old one */
+static int
+new_file(char **tmp)
+{
+    int new;
+
+    *tmp = NULL;
+    if (!path)
+        return memory_fd("", 0);
+    if (!(*tmp = malloc(strlen(path) + sizeof(".XXXXXX"))))
+        return -1;
+    sprintf(*tmp, "%s.XXXXXX", path);
+    if ((new = mkstemp(*tmp)) < 0) {
+        free(*tmp);
+        *tmp = NULL;
+    }
+    return new;
+}
+
+/* Write the history again without entry skip, or empty when skip is past the end */
+static bool
+rewrite(size_t skip)
+{
+    struct iovec iov[2] = { { map, 0 }, { map, 0 } };
+    char *tmp;
+    int new;
+    ssize_t n = 0;
+
+    if ((new = new_file(&tmp)) < 0) {
+        perror("history");
+        return false;
+    }
+    if (skip < count) {
+        iov[0].iov_len = records[skip].off;
+        iov[1].iov_base = map + records[skip].off + records[skip].len + 1;
+        iov[1].iov_len = indexed - (records[skip].off + records[skip].len + 1);
+        while ((n = writev(new, iov, 2)) < 0 && errno == EINTR)
+            ;
+    }
+    if (n < 0 || (tmp && rename(tmp, path) < 0)) {
+        perror("history");
+        if (tmp)
+            unlink(tmp);
+        free(tmp);
+        close(new);
+        return false;
+    }
+    free(tmp);
+
+    if (path) {
+        close(new);
+        return open_file();
+    }
+    /* Only this shell ever had the memory file */
+    fcntl(new, F_SETFL, O_APPEND);
+    close(fd);
+    fd = new;
+    forget();
+    index_tail();
+    return true;
+}
+
+bool
+history_delete(size_t i)
+{
+    return i < count && rewrite(i);
+}
+
+void
+history_clear(void)
+{
+    rewrite(count);
+}
@@ -0,0 +1,23 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Command history for Simple Humane Shell (shush).
+ */
+
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void history_init(void);
+void history_sync(void);
+void history_add(const char *line);
+size_t history_count(void);
+const char *history_entry(size_t i, size_t *len);
+long history_search(const char *needle, size_t len, long from);
+bool history_delete(size_t i);
+void history_clear(void);
+
+#endif /* HISTORY_H */
@@ -12,6 +12,7 @@
 #include <unistd.h>
 
 #include "init.h"
+#include "var.h"
 
 #define MAX_HOSTNAME_LENGTH 1024
 
@@ -24,10 +25,7 @@ set_hostname(void)
 
     if (!file) {
         perror("fopen");
-        if (setenv("HOSTNAME", "hostname", 1) < 0) {
-            perror("setenv");
-            exit(EXIT_FAILURE);
-        }
+        var_set("HOSTNAME", "hostname", VAR_EXPORT);
         return;
     }
 
@@ -35,20 +33,14 @@ set_hostname(void)
 
     if (fgets(hostname, MAX_HOSTNAME_LENGTH, file) == NULL) {
         perror("fgets");
-        if (setenv("HOSTNAME", "hostname", 1) < 0) {
-            perror("setenv");
-            exit(EXIT_FAILURE);
-        }
+        var_set("HOSTNAME", "hostname", VAR_EXPORT);
     } else {
         size_t len = strlen(hostname);
         if (len > 0 && hostname[len - 1] == '\n') {
             hostname[len - 1] = '\0';
         }
 
-        if (setenv("HOSTNAME", hostname, 1) < 0) {
-            perror("setenv");
-            exit(EXIT_FAILURE);
-        }
+        var_set("HOSTNAME", hostname, VAR_EXPORT);
     }
 
     fclose(file);
@@ -57,7 +49,12 @@ set_hostname(void)
 void
 initialize_shell(void)
 {
-    home_directory = getenv("HOME");
+    extern char **environ;
+
+    vars_init(environ);
+    /* ~ stays where HOME was when the shell started */
+    if (var_get("HOME"))
+        home_directory = strdup(var_get("HOME"));
     if (!home_directory) {
         fprintf(stderr, "HOME not set\n");
         exit(EXIT_FAILURE);
@@ -65,8 +62,5 @@ initialize_shell(void)
 
     set_hostname();
 
-    if (setenv("PATH", "/bin:/usr/bin", 1) < 0) {
-        perror("setenv");
-        exit(EXIT_FAILURE);
-    }
+    var_set("PATH", "/bin:/usr/bin", VAR_EXPORT);
 }
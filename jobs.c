@@ -0,0 +1,842 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Background jobs for Simple Humane Shell (shush).
+ *
+ * Each job is a forked copy of the shell running the command, in a
+ * process group of its own when there is job control. The pidfds of all
+ * jobs sit in one epoll set, so a finished job is noticed without
+ * polling every job and without a SIGCHLD handler: wait sleeps in
+ * epoll_wait, and the interactive loop waits on the set itself to reap
+ * jobs as soon as they exit, even while the prompt sits idle.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include "builtins.h"
+#include "exec.h"
+#include "jobs.h"
+#include "out.h"
+#include "parse.h"
+
+#define MAX_EVENTS 16
+#define COMMAND_LENGTH 256
+
+/* Job states */
+enum {
+    JOB_RUNNING,
+    JOB_STOPPED,
+    JOB_DONE,
+};
+
+typedef struct job {
+    int id;                 /* the n of %n */
+    pid_t pid;              /* the forked shell, also its process group */
+    pid_t last;             /* whose status is the job's, the last stage of a pipeline */
+    int pidfd;              /* readable once it exits, -1 without pidfd_open */
+    int state;
+    int status;             /* wait status once stopped or done */
+    char *command;
+    struct job *next;
+} job_t;
+
+static job_t *jobs = NULL;      /* by increasing id */
+static job_t *current = NULL;   /* %+, started or stopped last */
+static int epfd = -1;
+bool job_control = false;
+static pid_t last_pid = 0;
+
+/* Function Prototypes */
+static void append(char *buf, size_t size, size_t *len, const char *s);
+static void describe_word(word_t *w, char *buf, size_t size, size_t *len);
+static void describe(node_t *n, char *buf, size_t size, size_t *len);
+static job_t *add_job(pid_t pid, pid_t last, const char *command);
+static void remove_job(job_t *j);
+static job_t *previous_job(void);
+static void watch(job_t *j);
+static bool update(job_t *j, int options);
+static void set_status(job_t *j, int status);
+static int reap(int timeout);
+static bool any_running(void);
+static job_t *find_job(const char *spec, const char *who);
+static int exit_status(int status);
+static void print_job(job_t *j, bool pid);
+static void take_terminal(pid_t pgrp);
+static int foreground(job_t *j);
+static int wait_next(void);
+
+/*
+ * Job control (own process groups, fg and bg) is for interactive shells.
+ * ^Z and the terminal stop the command in the foreground, never the
+ * shell, so it ignores them while its children do not.
+ */
+void
+jobs_init(bool enable)
+{
+    job_control = enable && isatty(STDIN_FILENO);
+    if (job_control) {
+        signal(SIGTSTP, SIG_IGN);
+        signal(SIGTTIN, SIG_IGN);
+        signal(SIGTTOU, SIG_IGN);
+    }
+}
+
+/* In a child given a process group of its own, the stop signals work again */
+void
+job_child(void)
+{
+    if (!job_control)
+        return;
+    signal(SIGTSTP, SIG_DFL);
+    signal(SIGTTIN, SIG_DFL);
+    signal(SIGTTOU, SIG_DFL);
+}
+
+/* The epoll set of job pidfds, readable when a job has exited */
+int
+jobs_fd(void)
+{
+    if (epfd < 0 && (epfd = epoll_create1(EPOLL_CLOEXEC)) < 0)
+        perror("shush: epoll_create1");
+    return epfd;
+}
+
+/* Collect the jobs that have exited, to report them at the next prompt */
+void
+jobs_poll(void)
+{
+    if (jobs)
+        reap(0);
+}
+
+pid_t
+job_last_pid(void)
+{
+    return last_pid;
+}
+
+static void
+append(char *buf, size_t size, size_t *len, const char *s)
+{
+    size_t n = strlen(s);
+
+    if (n > size - 1 - *len)
+        n = size - 1 - *len;
+    memcpy(buf + *len, s, n);
+    *len += n;
+    buf[*len] = '\0';
+}
+
+static void
+describe_word(word_t *w, char *buf, size_t size, size_t *len)
+{
+    for (word_part_t *wp = w->parts; wp; wp = wp->next) {
+        switch (wp->type) {
+        case WP_PARAM:
+            append(buf, size, len, "$");
+            append(buf, size, len, wp->text);
+            break;
+        case WP_ARITH:
+            append(buf, size, len, "$((");
+            append(buf, size, len, wp->text);
+            append(buf, size, len, "))");
+            break;
+        case WP_CMDSUB:
+            append(buf, size, len, "$(");
+            append(buf, size, len, wp->text);
+            append(buf, size, len, ")");
+            break;
+        default:
+            append(buf, size, len, wp->text);
+            break;
+        }
+    }
+}
+
+/* Command text of n for the job table, rebuilt from the AST */
+static void
+describe(node_t *n, char *buf, size_t size, size_t *len)
+{
+    static const char *keywords[] = {
+        [N_IF] = "if", [N_WHILE] = "while", [N_UNTIL] = "until",
+        [N_FOR] = "for", [N_CASE] = "case", [N_ARITH] = "((",
+        [N_FUNC] = "function",
+    };
+    node_t *c;
+
+    switch (n->type) {
+    case N_CMD:
+        for (word_t *w = n->words; w; w = w->next) {
+            describe_word(w, buf, size, len);
+            if (w->next)
+                append(buf, size, len, " ");
+        }
+        break;
+    case N_PIPE:
+        if (n->flags & NODE_NEGATE)
+            append(buf, size, len, "! ");
+        for (c = n->body; c; c = c->next) {
+            describe(c, buf, size, len);
+            if (c->next)
+                append(buf, size, len, " | ");
+        }
+        break;
+    case N_AND:
+    case N_OR:
+        describe(n->left, buf, size, len);
+        append(buf, size, len, n->type == N_AND ? " && " : " || ");
+        describe(n->right, buf, size, len);
+        break;
+    case N_LIST:
+        for (c = n->body; c; c = c->next) {
+            describe(c, buf, size, len);
+            if (c->next)
+                append(buf, size, len, "; ");
+        }
+        break;
+    case N_GROUP:
+    case N_SUBSHELL:
+        append(buf, size, len, n->type == N_GROUP ? "{ " : "(");
+        describe(n->body, buf, size, len);
+        append(buf, size, len, n->type == N_GROUP ? "; }" : ")");
+        break;
+    default:
+        append(buf, size, len, keywords[n->type] ? keywords[n->type] : "");
+        append(buf, size, len, " ...");
+        break;
+    }
+}
+
+/*
+ * Run n in the background, starting it is the status. Without job
+ * control, as in scripts, the job ignores interrupts and its input is
+ * /dev/null unless it redirects it.
+ */
+int
+job_start(node_t *n)
+{
+    char command[COMMAND_LENGTH];
+    size_t len = 0;
+    job_t *j;
+    pid_t pid;
+    int fd, status;
+
+    out_flush();
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        /* The jobs of the parent are not ours */
+        for (j = jobs; j; j = j->next)
+            if (j->pidfd >= 0)
+                close(j->pidfd);
+        if (epfd >= 0)
+            close(epfd);
+        jobs = current = NULL;
+        epfd = -1;
+
+        if (job_control) {
+            setpgid(0, 0);
+            signal(SIGINT, SIG_DFL);
+            job_child();
+        } else {
+            signal(SIGINT, SIG_IGN);
+            signal(SIGQUIT, SIG_IGN);
+            if ((fd = open("/dev/null", O_RDONLY)) >= 0 && fd != STDIN_FILENO) {
+                dup2(fd, STDIN_FILENO);
+                close(fd);
+            }
+        }
+        job_control = false;
+        interactive = false;
+        n->flags &= ~NODE_BG;
+        status = execute(n);
+        out_flush();
+        _exit(status);
+    } else if (pid < 0) {
+        perror("shush: fork failed");
+        return 1;
+    }
+
+    /* Both sides set the group, whichever runs first wins the race */
+    if (job_control)
+        setpgid(pid, pid);
+    describe(n, command, sizeof(command), &len);
+    command[len] = '\0';
+    j = add_job(pid, pid, command);
+    last_pid = pid;
+    if (job_control)
+        fprintf(stderr, "[%d] %d\n", j->id, (int)pid);
+    return 0;
+}
+
+static job_t *
+add_job(pid_t pid, pid_t last, const char *command)
+{
+    job_t *j, **tail = &jobs;
+    int id = 1;
+
+    for (; *tail; tail = &(*tail)->next)
+        id = (*tail)->id + 1;
+    if (!(j = calloc(1, sizeof(*j))) || !(j->command = strdup(command))) {
+        perror("calloc");
+        exit(1);
+    }
+    j->id = id;
+    j->pid = pid;
+    j->last = last;
+    j->state = JOB_RUNNING;
+    watch(j);
+    *tail = j;
+    current = j;
+    return j;
+}
+
+static void
+remove_job(job_t *j)
+{
+    job_t **pp;
+
+    for (pp = &jobs; *pp != j; pp = &(*pp)->next)
+        ;
+    *pp = j->next;
+    if (j->pidfd >= 0)
+        close(j->pidfd);
+    if (current == j)
+        for (current = jobs; current && current->next; current = current->next)
+            ;
+    free(j->command);
+    free(j);
+}
+
+/* %-, the newest job that is not %+ */
+static job_t *
+previous_job(void)
+{
+    job_t *j, *prev = NULL;
+
+    for (j = jobs; j; j = j->next)
+        if (j != current)
+            prev = j;
+    return prev;
+}
+
+/* Add the pidfd of j to the epoll set, so reap hears when it exits */
+static void
+watch(job_t *j)
+{
+    struct epoll_event ev;
+
+    j->pidfd = -1;
+#ifdef SYS_pidfd_open
+    j->pidfd = syscall(SYS_pidfd_open, j->last, 0);
+#endif
+    if (j->pidfd < 0)
+        return;
+    if (jobs_fd() < 0) {
+        close(j->pidfd);
+        j->pidfd = -1;
+        return;
+    }
+    ev.events = EPOLLIN;
+    ev.data.ptr = j;
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, j->pidfd, &ev) < 0) {
+        close(j->pidfd);
+        j->pidfd = -1;
+    }
+}
+
+/* Ask the kernel about j, false when nothing changed */
+static bool
+update(job_t *j, int options)
+{
+    int status;
+    pid_t r;
+
+    while ((r = waitpid(j->last, &status, options | WUNTRACED | WCONTINUED)) < 0 && errno == EINTR)
+        ;
+    if (r < 0) {
+        /* Somebody else reaped it */
+        set_status(j, 0);
+        return true;
+    }
+    if (r == 0)
+        return false;
+    set_status(j, status);
+    return true;
+}
+
+static void
+set_status(job_t *j, int status)
+{
+    if (WIFSTOPPED(status)) {
+        j->state = JOB_STOPPED;
+        current = j;
+    } else if (WIFCONTINUED(status)) {
+        j->state = JOB_RUNNING;
+        return;
+    } else {
+        j->state = JOB_DONE;
+        /* Closing it also takes it out of the epoll set */
+        if (j->pidfd >= 0)
+            close(j->pidfd);
+        j->pidfd = -1;
+        /* The stages of a pipeline before the last that have exited too */
+        if (j->last != j->pid)
+            while (waitpid(-j->pid, NULL, WNOHANG) > 0)
+                ;
+    }
+    j->status = status;
+}
+
+/*
+ * Collect jobs that have finished, waiting up to timeout milliseconds
+ * (-1 for ever) while none has. Returns how many were collected, or -1
+ * when a signal interrupted the wait.
+ */
+static int
+reap(int timeout)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    bool unwatched = false;
+    job_t *j;
+    int n, i, done = 0, status;
+    pid_t pid;
+
+    /* Jobs without a pidfd can only be asked one at a time */
+    for (j = jobs; j; j = j->next) {
+        if (j->pidfd < 0 && j->state != JOB_DONE) {
+            unwatched = true;
+            if (update(j, WNOHANG) && j->state == JOB_DONE)
+                done++;
+        }
+    }
+    if (done)
+        timeout = 0;
+
+    if (unwatched && timeout) {
+        /* Any child will do, so wait for all of them at once */
+        if ((pid = waitpid(-1, &status, WUNTRACED)) < 0)
+            return errno == EINTR ? -1 : done;
+        for (j = jobs; j; j = j->next) {
+            if (j->last == pid) {
+                set_status(j, status);
+                done += j->state == JOB_DONE;
+            }
+        }
+        timeout = 0;
+    }
+
+    if (epfd < 0)
+        return done;
+    if ((n = epoll_wait(epfd, ev, MAX_EVENTS, timeout)) < 0)
+        return errno == EINTR ? -1 : done;
+    for (i = 0; i < n; i++) {
+        j = ev[i].data.ptr;
+        update(j, 0);
+        done += j->state == JOB_DONE;
+    }
+    return done;
+}
+
+static bool
+any_running(void)
+{
+    for (job_t *j = jobs; j; j = j->next)
+        if (j->state == JOB_RUNNING)
+            return true;
+    return false;
+}
+
+/* What kill signals for a job spec, its whole group with job control, 0 if none */
+pid_t
+job_target(const char *spec)
+{
+    job_t *j = find_job(spec, "kill");
+
+    if (!j)
+        return 0;
+    return job_control ? -j->pid : j->pid;
+}
+
+/* Report jobs that finished since the last prompt and forget them */
+void
+jobs_notify(void)
+{
+    job_t *j, *next;
+
+    if (!jobs)
+        return;
+    reap(0);
+    for (j = jobs; j; j = next) {
+        next = j->next;
+        if (j->state == JOB_DONE) {
+            print_job(j, false);
+            remove_job(j);
+        }
+    }
+    out_flush();
+}
+
+/* %n, %+, %-, %string or a process ID; NULL spec is the current job */
+static job_t *
+find_job(const char *spec, const char *who)
+{
+    job_t *j = NULL;
+    char *end;
+    long n;
+
+    if (!spec || !strcmp(spec, "%%") || !strcmp(spec, "%+") || !strcmp(spec, "%")) {
+        j = current;
+    } else if (!strcmp(spec, "%-")) {
+        j = previous_job();
+    } else if (spec[0] == '%') {
+        n = strtol(spec + 1, &end, 10);
+        for (j = jobs; j; j = j->next) {
+            if (*end == '\0' && end != spec + 1 ? j->id == n :
+                !strncmp(j->command, spec + 1, strlen(spec + 1)))
+                break;
+        }
+    } else {
+        n = strtol(spec, &end, 10);
+        if (*end || end == spec) {
+            fprintf(stderr, "%s: %s: not a pid or valid job spec\n", who, spec);
+            return NULL;
+        }
+        for (j = jobs; j && j->pid != n; j = j->next)
+            ;
+        if (!j) {
+            fprintf(stderr, "%s: pid %s is not a child of this shell\n", who, spec);
+            return NULL;
+        }
+    }
+    if (!j)
+        fprintf(stderr, "%s: %s: no such job\n", who, spec ? spec : "current");
+    return j;
+}
+
+static int
+exit_status(int status)
+{
+    if (WIFEXITED(status))
+        return WEXITSTATUS(status);
+    if (WIFSIGNALED(status))
+        return 128 + WTERMSIG(status);
+    if (WIFSTOPPED(status))
+        return 128 + WSTOPSIG(status);
+    return 0;
+}
+
+static void
+print_job(job_t *j, bool pid)
+{
+    char state[32];
+    int mark = j == current ? '+' : j == previous_job() ? '-' : ' ';
+
+    if (j->state == JOB_RUNNING)
+        strcpy(state, "Running");
+    else if (j->state == JOB_STOPPED)
+        strcpy(state, "Stopped");
+    else if (WIFSIGNALED(j->status))
+        snprintf(state, sizeof(state), "%s", custom_strsignal(WTERMSIG(j->status)));
+    else if (WEXITSTATUS(j->status))
+        snprintf(state, sizeof(state), "Exit %d", WEXITSTATUS(j->status));
+    else
+        strcpy(state, "Done");
+
+    out_printf("[%d]%c  ", j->id, mark);
+    if (pid)
+        out_printf("%d ", (int)j->pid);
+    out_printf("%-24s%s%s\n", state, j->command, j->state == JOB_RUNNING ? " &" : "");
+}
+
+/* Hand the terminal to pgrp, the shell is not in the foreground when it takes it back */
+static void
+take_terminal(pid_t pgrp)
+{
+    sigset_t ttou, old;
+
+    sigemptyset(&ttou);
+    sigaddset(&ttou, SIGTTOU);
+    sigprocmask(SIG_BLOCK, &ttou, &old);
+    tcsetpgrp(STDIN_FILENO, pgrp);
+    sigprocmask(SIG_SETMASK, &old, NULL);
+}
+
+/*
+ * Wait for a command that was given the terminal and take it back. A
+ * command stopped with ^Z becomes a job for fg and bg to resume.
+ */
+int
+job_wait(pid_t pid, char *args[])
+{
+    char command[COMMAND_LENGTH];
+    size_t len = 0;
+    job_t *j;
+    int status;
+
+    while (waitpid(pid, &status, WUNTRACED) < 0) {
+        if (errno != EINTR) {
+            status = 1 << 8;
+            break;
+        }
+    }
+    take_terminal(getpgrp());
+    if (!WIFSTOPPED(status)) {
+        /* The ^C went to its group only, but it was meant for the loop around it too */
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+            interrupted = 1;
+        return exit_status(status);
+    }
+
+    command[0] = '\0';
+    for (int i = 0; args[i]; i++) {
+        append(command, sizeof(command), &len, args[i]);
+        if (args[i + 1])
+            append(command, sizeof(command), &len, " ");
+    }
+    j = add_job(pid, pid, command);
+    set_status(j, status);
+    out_char('\n');
+    print_job(j, false);
+    out_flush();
+    return exit_status(status);
+}
+
+/*
+ * job_wait for a pipeline or subshell n, its count processes in pids all
+ * in the process group of the first one started. 0 in pids is a stage
+ * that was never started, with status 127. When ^Z stops it, all of n
+ * becomes one job.
+ */
+int
+job_wait_group(node_t *n, pid_t pids[], int count)
+{
+    char command[COMMAND_LENGTH];
+    size_t len = 0;
+    pid_t pgrp = 0, stopped = 0;
+    job_t *j;
+    int status = 0, wstatus, stop_status = 0;
+
+    for (int i = 0; i < count; i++) {
+        if (pids[i] == 0) {
+            wstatus = 127 << 8;
+        } else {
+            if (!pgrp)
+                pgrp = pids[i];
+            while (waitpid(pids[i], &wstatus, WUNTRACED) < 0) {
+                if (errno != EINTR) {
+                    wstatus = 1 << 8;
+                    break;
+                }
+            }
+            if (WIFSTOPPED(wstatus)) {
+                stopped = pids[i];
+                stop_status = wstatus;
+            }
+        }
+        if (i == count - 1)
+            status = wstatus;
+    }
+    take_terminal(getpgrp());
+    if (!stopped) {
+        if (WIFSIGNALED(status) && WTERMSIG(status) == SIGINT)
+            interrupted = 1;
+        return exit_status(status);
+    }
+
+    describe(n, command, sizeof(command), &len);
+    command[len] = '\0';
+    j = add_job(pgrp, stopped, command);
+    set_status(j, stop_status);
+    out_char('\n');
+    print_job(j, false);
+    out_flush();
+    return exit_status(stop_status);
+}
+
+/* Give j the terminal and wait until it exits or stops */
+static int
+foreground(job_t *j)
+{
+    int status;
+
+    take_terminal(j->pid);
+    if (j->state == JOB_STOPPED)
+        kill(-j->pid, SIGCONT);
+    j->state = JOB_RUNNING;
+    while (j->state == JOB_RUNNING)
+        update(j, 0);
+    take_terminal(getpgrp());
+
+    if (j->state == JOB_STOPPED) {
+        out_char('\n');
+        print_job(j, false);
+        return exit_status(j->status);
+    }
+    if (WIFSIGNALED(j->status) && WTERMSIG(j->status) == SIGINT)
+        interrupted = 1;
+    status = exit_status(j->status);
+    remove_job(j);
+    return status;
+}
+
+/* Status of the next job to finish, or of one that finished unwaited */
+static int
+wait_next(void)
+{
+    job_t *j;
+    int status;
+
+    for (;;) {
+        for (j = jobs; j; j = j->next) {
+            if (j->state == JOB_DONE) {
+                status = exit_status(j->status);
+                remove_job(j);
+                return status;
+            }
+        }
+        if (!any_running())
+            return 127;
+        if (reap(-1) < 0)
+            return 128 + SIGINT;
+    }
+}
+
+/* Built-in jobs command */
+void
+builtin_jobs(char *args[])
+{
+    job_t *j, *next;
+    bool pid = false, pids_only = false;
+    int i = 1;
+
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (!strcmp(args[i], "-l")) {
+            pid = true;
+        } else if (!strcmp(args[i], "-p")) {
+            pids_only = true;
+        } else {
+            fprintf(stderr, "jobs: %s: invalid option\n", args[i]);
+            last_exit_status = 2;
+            return;
+        }
+    }
+
+    /* Also catches jobs that stopped, which their pidfds do not show */
+    for (j = jobs; j; j = j->next)
+        if (j->state != JOB_DONE)
+            update(j, WNOHANG);
+
+    last_exit_status = 0;
+    for (j = jobs; j; j = next) {
+        next = j->next;
+        if (args[i] && find_job(args[i], "jobs") != j)
+            continue;
+        if (pids_only)
+            out_printf("%d\n", (int)j->pid);
+        else
+            print_job(j, pid);
+        if (j->state == JOB_DONE)
+            remove_job(j);
+    }
+}
+
+/* Built-in wait command */
+void
+builtin_wait(char *args[])
+{
+    job_t *j, *next;
+    int i = 1;
+
+    if (args[1] && !strcmp(args[1], "-n")) {
+        last_exit_status = wait_next();
+        return;
+    }
+
+    if (!args[1]) {
+        while (any_running()) {
+            if (reap(-1) < 0) {
+                last_exit_status = 128 + SIGINT;
+                return;
+            }
+        }
+        for (j = jobs; j; j = next) {
+            next = j->next;
+            if (j->state == JOB_DONE)
+                remove_job(j);
+        }
+        last_exit_status = 0;
+        return;
+    }
+
+    for (; args[i]; i++) {
+        if (!(j = find_job(args[i], "wait"))) {
+            last_exit_status = 127;
+            continue;
+        }
+        while (j->state == JOB_RUNNING) {
+            if (reap(-1) < 0) {
+                last_exit_status = 128 + SIGINT;
+                return;
+            }
+        }
+        last_exit_status = exit_status(j->status);
+        if (j->state == JOB_DONE)
+            remove_job(j);
+    }
+}
+
+/* Built-in fg command */
+void
+builtin_fg(char *args[])
+{
+    job_t *j;
+
+    if (!job_control) {
+        fprintf(stderr, "fg: no job control\n");
+        last_exit_status = 1;
+        return;
+    }
+    if (!(j = find_job(args[1], "fg"))) {
+        last_exit_status = 1;
+        return;
+    }
+    out_printf("%s\n", j->command);
+    out_flush();
+    last_exit_status = foreground(j);
+}
+
+/* Built-in bg command */
+void
+builtin_bg(char *args[])
+{
+    job_t *j;
+
+    if (!job_control) {
+        fprintf(stderr, "bg: no job control\n");
+        last_exit_status = 1;
+        return;
+    }
+    if (!(j = find_job(args[1], "bg"))) {
+        last_exit_status = 1;
+        return;
+    }
+    if (j->state == JOB_DONE) {
+        fprintf(stderr, "bg: job %d has terminated\n", j->id);
+        last_exit_status = 1;
+        return;
+    }
+    kill(-j->pid, SIGCONT);
+    j->state = JOB_RUNNING;
+    out_printf("[%d]%c %s &\n", j->id, j == current ? '+' : '-', j->command);
+    last_exit_status = 0;
+}
@@ -0,0 +1,29 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Background jobs for Simple Humane Shell (shush).
+ */
+
+#ifndef JOBS_H
+#define JOBS_H
+
+#include <stdbool.h>
+#include <sys/types.h>
+
+#include "parse.h"
+
+extern bool job_control;
+
+void jobs_init(bool enable);
+int jobs_fd(void);
+void jobs_poll(void);
+int job_start(node_t *n);
+int job_wait(pid_t pid, char *args[]);
+int job_wait_group(node_t *n, pid_t pids[], int count);
+void job_child(void);
+pid_t job_last_pid(void);
+pid_t job_target(const char *spec);
+void jobs_notify(void);
+
+#endif /* JOBS_H */
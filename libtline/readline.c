@@ -1,118 +1,735 @@
 #include "readline.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/ioctl.h>
 #include <termios.h>
 #include <unistd.h>
 #include <ctype.h>
 
 #define BUFFER_SIZE 1024
+#define OUTPUT_SIZE 4096
+#define INPUT_SIZE 4096
+#define TAB_WIDTH 8
 
+/* Escape sequence states */
+enum {
+    ESC_NONE,
+    ESC_START,      /* after ESC */
+    ESC_CSI,        /* after ESC [ and any digits, in esc_param */
+};
+
+/* Bracketed paste: the terminal marks pasted text with ESC [ 200 ~ and ESC [ 201 ~ */
+#define PASTE_ON  "\033[?2004h"
+#define PASTE_OFF "\033[?2004l"
+#define PASTE_START 200
+#define PASTE_END   201
+
+/* The line being read */
+static struct termios orig_termios;
+static char* prompt_text = NULL;
+static char* buffer = NULL;
+static size_t size = 0;
+static size_t len = 0;
+static size_t cursor_pos = 0;
+static int esc = ESC_NONE;
+static int esc_param = 0;
+static int pasting = 0;
+static int paste_enabled = 0;
+static int eof = 0;
+
+/*
+ * History: the entry shown, history_len when it is the line being typed,
+ * which is kept aside meanwhile. A reverse search shows its query in
+ * place of the prompt and the entry it matched as the line.
+ */
+static const readline_history_t* history = NULL;
+static size_t history_len = 0;
+static size_t history_pos = 0;
+static char* saved = NULL;
+static size_t saved_len = 0;
+static int searching = 0;
+static int search_failed = 0;
+static char* query = NULL;
+static size_t query_len = 0;
+static long match = -1;
+static char* search_prompt = NULL;
+
+/*
+ * Completion: the words the completer offered for the last Tab, and
+ * whether the key before this one was a Tab, which lists them.
+ */
+static readline_completer_t completer = NULL;
+static char** completions = NULL;
+static size_t completion_count = 0;
+static size_t completion_size = 0;
+static int last_tab = 0;
+
+/* Input readline() read past the end of its line, for the next call */
+static char pending[INPUT_SIZE];
+static size_t pending_pos = 0;
+static size_t pending_len = 0;
+
+/*
+ * What the terminal shows: the line as last drawn and where the cursor
+ * is, counted in columns from the start of the prompt. Lines wider than
+ * the terminal wrap, so a column count maps to a row and a column.
+ */
+static char* shown = NULL;
+static size_t shown_len = 0;
+static size_t prompt_width = 0;
+static size_t cursor_col = 0;
+static size_t columns = 80;
+
+/* Output is gathered here and written once per call into readline */
+static char* output = NULL;
+static size_t output_len = 0;
+static size_t output_size = 0;
+
+/* TCSADRAIN, not TCSAFLUSH: keys typed ahead are for the next line */
 static void disable_raw_mode(struct termios* orig_termios) {
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, orig_termios);
+    tcsetattr(STDIN_FILENO, TCSADRAIN, orig_termios);
 }
 
 static void enable_raw_mode(struct termios* orig_termios) {
     struct termios raw = *orig_termios;
     raw.c_lflag &= ~(ECHO | ICANON);
-    tcsetattr(STDIN_FILENO, TCSAFLUSH, &raw);
+    raw.c_cc[VMIN] = 1;
+    raw.c_cc[VTIME] = 0;
+    tcsetattr(STDIN_FILENO, TCSADRAIN, &raw);
 }
 
-static void clear_line() {
-    printf("\033[K");
-    fflush(stdout);
+static void *xrealloc(void* p, size_t size) {
+    if (!(p = realloc(p, size))) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    return p;
 }
 
-static void move_cursor(int offset) {
-    printf("\033[%dC", offset);
-    fflush(stdout);
+static void emit(const char* s, size_t n) {
+    if (output_len + n > output_size) {
+        while (output_len + n > output_size)
+            output_size = output_size ? output_size * 2 : OUTPUT_SIZE;
+        output = xrealloc(output, output_size);
+    }
+    memcpy(output + output_len, s, n);
+    output_len += n;
 }
 
-static void move_cursor_left(int offset) {
-    printf("\033[%dD", offset);
-    fflush(stdout);
+static void emit_str(const char* s) {
+    emit(s, strlen(s));
 }
 
-static void insert_char_at_cursor(char c) {
-    printf("%c", c);
-    fflush(stdout);
+static void emit_move(const char* code, size_t n) {
+    char seq[32];
+
+    if (n > 0) {
+        snprintf(seq, sizeof(seq), "\033[%zu%s", n, code);
+        emit_str(seq);
+    }
+}
+
+static void flush_output(void) {
+    size_t done = 0;
+    ssize_t n;
+
+    while (done < output_len) {
+        n = write(STDOUT_FILENO, output + done, output_len - done);
+        if (n < 0 && errno != EINTR)
+            break;
+        if (n > 0)
+            done += n;
+    }
+    output_len = 0;
+}
+
+static void update_columns(void) {
+    struct winsize ws;
+
+    if (ioctl(STDOUT_FILENO, TIOCGWINSZ, &ws) == 0 && ws.ws_col > 0)
+        columns = ws.ws_col;
 }
 
-static void delete_char_at_cursor(size_t *cursor_pos, size_t *len, char *buffer) {
-    if (*cursor_pos < *len) {
-        memmove(buffer + *cursor_pos, buffer + *cursor_pos + 1, *len - *cursor_pos);
-        (*len)--;
-        printf("\033[1D");
-        clear_line();
-        printf("%s", buffer + *cursor_pos);
-        move_cursor_left(*len - *cursor_pos);
+/* The column after byte c drawn at col; UTF-8 continuation bytes take none */
+static size_t advance(size_t col, unsigned char c) {
+    if (c == '\n')
+        return (col / columns + 1) * columns;
+    if (c == '\t')
+        return col + TAB_WIDTH - col % columns % TAB_WIDTH;
+    if ((c & 0xC0) == 0x80)
+        return col;
+    return col + 1;
+}
+
+/* The column after the first n bytes of s, drawn from column col */
+static size_t width(const char* s, size_t n, size_t col) {
+    for (size_t i = 0; i < n; i++)
+        col = advance(col, s[i]);
+    return col;
+}
+
+/* Move the cursor between two columns, across rows if the line wraps */
+static void move_to(size_t col) {
+    size_t from_row = cursor_col / columns, to_row = col / columns;
+    size_t from = cursor_col % columns, to = col % columns;
+
+    if (to_row < from_row)
+        emit_move("A", from_row - to_row);
+    else if (to_row > from_row)
+        emit_move("B", to_row - from_row);
+    if (to == 0 && from != 0)
+        emit_str("\r");
+    else if (to > from)
+        emit_move("C", to - from);
+    else if (to < from)
+        emit_move("D", from - to);
+    cursor_col = col;
+}
+
+/*
+ * Draw bytes from the cursor, tabs as spaces so the screen matches our
+ * columns. A newline from a paste clears the rest of its row and goes
+ * on at the start of the next.
+ */
+static void draw(const char* s, size_t n) {
+    size_t col;
+
+    for (size_t i = 0; i < n; i++) {
+        col = advance(cursor_col, s[i]);
+        if (s[i] == '\n')
+            emit_str("\033[K\r\n");
+        else if (s[i] == '\t')
+            emit("        ", col - cursor_col);
+        else
+            emit(s + i, 1);
+        cursor_col = col;
     }
+    /* A full row leaves the cursor on its last column until more comes */
+    if (n > 0 && s[n - 1] != '\n' && cursor_col % columns == 0)
+        emit_str("\r\n");
 }
 
-char* readline(const char* prompt) {
-    printf("%s", prompt);
-    fflush(stdout);  // Ensure the prompt is displayed before we start reading input
+/*
+ * Bring the screen up to date with the line, rewriting only from the
+ * first byte that changed and clearing what is left of a longer line.
+ */
+static void refresh(void) {
+    size_t same = 0;
 
-    struct termios orig_termios;
-    tcgetattr(STDIN_FILENO, &orig_termios);
-    enable_raw_mode(&orig_termios);
+    while (same < len && same < shown_len && buffer[same] == shown[same])
+        same++;
+    /* Never start in the middle of a UTF-8 sequence */
+    while (same > 0 && (buffer[same] & 0xC0) == 0x80)
+        same--;
+
+    if (same < len || same < shown_len) {
+        move_to(width(buffer, same, prompt_width));
+        draw(buffer + same, len - same);
+        if (same < shown_len)
+            emit_str("\033[J");
+    }
+    move_to(width(buffer, cursor_pos, prompt_width));
+
+    shown = xrealloc(shown, len + 1);
+    memcpy(shown, buffer, len);
+    shown_len = len;
+}
+
+/*
+ * Draw the prompt. What it has between \001 and \002, such as colour
+ * escapes, goes to the terminal without taking up columns.
+ */
+static void draw_prompt(void) {
+    const char* text = searching ? search_prompt : prompt_text;
+    const char* end;
+
+    while ((end = strchr(text, '\001'))) {
+        draw(text, end - text);
+        text = end + 1;
+        end = text + strcspn(text, "\002");
+        emit(text, end - text);
+        text = *end ? end + 1 : end;
+    }
+    draw(text, strlen(text));
+    prompt_width = cursor_col;
+}
+
+/* Draw the prompt again from its first row, the line follows with refresh */
+static void redraw_prompt(void) {
+    move_to(0);
+    emit_str("\033[J");
+    shown_len = 0;
+    draw_prompt();
+}
+
+/* Skip over a whole UTF-8 character left or right of the cursor */
+static void cursor_left(void) {
+    while (cursor_pos > 0 && (buffer[--cursor_pos] & 0xC0) == 0x80)
+        ;
+}
+
+static void cursor_right(void) {
+    if (cursor_pos < len)
+        cursor_pos++;
+    while (cursor_pos < len && (buffer[cursor_pos] & 0xC0) == 0x80)
+        cursor_pos++;
+}
+
+static void delete_range(size_t from, size_t to) {
+    memmove(buffer + from, buffer + to, len - to);
+    len -= to - from;
+}
+
+static void insert(const char* s, size_t n) {
+    if (len + n + 1 > size) {
+        while (len + n + 1 > size)
+            size *= 2;
+        buffer = xrealloc(buffer, size);
+    }
+    memmove(buffer + cursor_pos + n, buffer + cursor_pos, len - cursor_pos);
+    memcpy(buffer + cursor_pos, s, n);
+    cursor_pos += n;
+    len += n;
+}
+
+static void set_line(const char* s, size_t n) {
+    len = 0;
+    cursor_pos = 0;
+    insert(s, n);
+}
+
+static void save(char** to, size_t* to_len) {
+    *to = xrealloc(*to, len + 1);
+    memcpy(*to, buffer, len);
+    *to_len = len;
+}
+
+/* Show history entry pos, or the line being typed for history_len */
+static void recall(size_t pos) {
+    const char* text;
+    size_t n;
+
+    if (!history || pos > history_len || pos == history_pos)
+        return;
+    if (history_pos == history_len)
+        save(&saved, &saved_len);
+    history_pos = pos;
+    if (pos == history_len) {
+        set_line(saved, saved_len);
+    } else if ((text = history->entry(pos, &n))) {
+        set_line(text, n);
+    }
+}
+
+/* Look for the query in entries from from back, and show what it finds */
+static void search(long from) {
+    static size_t prompt_size = 0;
+    const char* text;
+    size_t n, at;
+    long found = from < 0 ? -1 : history->search(query, query_len, from);
+
+    search_failed = found < 0;
+    if (found >= 0 && (text = history->entry(found, &n))) {
+        match = found;
+        set_line(text, n);
+        // The cursor goes to where the query is in the entry
+        for (at = 0; at + query_len <= n && memcmp(text + at, query, query_len); at++)
+            ;
+        cursor_pos = at + query_len <= n ? at : 0;
+    }
+    if (prompt_size < query_len + 32) {
+        prompt_size = query_len + 32;
+        search_prompt = xrealloc(search_prompt, prompt_size);
+    }
+    snprintf(search_prompt, prompt_size, "(%sreverse-i-search)`%.*s': ",
+             search_failed ? "failed " : "", (int)query_len, query);
+    redraw_prompt();
+}
+
+static void search_start(void) {
+    if (!history)
+        return;
+    save(&saved, &saved_len);
+    searching = 1;
+    query_len = 0;
+    match = -1;
+    search(history_len - 1);
+}
+
+/* Leave the search with the line it found, or the line from before it */
+static void search_end(int keep) {
+    searching = 0;
+    if (keep && match >= 0) {
+        history_pos = match;
+    } else if (!keep) {
+        set_line(saved, saved_len);
+        history_pos = history_len;
+    }
+    redraw_prompt();
+}
+
+/* A key during a search; false for one that ends it and is edited as usual */
+static int search_key(int c) {
+    if (c == 18) { // Ctrl-R, the next older match
+        search(match >= 0 ? match - 1 : (long)history_len - 1);
+    } else if (c == 7) { // Ctrl-G gives up
+        search_end(0);
+    } else if (c == 127) {
+        while (query_len > 0 && (query[--query_len] & 0xC0) == 0x80)
+            ;
+        search(history_len - 1);
+    } else if (c >= 32 || c == '\t') {
+        query = xrealloc(query, query_len + 1);
+        query[query_len++] = c;
+        search(match >= 0 ? match : (long)history_len - 1);
+    } else {
+        search_end(1);
+        return 0;
+    }
+    return 1;
+}
+
+static int compare_words(const void* a, const void* b) {
+    return strcmp(*(char* const*)a, *(char* const*)b);
+}
+
+/* Sort the completions and drop the words offered twice */
+static void sort_completions(void) {
+    size_t i, kept = 0;
+
+    qsort(completions, completion_count, sizeof(*completions), compare_words);
+    for (i = 0; i < completion_count; i++) {
+        if (kept > 0 && !strcmp(completions[kept - 1], completions[i]))
+            free(completions[i]);
+        else
+            completions[kept++] = completions[i];
+    }
+    completion_count = kept;
+}
+
+/* Lay the completions out in columns below the line, which follows them */
+static void list_completions(void) {
+    size_t widest = 0, per_row, w, i;
+
+    for (i = 0; i < completion_count; i++)
+        if ((w = width(completions[i], strlen(completions[i]), 0)) > widest)
+            widest = w;
+    widest += 2;
+    per_row = columns / widest ? columns / widest : 1;
+
+    move_to(width(buffer, len, prompt_width));
+    if (cursor_col % columns != 0 || cursor_col == 0)
+        emit_str("\r\n");
+    for (i = 0; i < completion_count; i++) {
+        emit_str(completions[i]);
+        if ((i + 1) % per_row == 0 || i + 1 == completion_count) {
+            emit_str("\r\n");
+        } else {
+            for (w = width(completions[i], strlen(completions[i]), 0); w < widest; w++)
+                emit(" ", 1);
+        }
+    }
+    cursor_col = 0;
+    shown_len = 0;
+    draw_prompt();
+}
+
+/*
+ * Complete the word before the cursor. A single match goes in whole and
+ * several are cut to what they all begin with. When that adds nothing,
+ * a second Tab lists them.
+ */
+static void complete(int again) {
+    size_t start, common, i;
+
+    for (i = 0; i < completion_count; i++)
+        free(completions[i]);
+    completion_count = 0;
+    buffer[len] = '\0';
+    if ((start = completer(buffer, cursor_pos)) > cursor_pos)
+        start = cursor_pos;
+    if (completion_count == 0) {
+        emit_str("\a");
+        return;
+    }
+    sort_completions();
+
+    common = strlen(completions[0]);
+    for (i = 1; i < completion_count; i++) {
+        size_t same = 0;
 
-    char* buffer = malloc(BUFFER_SIZE);
-    if (!buffer) {
+        while (same < common && completions[i][same] == completions[0][same])
+            same++;
+        common = same;
+    }
+    // Never cut a UTF-8 character in half
+    while (common > 0 && (completions[0][common] & 0xC0) == 0x80)
+        common--;
+
+    if (completion_count == 1 || common > cursor_pos - start) {
+        delete_range(start, cursor_pos);
+        cursor_pos = start;
+        insert(completions[0], common);
+        if (completion_count == 1 && common > 0 && completions[0][common - 1] != '/')
+            insert(" ", 1);
+    } else if (again) {
+        list_completions();
+    }
+}
+
+/* Handle one byte of an escape sequence */
+static void escape_key(int c) {
+    size_t at;
+
+    switch (esc) {
+    case ESC_START:
+        esc = c == '[' || c == 'O' ? ESC_CSI : ESC_NONE;
+        esc_param = 0;
+        return;
+    case ESC_CSI:
+        if (c >= '0' && c <= '9') {
+            if (esc_param < 1000)
+                esc_param = esc_param * 10 + c - '0';
+            return;
+        }
+        esc = ESC_NONE;
+        if (pasting) {
+            // Only the end of the paste means anything in one
+            if (c == '~' && esc_param == PASTE_END)
+                pasting = 0;
+        } else if (c == '~' && esc_param == PASTE_START) {
+            pasting = 1;
+        } else if (c == '~' && esc_param == 3) { // Handle delete key
+            at = cursor_pos;
+            cursor_right();
+            delete_range(at, cursor_pos);
+            cursor_pos = at;
+        } else if (c == 'A') { // Up arrow key
+            if (history_pos > 0)
+                recall(history_pos - 1);
+        } else if (c == 'B') { // Down arrow key
+            recall(history_pos + 1);
+        } else if (c == 'C') { // Right arrow key
+            cursor_right();
+        } else if (c == 'D') { // Left arrow key
+            cursor_left();
+        }
+        return;
+    }
+}
+
+/*
+ * Take pasted text as it is, up to the next escape. Its newlines stay in
+ * the line, so a pasted block runs as a whole once Enter is pressed.
+ */
+static size_t paste(const char* input, size_t n) {
+    size_t i = 0, start;
+    unsigned char c;
+
+    while (i < n && input[i] != 27) {
+        start = i;
+        while (i < n && ((c = input[i]) >= 32 || c == '\t' || c == '\n'))
+            i++;
+        insert(input + start, i - start);
+        if (i < n && input[i] != 27) {
+            if (input[i] == '\r')
+                insert("\n", 1);
+            i++;
+        }
+    }
+    return i;
+}
+
+static void bracketed_paste(int on) {
+    if (on != paste_enabled)
+        emit_str(on ? PASTE_ON : PASTE_OFF);
+    paste_enabled = on;
+}
+
+void readline_begin(const char* prompt) {
+    free(prompt_text);
+    prompt_text = strdup(prompt);
+    size = BUFFER_SIZE;
+    buffer = malloc(size);
+    if (!buffer || !prompt_text) {
         perror("Unable to allocate buffer");
         exit(EXIT_FAILURE);
     }
+    len = 0;
+    cursor_pos = 0;
+    esc = ESC_NONE;
+    pasting = 0;
+    eof = 0;
+    searching = 0;
+    last_tab = 0;
+    history_len = history ? history->count() : 0;
+    history_pos = history_len;
 
-    size_t len = 0;
-    size_t cursor_pos = 0;
-    int c;
-    while (1) {
-        c = getchar();
-        if (c == '\n' || c == EOF) {
-            buffer[len] = '\0';
-            break;
+    tcgetattr(STDIN_FILENO, &orig_termios);
+    enable_raw_mode(&orig_termios);
+
+    // Whatever the caller printed goes before the prompt
+    fflush(stdout);
+    update_columns();
+    shown_len = 0;
+    cursor_col = 0;
+    bracketed_paste(1);
+    draw_prompt();
+    flush_output();
+}
+
+/*
+ * Edit the line with the next n bytes of input. Stops after the byte that
+ * ends the line, which *used counts in; the rest belongs to the next line.
+ * The screen is brought up to date once, with a single write.
+ */
+int readline_feed(const char* input, size_t n, size_t* used) {
+    int state = READLINE_MORE;
+    size_t i;
+    int c, tab;
+
+    for (i = 0; i < n && state == READLINE_MORE; i++) {
+        c = (unsigned char)input[i];
+        tab = last_tab;
+        last_tab = 0;
+        if (pasting && esc == ESC_NONE && c != 27) {
+            i += paste(input + i, n - i) - 1;
+        } else if (searching && esc == ESC_NONE && search_key(c)) {
+            // Taken by the search
+        } else if (esc != ESC_NONE) {
+            escape_key(c);
+        } else if (c == '\n') {
+            state = READLINE_DONE;
+        } else if (c == 4 && len == 0) { // Ctrl-D on an empty line
+            eof = 1;
+            state = READLINE_EOF;
         } else if (c == 127) { // Handle backspace
-            if (cursor_pos > 0) {
-                cursor_pos--;
-                len--;
-                memmove(buffer + cursor_pos, buffer + cursor_pos + 1, len - cursor_pos);
-                printf("\b \b");
-                fflush(stdout);
-            }
+            size_t at = cursor_pos;
+
+            cursor_left();
+            delete_range(cursor_pos, at);
         } else if (c == 27) { // Handle escape sequences
-            getchar(); // Skip '['
-            c = getchar();
-            if (c == '3') { // Handle delete key
-                getchar(); // Skip '~'
-                delete_char_at_cursor(&cursor_pos, &len, buffer);
-            } else if (c == 'C') { // Right arrow key
-                if (cursor_pos < len) {
-                    cursor_pos++;
-                    move_cursor(1);
-                }
-            } else if (c == 'D') { // Left arrow key
-                if (cursor_pos > 0) {
-                    cursor_pos--;
-                    move_cursor_left(1);
-                }
-            }
+            esc = ESC_START;
+        } else if (c == 18) { // Ctrl-R searches history
+            search_start();
+        } else if (c == '\t' && completer) {
+            complete(tab);
+            last_tab = 1;
+        } else if (c < 32 && c != '\t') {
+            // Other control characters are not part of the line
         } else {
-            if (len < BUFFER_SIZE - 1) {
-                if (cursor_pos < len) {
-                    memmove(buffer + cursor_pos + 1, buffer + cursor_pos, len - cursor_pos);
-                }
-                buffer[cursor_pos] = c;
-                cursor_pos++;
-                len++;
-                printf("%c", c);
-                fflush(stdout);
-            }
+            insert(input + i, 1);
         }
     }
+    *used = i;
 
-    // Move cursor to the end of input line
-    printf("\n");
+    refresh();
+    if (state != READLINE_MORE)
+        bracketed_paste(0);
+    if (state == READLINE_DONE) {
+        // Move cursor to the end of input line
+        move_to(width(buffer, len, prompt_width));
+        // Unless drawing it already went on to a new row
+        if (cursor_col % columns != 0 || cursor_col == 0)
+            emit_str("\n");
+    }
+    flush_output();
+    return state;
+}
+
+/*
+ * Draw the prompt and the line again, after the terminal changed size.
+ * Terminals rewrap what they show, so the cursor row is found with the
+ * new width before the old drawing is cleared.
+ */
+void readline_redraw(void) {
+    if (!buffer)
+        return;
+    update_columns();
+    emit_move("A", cursor_col / columns);
+    emit_str("\r\033[J");
+    cursor_col = 0;
+    shown_len = 0;
+    draw_prompt();
+    refresh();
+    flush_output();
+}
 
+/* Show another prompt in place of the one drawn, keeping the line */
+void readline_set_prompt(const char* prompt) {
+    if (!buffer)
+        return;
+    free(prompt_text);
+    if (!(prompt_text = strdup(prompt))) {
+        perror("Unable to allocate buffer");
+        exit(EXIT_FAILURE);
+    }
+    // A search shows its own prompt, this one comes back after it
+    if (searching)
+        return;
+    redraw_prompt();
+    refresh();
+    flush_output();
+}
+
+/* Leave raw mode. Returns the line, NULL if input ended before one */
+char* readline_end(void) {
+    char* line = buffer;
+
+    bracketed_paste(0);
+    flush_output();
     disable_raw_mode(&orig_termios);
-    return buffer;
+    buffer = NULL;
+    if (eof) {
+        free(line);
+        return NULL;
+    }
+    line[len] = '\0';
+    return line;
+}
+
+void readline_set_history(const readline_history_t* h) {
+    history = h;
+}
+
+void readline_set_completer(readline_completer_t c) {
+    completer = c;
+}
+
+void readline_add_completion(const char* word, size_t n) {
+    char* copy = xrealloc(NULL, n + 1);
+
+    memcpy(copy, word, n);
+    copy[n] = '\0';
+    if (completion_count == completion_size) {
+        completion_size = completion_size ? completion_size * 2 : 64;
+        completions = xrealloc(completions, completion_size * sizeof(*completions));
+    }
+    completions[completion_count++] = copy;
+}
+
+char* readline(const char* prompt) {
+    size_t used;
+    ssize_t n;
+    int state = READLINE_MORE;
+
+    readline_begin(prompt);
+    while (state == READLINE_MORE) {
+        if (pending_pos == pending_len) {
+            n = read(STDIN_FILENO, pending, sizeof(pending));
+            if (n < 0 && errno == EINTR)
+                continue;
+            if (n <= 0) {
+                eof = len == 0;
+                break;
+            }
+            pending_pos = 0;
+            pending_len = n;
+        }
+        state = readline_feed(pending + pending_pos, pending_len - pending_pos, &used);
+        pending_pos += used;
+    }
+    return readline_end();
 }
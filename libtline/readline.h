@@ -1,6 +1,35 @@
 #ifndef READLINE_H
 #define READLINE_H
 
+#include <stddef.h>
+
+/* What readline_feed made of its input */
+#define READLINE_MORE 0     // the line goes on
+#define READLINE_DONE 1     // the line is complete
+#define READLINE_EOF  2     // input ended on an empty line
+
+// Lines to recall with Up, Down and Ctrl-R, kept by the caller
+typedef struct {
+    size_t (*count)(void);
+    const char* (*entry)(size_t i, size_t* len);                // 0 is the oldest
+    long (*search)(const char* needle, size_t len, long from);  // newest match up to from, or -1
+} readline_history_t;
+
+// Tab completion: given the line and the cursor, the completer offers
+// words with readline_add_completion and returns where the word they
+// replace starts. The line ends in a NUL at len.
+typedef size_t (*readline_completer_t)(const char* line, size_t cursor);
+
 char* readline(const char* prompt);
+void readline_set_history(const readline_history_t* history);
+void readline_set_completer(readline_completer_t completer);
+void readline_add_completion(const char* word, size_t len);
+
+// For callers that wait for input themselves, e.g. with epoll
+void readline_begin(const char* prompt);
+int readline_feed(const char* input, size_t n, size_t* used);
+void readline_redraw(void);
+void readline_set_prompt(const char* prompt);
+char* readline_end(void);
 
 #endif // READLINE_H
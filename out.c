@@ -0,0 +1,172 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Output of built-in commands for Simple Humane Shell (shush).
+ *
+ * Builtins write to their own buffer instead of stdio, so echo is a
+ * memcpy rather than a putchar per byte, and none of it is left in stdio
+ * for a child to inherit. The buffer goes out with one writev at the end
+ * of each builtin, or before that when it is full.
+ */
+
+#include <errno.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+
+#include "out.h"
+
+#define OUT_SIZE 65536
+
+static char buffer[OUT_SIZE];
+static size_t used = 0;
+static int failed = 0;          /* errno of a write this builtin lost, or 0 */
+static bool registered = false; /* out_exit runs at exit */
+
+/* Function Prototypes */
+static bool write_iov(struct iovec *iov, int count);
+static void spill(void);
+static void out_exit(void);
+
+/* All of iov to stdout, after what stdio holds for it */
+static bool
+write_iov(struct iovec *iov, int count)
+{
+    ssize_t w;
+
+    fflush(stdout);
+    while (count > 0) {
+        if ((w = writev(STDOUT_FILENO, iov, count)) < 0) {
+            if (errno == EINTR)
+                continue;
+            return false;
+        }
+        for (; count > 0 && (size_t)w >= iov->iov_len; iov++, count--)
+            w -= iov->iov_len;
+        if (count > 0) {
+            iov->iov_base = (char *)iov->iov_base + w;
+            iov->iov_len -= w;
+        }
+    }
+    return true;
+}
+
+/* Make room by writing the buffer out, for a builtin still running */
+static void
+spill(void)
+{
+    struct iovec iov = { buffer, used };
+
+    used = 0;
+    if (!write_iov(&iov, 1) && !failed)
+        failed = errno;
+}
+
+static void
+out_exit(void)
+{
+    out_flush();
+}
+
+/* Add n bytes at s to the output */
+void
+out_write(const char *s, size_t n)
+{
+    struct iovec iov[2];
+
+    if (!registered) {
+        atexit(out_exit);
+        registered = true;
+    }
+    if (n <= OUT_SIZE - used) {
+        memcpy(buffer + used, s, n);
+        used += n;
+        return;
+    }
+
+    /* Too much to keep: out with the buffer and s in one call */
+    iov[0] = (struct iovec){ buffer, used };
+    iov[1] = (struct iovec){ (char *)s, n };
+    used = 0;
+    if (!write_iov(iov, 2) && !failed)
+        failed = errno;
+}
+
+void
+out_char(char c)
+{
+    out_write(&c, 1);
+}
+
+void
+out_str(const char *s)
+{
+    out_write(s, strlen(s));
+}
+
+void
+out_printf(const char *format, ...)
+{
+    va_list ap, again;
+    char *big;
+    int n;
+
+    if (!registered) {
+        atexit(out_exit);
+        registered = true;
+    }
+    va_start(ap, format);
+    va_copy(again, ap);
+    n = vsnprintf(buffer + used, OUT_SIZE - used, format, ap);
+    if (n < 0) {
+        /* Nothing to add */
+    } else if ((size_t)n < OUT_SIZE - used) {
+        used += n;
+    } else if ((size_t)n < OUT_SIZE) {
+        spill();
+        used = vsnprintf(buffer, OUT_SIZE, format, again);
+    } else if ((big = malloc(n + 1))) {
+        vsnprintf(big, n + 1, format, again);
+        out_write(big, n);
+        free(big);
+    }
+    va_end(again);
+    va_end(ap);
+}
+
+/*
+ * Write out everything held for stdout, before anything else may write
+ * to it or it is pointed elsewhere. False when some of it was lost.
+ */
+bool
+out_flush(void)
+{
+    struct iovec iov = { buffer, used };
+
+    used = 0;
+    if (!iov.iov_len)
+        return fflush(stdout) == 0;
+    return write_iov(&iov, 1);
+}
+
+/*
+ * The end of a builtin, its output goes out. False, with errno set, when
+ * some of what it wrote could not be written.
+ */
+bool
+out_done(void)
+{
+    int error;
+
+    if (used && !out_flush() && !failed)
+        failed = errno;
+    if (!(error = failed))
+        return true;
+    failed = 0;
+    errno = error;
+    return false;
+}
@@ -0,0 +1,21 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Output of built-in commands for Simple Humane Shell (shush).
+ */
+
+#ifndef OUT_H
+#define OUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+void out_write(const char *s, size_t n);
+void out_char(char c);
+void out_str(const char *s);
+void out_printf(const char *format, ...) __attribute__((format(printf, 1, 2)));
+bool out_flush(void);
+bool out_done(void);
+
+#endif /* OUT_H */
@@ -0,0 +1,514 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * The parallel built-in for Simple Humane Shell (shush).
+ *
+ * parallel [-j N] command [arg...] ::: input...
+ * producer | parallel [-j N] command [arg...]
+ *
+ * Runs the command once per input, {} in its words replaced by the
+ * input or the input added as the last word, with up to N of them
+ * running at a time. Each job writes into memory files of its own that
+ * are copied out when it exits, so the output of jobs never interleaves.
+ * Jobs are forks of the shell or spawned commands, so shell functions
+ * and variables work in them. Under make -j every job after the first
+ * needs a token from the make jobserver, given back when jobs end.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "builtins.h"
+#include "exec.h"
+#include "out.h"
+#include "var.h"
+
+#define MAX_SLOTS 1024
+#define MAX_EVENTS 32
+#define READ_CHUNK 65536
+
+/* epoll keys besides slot numbers */
+#define KEY_INPUT    (MAX_SLOTS + 1)
+#define KEY_TOKEN    (MAX_SLOTS + 2)
+
+typedef struct {
+    pid_t pid;              /* 0 when the slot is free */
+    int pidfd;              /* -1 without pidfd_open, then it is polled */
+    int out;                /* memory files with its stdout and stderr */
+    int err;
+} slot_t;
+
+typedef struct {
+    char **command;         /* words before ::: */
+    int words;
+    char **inputs;          /* after :::, or NULL to read lines from stdin */
+    int next;               /* next of inputs */
+    char *buf;              /* lines read from stdin */
+    size_t len, size, pos;
+    bool input_done;        /* stdin reached its end */
+    bool pollable;          /* stdin can be waited for with epoll */
+    int null;               /* /dev/null, the stdin of jobs reading lines */
+    slot_t *slots;
+    int max;
+    int running;
+    int failed;
+    int epfd;
+    int token_r;            /* jobserver, -1 when not under make */
+    int token_w;
+    unsigned char tokens[MAX_SLOTS];        /* held, one per job but the first */
+    int ntokens;
+    bool watching[2];       /* KEY_INPUT and KEY_TOKEN are in the epoll set */
+} parallel_t;
+
+/* Function Prototypes */
+static bool parse_args(parallel_t *p, char *args[]);
+static void jobserver_open(parallel_t *p);
+static bool get_token(parallel_t *p);
+static void put_tokens(parallel_t *p, int keep);
+static char *next_input(parallel_t *p, bool *later);
+static bool read_input(parallel_t *p);
+static bool start_job(parallel_t *p, const char *input);
+static void finish_job(parallel_t *p, slot_t *s, int status);
+static void copy_out(int from, int to);
+static void watch(parallel_t *p, int key, int fd, bool on);
+static bool wait_events(parallel_t *p);
+static void stop_all(parallel_t *p);
+
+static bool
+parse_args(parallel_t *p, char *args[])
+{
+    char *end;
+    int i = 1;
+    long n;
+
+    p->max = sysconf(_SC_NPROCESSORS_ONLN);
+    for (; args[i] && args[i][0] == '-' && args[i][1]; i++) {
+        if (!strcmp(args[i], "--")) {
+            i++;
+            break;
+        }
+        if (strncmp(args[i], "-j", 2)) {
+            fprintf(stderr, "parallel: %s: invalid option\n", args[i]);
+            return false;
+        }
+        const char *v = args[i][2] ? args[i] + 2 : args[++i];
+
+        if (!v || (n = strtol(v, &end, 10)) < 1 || *end || n > MAX_SLOTS) {
+            fprintf(stderr, "parallel: -j takes a number from 1 to %d\n", MAX_SLOTS);
+            return false;
+        }
+        p->max = n;
+    }
+    if (p->max < 1)
+        p->max = 1;
+
+    p->command = args + i;
+    for (; args[i] && strcmp(args[i], ":::"); i++)
+        p->words++;
+    if (!p->words) {
+        fprintf(stderr, "parallel: usage: parallel [-j N] command [arg...] [::: input...]\n");
+        return false;
+    }
+    if (args[i])
+        p->inputs = args + i + 1;
+    return true;
+}
+
+/*
+ * Join the jobserver of make from MAKEFLAGS, either a named pipe with
+ * --jobserver-auth=fifo:PATH or inherited descriptors R,W. The read side
+ * is opened anew through /proc, so it can be non-blocking without
+ * changing the descriptor make and the other jobs share.
+ */
+static void
+jobserver_open(parallel_t *p)
+{
+    const char *flags = var_get("MAKEFLAGS"), *auth;
+    char path[64];
+    int r, w;
+
+    p->token_r = p->token_w = -1;
+    if (!flags)
+        return;
+    if (!(auth = strstr(flags, "--jobserver-auth=")) && !(auth = strstr(flags, "--jobserver-fds=")))
+        return;
+    auth = strchr(auth, '=') + 1;
+
+    if (!strncmp(auth, "fifo:", 5)) {
+        size_t n = strcspn(auth + 5, " ");
+        char *fifo = strndup(auth + 5, n);
+
+        if (fifo) {
+            p->token_r = open(fifo, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+            p->token_w = open(fifo, O_WRONLY | O_CLOEXEC);
+            free(fifo);
+        }
+    } else if (sscanf(auth, "%d,%d", &r, &w) == 2 && r >= 0 && w >= 0 &&
+               fcntl(r, F_GETFD) >= 0 && fcntl(w, F_GETFD) >= 0) {
+        snprintf(path, sizeof(path), "/proc/self/fd/%d", r);
+        p->token_r = open(path, O_RDONLY | O_NONBLOCK | O_CLOEXEC);
+        p->token_w = fcntl(w, F_DUPFD_CLOEXEC, 0);
+    }
+
+    if (p->token_r < 0 || p->token_w < 0) {
+        if (p->token_r >= 0)
+            close(p->token_r);
+        if (p->token_w >= 0)
+            close(p->token_w);
+        p->token_r = p->token_w = -1;
+    }
+}
+
+/*
+ * Make sure there is a token for one more job, false if none is free now.
+ * The first job runs on the token make gave us by starting us at all.
+ */
+static bool
+get_token(parallel_t *p)
+{
+    if (p->token_r < 0 || p->running < p->ntokens + 1)
+        return true;
+    return read(p->token_r, &p->tokens[p->ntokens], 1) == 1 && ++p->ntokens;
+}
+
+/* Give back the tokens above keep */
+static void
+put_tokens(parallel_t *p, int keep)
+{
+    while (p->ntokens > keep) {
+        if (write(p->token_w, &p->tokens[p->ntokens - 1], 1) < 0 && errno == EINTR)
+            continue;
+        p->ntokens--;
+    }
+}
+
+/*
+ * The next input, or NULL. *later is set when more may come from stdin
+ * once it is readable.
+ */
+static char *
+next_input(parallel_t *p, bool *later)
+{
+    char *line, *nl;
+
+    *later = false;
+    if (p->inputs)
+        return p->inputs[p->next] ? p->inputs[p->next++] : NULL;
+
+    for (;;) {
+        line = p->buf + p->pos;
+        if ((nl = memchr(line, '\n', p->len - p->pos))) {
+            *nl = '\0';
+            p->pos = nl - p->buf + 1;
+            return line;
+        }
+        if (p->input_done) {
+            /* A last line without a newline */
+            if (p->pos == p->len)
+                return NULL;
+            p->buf[p->len] = '\0';
+            p->pos = p->len;
+            return line;
+        }
+        if (p->pollable) {
+            *later = true;
+            return NULL;
+        }
+        if (!read_input(p))
+            return NULL;
+    }
+}
+
+/* Read what stdin has, false on error */
+static bool
+read_input(parallel_t *p)
+{
+    ssize_t n;
+
+    /* Lines already handed out are not needed any more */
+    if (p->pos) {
+        memmove(p->buf, p->buf + p->pos, p->len - p->pos);
+        p->len -= p->pos;
+        p->pos = 0;
+    }
+    if (p->size - p->len < READ_CHUNK + 1) {
+        p->size = p->size ? p->size * 2 : 2 * READ_CHUNK;
+        if (!(p->buf = realloc(p->buf, p->size))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    while ((n = read(STDIN_FILENO, p->buf + p->len, p->size - p->len - 1)) < 0 && errno == EINTR)
+        ;
+    if (n < 0 && errno == EAGAIN)
+        return true;
+    if (n <= 0) {
+        if (n < 0)
+            perror("parallel: read");
+        p->input_done = true;
+        return n == 0;
+    }
+    p->len += n;
+    return true;
+}
+
+/* Run the command for input in a free slot */
+static bool
+start_job(parallel_t *p, const char *input)
+{
+    arena_mark_t mark = arena_mark(&scratch);
+    char **argv = arena_alloc(&scratch, (p->words + 2) * sizeof(char *));
+    bool replaced = false;
+    size_t in_len = strlen(input);
+    slot_t *s;
+    int i, argc = 0;
+
+    for (s = p->slots; s->pid; s++)
+        ;
+
+    /* Every {} in the words becomes the input */
+    for (i = 0; i < p->words; i++) {
+        const char *w = p->command[i], *hole;
+        size_t len = 0;
+        char *out;
+
+        for (hole = w; (hole = strstr(hole, "{}")); hole += 2)
+            len++;
+        if (!len) {
+            argv[argc++] = p->command[i];
+            continue;
+        }
+        replaced = true;
+        out = argv[argc++] = arena_alloc(&scratch, strlen(w) + len * in_len + 1);
+        while ((hole = strstr(w, "{}"))) {
+            memcpy(out, w, hole - w);
+            out += hole - w;
+            memcpy(out, input, in_len);
+            out += in_len;
+            w = hole + 2;
+        }
+        strcpy(out, w);
+    }
+    if (!replaced)
+        argv[argc++] = (char *)input;
+    argv[argc] = NULL;
+
+    if ((s->out = memory_fd("", 0)) < 0 || (s->err = memory_fd("", 0)) < 0) {
+        if (s->out >= 0)
+            close(s->out);
+        arena_release(&scratch, mark);
+        return false;
+    }
+    s->pid = exec_async(argc, argv, p->inputs ? -1 : p->null, s->out, s->err);
+    arena_release(&scratch, mark);
+
+    s->pidfd = -1;
+    if (s->pid <= 0) {
+        /* Not found or not started, a failed job with nothing to wait for */
+        finish_job(p, s, 127 << 8);
+        return false;
+    }
+    p->running++;
+
+#ifdef SYS_pidfd_open
+    s->pidfd = syscall(SYS_pidfd_open, s->pid, 0);
+#endif
+    if (s->pidfd >= 0) {
+        struct epoll_event ev = { .events = EPOLLIN, .data.u32 = s - p->slots };
+
+        if (epoll_ctl(p->epfd, EPOLL_CTL_ADD, s->pidfd, &ev) < 0) {
+            close(s->pidfd);
+            s->pidfd = -1;
+        }
+    }
+    return true;
+}
+
+/* Copy out what the job in s wrote, and free the slot */
+static void
+finish_job(parallel_t *p, slot_t *s, int status)
+{
+    out_flush();
+    copy_out(s->out, STDOUT_FILENO);
+    copy_out(s->err, STDERR_FILENO);
+    close(s->out);
+    close(s->err);
+    if (s->pidfd >= 0)
+        close(s->pidfd);
+    if (!WIFEXITED(status) || WEXITSTATUS(status))
+        p->failed++;
+    if (s->pid > 0)
+        p->running--;
+    s->pid = 0;
+    put_tokens(p, p->running > 1 ? p->running - 1 : 0);
+}
+
+static void
+copy_out(int from, int to)
+{
+    char buf[READ_CHUNK];
+    off_t off = 0;
+    ssize_t n, w, done;
+
+    while ((n = pread(from, buf, sizeof(buf), off)) > 0) {
+        off += n;
+        for (done = 0; done < n; done += w)
+            if ((w = write(to, buf + done, n - done)) < 0 && errno != EINTR)
+                return;
+            else if (w < 0)
+                w = 0;
+    }
+}
+
+/* Add fd to the epoll set or take it out, for the times we wait on it */
+static void
+watch(parallel_t *p, int key, int fd, bool on)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = key };
+    bool *state = &p->watching[key - KEY_INPUT];
+
+    if (fd < 0 || *state == on)
+        return;
+    if (epoll_ctl(p->epfd, on ? EPOLL_CTL_ADD : EPOLL_CTL_DEL, fd, &ev) == 0)
+        *state = on;
+    else if (key == KEY_INPUT)
+        p->pollable = false;
+}
+
+/* Sleep until a job exits, stdin has more or a token is free. False on ^C */
+static bool
+wait_events(parallel_t *p)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    slot_t *s;
+    bool polled = false;
+    int n, i, status;
+
+    for (i = 0; i < p->max; i++)
+        polled |= p->slots[i].pid > 0 && p->slots[i].pidfd < 0;
+
+    /* Jobs without pidfds are checked every few milliseconds */
+    if ((n = epoll_wait(p->epfd, ev, MAX_EVENTS, polled ? 10 : -1)) < 0)
+        return errno != EINTR;
+
+    for (i = 0; i < n; i++) {
+        if (ev[i].data.u32 == KEY_INPUT) {
+            if (!read_input(p) || p->input_done)
+                watch(p, KEY_INPUT, STDIN_FILENO, false);
+        } else if (ev[i].data.u32 < MAX_SLOTS) {
+            s = &p->slots[ev[i].data.u32];
+            if (s->pid > 0 && waitpid(s->pid, &status, 0) == s->pid)
+                finish_job(p, s, status);
+        }
+    }
+    for (i = 0; polled && i < p->max; i++) {
+        s = &p->slots[i];
+        if (s->pid > 0 && s->pidfd < 0 && waitpid(s->pid, &status, WNOHANG) == s->pid)
+            finish_job(p, s, status);
+    }
+    return true;
+}
+
+/* Interrupted: end the jobs that are running and keep what they wrote */
+static void
+stop_all(parallel_t *p)
+{
+    int status;
+
+    for (int i = 0; i < p->max; i++)
+        if (p->slots[i].pid > 0)
+            kill(p->slots[i].pid, SIGTERM);
+    for (int i = 0; i < p->max; i++) {
+        if (p->slots[i].pid > 0) {
+            while (waitpid(p->slots[i].pid, &status, 0) < 0 && errno == EINTR)
+                ;
+            finish_job(p, &p->slots[i], status);
+        }
+    }
+}
+
+/* Built-in parallel command */
+void
+builtin_parallel(char *args[])
+{
+    parallel_t p = { 0 };
+    char *input = NULL;
+    bool later = false, ok = true;
+    int flags = 0;
+
+    if (!parse_args(&p, args)) {
+        last_exit_status = 2;
+        return;
+    }
+    if (!(p.slots = calloc(p.max, sizeof(*p.slots))) ||
+        (p.epfd = epoll_create1(EPOLL_CLOEXEC)) < 0) {
+        perror("parallel");
+        free(p.slots);
+        last_exit_status = 2;
+        return;
+    }
+    jobserver_open(&p);
+    p.null = -1;
+    if (!p.inputs) {
+        p.null = open("/dev/null", O_RDONLY | O_CLOEXEC);
+        p.pollable = true;
+        flags = fcntl(STDIN_FILENO, F_GETFL);
+        fcntl(STDIN_FILENO, F_SETFL, flags | O_NONBLOCK);
+    }
+
+    for (;;) {
+        if (!input && !later)
+            input = next_input(&p, &later);
+        if (!input && !later && !p.running)
+            break;
+
+        if (input && p.running < p.max) {
+            if (get_token(&p)) {
+                watch(&p, KEY_TOKEN, p.token_r, false);
+                start_job(&p, input);
+                input = NULL;
+                continue;
+            }
+            watch(&p, KEY_TOKEN, p.token_r, true);
+        } else {
+            watch(&p, KEY_TOKEN, p.token_r, false);
+        }
+        /* A pending input points into the buffer, so read no more until it runs */
+        watch(&p, KEY_INPUT, STDIN_FILENO, later);
+        if (later && !p.pollable)
+            later = false;
+        if (!wait_events(&p)) {
+            ok = false;
+            break;
+        }
+        later = false;
+    }
+
+    if (!ok)
+        stop_all(&p);
+    if (!p.inputs)
+        fcntl(STDIN_FILENO, F_SETFL, flags);
+    if (p.null >= 0)
+        close(p.null);
+    put_tokens(&p, 0);
+    if (p.token_r >= 0)
+        close(p.token_r);
+    if (p.token_w >= 0)
+        close(p.token_w);
+    close(p.epfd);
+    free(p.slots);
+    free(p.buf);
+
+    /* Like GNU parallel, the status counts the jobs that failed */
+    last_exit_status = ok ? (p.failed > 101 ? 101 : p.failed) : 128 + SIGINT;
+}
@@ -2,274 +2,1873 @@
  * MIT/X Consortium License
  * Copyright © 2024 Milán Atanáz Major
  *
- * Parsing and executing commands for Simple Humane Shell (shush).
+ * Parsing commands for Simple Humane Shell (shush).
+ *
+ * The input is scanned once: the lexer walks the source buffer and
+ * hands words to the parser already split into literal and expansion
+ * parts, and the parser builds the AST. Every node and string comes
+ * from the caller's arena, so a whole command is freed in one step.
  */
 
 #include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <signal.h>
-#include <unistd.h>
-#include <sys/wait.h>
 #include <stdbool.h>
 #include "parse.h"
-#include "builtins.h"
 
-#define MAX_LINE 1024
+/* Tokens */
+enum {
+    T_EOF,
+    T_WORD,
+    T_NEWLINE,
+    T_SEMI,
+    T_AMP,
+    T_AND,
+    T_OR,
+    T_PIPE,
+    T_LPAREN,
+    T_RPAREN,
+    T_DSEMI,
+    T_REDIR,
+};
 
-static bool debug = false;
+static const char *token_names[] = {
+    [T_EOF] = "end of file",
+    [T_WORD] = "word",
+    [T_NEWLINE] = "newline",
+    [T_SEMI] = ";",
+    [T_AMP] = "&",
+    [T_AND] = "&&",
+    [T_OR] = "||",
+    [T_PIPE] = "|",
+    [T_LPAREN] = "(",
+    [T_RPAREN] = ")",
+    [T_DSEMI] = ";;",
+    [T_REDIR] = "redirection",
+};
 
 /* Function Prototypes */
-static int exec_cmd(char *cmd);
-static char *trim(char *str);
-static char *parse_arg(char **cmd);
-static void handle_chain(char *line);
-static void handle_result(char sep, int status, bool *exec_next);
-static size_t append_env_var(char **res, size_t *res_len, const char *env_name);
-static int exec_external(char *args[]);
+static int lex(parser_t *p);
+static bool lex_word(parser_t *p, word_t *w);
+static bool lex_param(parser_t *p, word_t *w, bool quoted);
+static bool lex_arith(parser_t *p, word_t *w, bool quoted);
+static bool arith_expands(const char *s, size_t n);
+static bool lex_cmdsub(parser_t *p, word_t *w, bool quoted);
+static bool lex_backquote(parser_t *p, word_t *w, bool quoted);
+static bool parse_cmdsub(parser_t *p, word_part_t *wp, const char *src, size_t len, bool eof, bool paren);
+static int lex_redir(parser_t *p, int fd);
+static bool read_heredocs(parser_t *p);
+static bool heredoc_body(parser_t *p, redir_t *r, size_t start, size_t end);
+static bool lex_expanding(parser_t *p, word_t *w, const char *text, size_t n);
+static bool lex_brace(parser_t *p, word_t *w, bool quoted);
+static bool lex_operator(parser_t *p, word_part_t *wp, bool quoted);
+static size_t operand_end(const parser_t *p, size_t i, const char *stops, bool squote);
+static bool lex_operand(parser_t *p, word_t **w, size_t start, size_t end, bool quoted);
+static void add_part(parser_t *p, word_t *w, int type, const char *s, size_t n, bool quoted);
+static bool need_more(parser_t *p);
+static int peek(parser_t *p);
+static void consume(parser_t *p);
+static void syntax_error(parser_t *p);
+static bool is_word(parser_t *p, const char *kw);
+static bool expect(parser_t *p, const char *kw);
+static void skip_newlines(parser_t *p);
+static bool is_list_end(parser_t *p);
+static node_t *new_node(parser_t *p, int type);
+static word_t *copy_words(arena_t *a, const word_t *w);
+static assignment_t *copy_assignment(arena_t *a, const assignment_t *as);
+static redir_t *copy_redirs(arena_t *a, const redir_t *r);
+static node_t *copy_chain(arena_t *a, const node_t *n);
+static node_t *parse_list(parser_t *p, bool compound);
+static node_t *parse_and_or(parser_t *p);
+static node_t *parse_pipeline(parser_t *p);
+static node_t *parse_command(parser_t *p);
+static word_t *slice_word(parser_t *p, word_part_t *from, size_t start, word_part_t *to, size_t end);
+static assignment_t *split_assignment(parser_t *p, word_t *w, bool element);
+static bool is_compound(parser_t *p, word_t *w);
+static bool compound_allowed(parser_t *p, node_t *n, word_t *last);
+static bool parse_array(parser_t *p, word_t *w);
+static node_t *parse_compound(parser_t *p);
+static node_t *parse_compound_command(parser_t *p);
+static bool parse_redir(parser_t *p, node_t *n);
+static node_t *parse_if(parser_t *p);
+static node_t *parse_loop(parser_t *p, int type);
+static node_t *parse_for(parser_t *p);
+static node_t *parse_case(parser_t *p);
+static node_t *parse_function(parser_t *p, word_t *name);
+static node_t *parse_cond(parser_t *p, word_t *first);
+
+/* Character classes, so scanning never has to rely on a terminating NUL */
+#define C_BLANK  1      /* separates tokens */
+#define C_META   2      /* ends an unquoted word */
+#define C_WORD   4      /* ends a literal run outside quotes */
+#define C_DQUOTE 8      /* ends a literal run inside double quotes */
+#define C_RMETA  16     /* ends a regex word, where ( ) | < > are literal */
+#define C_RWORD  32     /* ends a literal run in a regex word */
+#define C_HEREDOC 64    /* ends a literal run in a here-document body */
+#define C_OPERAND 128   /* ends a literal run in the word of ${name op word} */
+
+static const unsigned char char_class[256] = {
+    [' '] = C_BLANK | C_META | C_WORD | C_RMETA | C_RWORD,
+    ['\t'] = C_BLANK | C_META | C_WORD | C_RMETA | C_RWORD,
+    ['\n'] = C_META | C_WORD | C_RMETA | C_RWORD,
+    [';'] = C_META | C_WORD | C_RMETA | C_RWORD,
+    ['&'] = C_META | C_WORD | C_RMETA | C_RWORD,
+    ['|'] = C_META | C_WORD,
+    ['('] = C_META | C_WORD,
+    [')'] = C_META | C_WORD,
+    ['<'] = C_META | C_WORD,
+    ['>'] = C_META | C_WORD,
+    ['\\'] = C_WORD | C_DQUOTE | C_RWORD | C_HEREDOC | C_OPERAND,
+    ['`'] = C_WORD | C_DQUOTE | C_RWORD | C_HEREDOC | C_OPERAND,
+    ['\''] = C_WORD | C_RWORD | C_OPERAND,
+    ['"'] = C_WORD | C_DQUOTE | C_RWORD | C_OPERAND,
+    ['$'] = C_WORD | C_DQUOTE | C_RWORD | C_HEREDOC | C_OPERAND,
+};
 
-/* Custom strndup implementation */
-static char *
-strndup(const char *s, size_t n)
+#define is_blank(c)  (char_class[(unsigned char)(c)] & C_BLANK)
+#define is_meta(c)   (char_class[(unsigned char)(c)] & C_META)
+#define ends_word(p, c) (!(p)->operand && \
+                         (char_class[(unsigned char)(c)] & ((p)->regex ? C_RMETA : C_META)))
+#define is_name(c)   (isalnum((unsigned char)(c)) || (c) == '_')
+
+/* Modes of lexing the word of ${name op word} */
+#define OPERAND_WORD   1        /* like a word, up to the '}' */
+#define OPERAND_QUOTED 2        /* the same inside double quotes: ' is ordinary */
+
+/* Length of the run at pos that has none of the given classes */
+static size_t
+span(const parser_t *p, int classes)
 {
-    char *p;
-    size_t len = strnlen(s, n);
-    p = malloc(len + 1);
-    if (p) {
-        memcpy(p, s, len);
-        p[len] = '\0';
-    }
-    return p;
+    size_t i = p->pos;
+
+    while (i < p->len && !(char_class[(unsigned char)p->src[i]] & classes))
+        i++;
+    return i - p->pos;
 }
 
 void
-set_debug(bool mode)
+parser_init(parser_t *p, arena_t *a, const char *src, size_t len, bool eof)
 {
-	debug = mode;
+    memset(p, 0, sizeof(*p));
+    p->arena = a;
+    p->src = src;
+    p->len = len;
+    p->eof = eof;
 }
 
-void
-parse_and_execute(char *line)
+/* Text of a word made of a single unquoted literal, or NULL */
+const char *
+word_literal(const word_t *w)
 {
-	handle_chain(line);
+    const word_part_t *wp = w->parts;
+
+    if (wp && !wp->next && wp->type == WP_LITERAL && !wp->quoted)
+        return wp->text;
+    return NULL;
+}
+
+/*
+ * Input ran out where the grammar needs more. This is an error at the
+ * real end of input, otherwise the caller may come back with more.
+ */
+static bool
+need_more(parser_t *p)
+{
+    if (!p->eof) {
+        p->incomplete = true;
+    } else if (!p->error) {
+        if (!p->quiet)
+            fprintf(stderr, "shush: syntax error: unexpected end of file\n");
+        p->error = true;
+    }
+    return false;
 }
 
 static void
-handle_chain(char *line)
+add_part(parser_t *p, word_t *w, int type, const char *s, size_t n, bool quoted)
 {
-	char *cmd, *end;
-	int status = 0;
-	bool exec_next = true;
+    word_part_t **tail = &w->parts, *last = NULL;
 
-	while (*line) {
-		line = trim(line);
-		if (!*line)
-			break;
+    while (*tail) {
+        last = *tail;
+        tail = &last->next;
+    }
 
-		end = line + strcspn(line, ";&|");
+    /* Escapes split literals, join them back with their neighbour */
+    if (type == WP_LITERAL && last && last->type == WP_LITERAL &&
+        last->quoted == quoted) {
+        char *text = arena_alloc(p->arena, last->len + n + 1);
 
-		if (exec_next) {
-			cmd = strndup(line, end - line);
-			if (!cmd) {
-				perror("strndup");
-				exit(1);
-			}
-			char *expanded = expand_variables(cmd); /* Reverting to original name */
-			free(cmd);
+        memcpy(text, last->text, last->len);
+        memcpy(text + last->len, s, n);
+        text[last->len + n] = '\0';
+        last->text = text;
+        last->len += n;
+        return;
+    }
 
-			if (!expanded) {
-				fprintf(stderr, "Failed to expand command\n");
-				exit(1);
-			}
+    word_part_t *wp = arena_alloc(p->arena, sizeof(*wp));
+    wp->type = type;
+    wp->quoted = quoted;
+    wp->text = arena_strndup(p->arena, s, n);
+    wp->len = n;
+    wp->flags = 0;
+    wp->subscript = NULL;
+    wp->op = PO_NONE;
+    wp->word = NULL;
+    wp->word2 = NULL;
+    wp->pattern = NULL;
+    wp->arith = NULL;
+    wp->node = NULL;
+    wp->next = NULL;
+    *tail = wp;
+}
 
-			status = exec_cmd(expanded);
-			free(expanded);
-		}
+/* The part added last to w */
+static word_part_t *
+last_part(word_t *w)
+{
+    word_part_t *wp = w->parts;
 
-		handle_result(*end, status, &exec_next);
-		line = *end ? end + 1 : end;
-	}
+    while (wp->next)
+        wp = wp->next;
+    return wp;
 }
 
-static void
-handle_result(char sep, int status, bool *exec_next)
+/*
+ * Parse the command of a substitution from src with a parser of its own,
+ * into the same arena. With paren it ends at the ')' that closes it,
+ * and the length used is added to p->pos. The command is parsed here,
+ * once, so running the substitution again never parses it again.
+ */
+static bool
+parse_cmdsub(parser_t *p, word_part_t *wp, const char *src, size_t len, bool eof, bool paren)
 {
-	switch (sep) {
-	case '&':
-		*exec_next = (status == 0);
-		break;
-	case '|':
-		*exec_next = (status != 0);
-		break;
-	default:
-		*exec_next = true;
-		break;
-	}
+    parser_t sub;
+
+    parser_init(&sub, p->arena, src, len, eof);
+    sub.quiet = p->quiet;
+    skip_newlines(&sub);
+    if (!(paren ? sub.tok == T_RPAREN : sub.tok == T_EOF) &&
+        !(wp->node = parse_list(&sub, true)))
+        goto fail;
+    if (paren ? peek(&sub) != T_RPAREN : peek(&sub) != T_EOF) {
+        syntax_error(&sub);
+        goto fail;
+    }
+    if (paren)
+        p->pos += sub.pos;
+    return true;
+
+fail:
+    if (sub.incomplete)
+        return need_more(p);
+    p->error = true;
+    return false;
+}
+
+/* $( command ), pos is just past the '(' */
+static bool
+lex_cmdsub(parser_t *p, word_t *w, bool quoted)
+{
+    size_t start = p->pos;
+
+    add_part(p, w, WP_CMDSUB, "", 0, quoted);
+    if (!parse_cmdsub(p, last_part(w), p->src + start, p->len - start, p->eof, true))
+        return false;
+    last_part(w)->text = arena_strndup(p->arena, p->src + start, p->pos - start - 1);
+    last_part(w)->len = p->pos - start - 1;
+    return true;
+}
+
+/*
+ * ` command `, pos is just past the opening '`'. Inside, \ only escapes
+ * $ ` and \ (and " within double quotes), the rest is parsed as is.
+ */
+static bool
+lex_backquote(parser_t *p, word_t *w, bool quoted)
+{
+    const char *s = p->src;
+    char *text;
+    size_t i, n = 0;
+
+    for (i = p->pos; i < p->len && s[i] != '`'; i++)
+        if (s[i] == '\\' && i + 1 < p->len)
+            i++;
+    if (i >= p->len)
+        return need_more(p);
+
+    text = arena_alloc(p->arena, i - p->pos + 1);
+    for (i = p->pos; s[i] != '`'; i++) {
+        if (s[i] == '\\' && (strchr("$`\\", s[i + 1]) || (quoted && s[i + 1] == '"')))
+            i++;
+        text[n++] = s[i];
+    }
+    text[n] = '\0';
+    p->pos = i + 1;
+
+    add_part(p, w, WP_CMDSUB, text, n, quoted);
+    return parse_cmdsub(p, last_part(w), last_part(w)->text, n, true, false);
+}
+
+/*
+ * The expression of $(( or ((, pos is just past the two parentheses.
+ * It runs up to the '))' that balances them. One with quotes, ${ }, $( )
+ * or ` ` in it is also lexed as a word, to be expanded before it is
+ * evaluated.
+ */
+static bool
+lex_arith(parser_t *p, word_t *w, bool quoted)
+{
+    const char *s = p->src;
+    size_t i, start = p->pos;
+    word_part_t *wp;
+    int depth = 0;
+
+    for (i = start; i < p->len; i++) {
+        if (s[i] == '(')
+            depth++;
+        else if (s[i] == ')' && depth-- == 0)
+            break;
+    }
+    if (i + 1 >= p->len)
+        return need_more(p);
+    if (s[i + 1] != ')') {
+        if (!p->quiet)
+            fprintf(stderr, "shush: syntax error: `))' expected\n");
+        p->error = true;
+        return false;
+    }
+    add_part(p, w, WP_ARITH, s + start, i - start, quoted);
+    wp = last_part(w);
+    if (arith_expands(s + start, i - start)) {
+        if (!lex_operand(p, &wp->word, start, i, false))
+            return false;
+        /* ~ is bitwise not here, not the home directory */
+        if (wp->word->parts && wp->word->parts->type == WP_TILDE)
+            wp->word->parts->type = WP_LITERAL;
+    }
+    p->pos = i + 2;
+    return true;
+}
+
+/*
+ * Whether the text of $(( )) has more than $name and $((e)) in it. A
+ * $name in a subscript counts, the key of an associative array is text.
+ */
+static bool
+arith_expands(const char *s, size_t n)
+{
+    int brackets = 0;
+
+    for (size_t i = 0; i < n; i++) {
+        if (s[i] && strchr("\\`\"'", s[i]))
+            return true;
+        if (s[i] == '[')
+            brackets++;
+        else if (s[i] == ']')
+            brackets--;
+        else if (s[i] == '$' && brackets > 0)
+            return true;
+        if (s[i] == '$' && i + 1 < n &&
+            (s[i + 1] == '{' || (s[i + 1] == '(' && (i + 2 >= n || s[i + 2] != '('))))
+            return true;
+    }
+    return false;
+}
+
+/* $name, ${name}, $1 or a special parameter, pos is just past the '$' */
+static bool
+lex_param(parser_t *p, word_t *w, bool quoted)
+{
+    const char *s = p->src;
+    size_t start = p->pos;
+
+    if (p->pos >= p->len) {
+        if (!p->eof)
+            return need_more(p);
+        add_part(p, w, WP_LITERAL, "$", 1, quoted);
+        return true;
+    }
+
+    if (s[p->pos] == '(' && p->pos + 1 < p->len && s[p->pos + 1] == '(') {
+        p->pos += 2;
+        return lex_arith(p, w, quoted);
+    } else if (s[p->pos] == '(') {
+        p->pos++;
+        return lex_cmdsub(p, w, quoted);
+    } else if (s[p->pos] == '{') {
+        p->pos++;
+        return lex_brace(p, w, quoted);
+    } else if (isalpha((unsigned char)s[p->pos]) || s[p->pos] == '_') {
+        while (p->pos < p->len && is_name(s[p->pos]))
+            p->pos++;
+        add_part(p, w, WP_PARAM, s + start, p->pos - start, quoted);
+    } else if (isdigit((unsigned char)s[p->pos]) ||
+               (s[p->pos] && strchr("?#@*$!-", s[p->pos]))) {
+        p->pos++;
+        add_part(p, w, WP_PARAM, s + start, 1, quoted);
+    } else {
+        add_part(p, w, WP_LITERAL, "$", 1, quoted);
+    }
+    return true;
+}
+
+/*
+ * ${...}, pos is just past the '{'. ${name}, ${#name}, ${name[subscript]},
+ * ${#name[@]} and ${!name[@]} are taken apart, the subscript into a word
+ * that expands like a here-document, and so is ${name op word}. Anything
+ * else is kept whole.
+ */
+static bool
+lex_brace(parser_t *p, word_t *w, bool quoted)
+{
+    const char *s = p->src, *end;
+    size_t i = p->pos, name, sub = 0, sub_end = 0;
+    int flags = 0, depth = 0;
+    word_part_t *wp;
+
+    if (i + 1 < p->len && (s[i] == '#' || s[i] == '!') && s[i + 1] != '}') {
+        flags = s[i] == '#' ? PARAM_LENGTH : PARAM_KEYS;
+        i++;
+    }
+    name = i;
+    if (i < p->len && (isalpha((unsigned char)s[i]) || s[i] == '_')) {
+        while (i < p->len && is_name(s[i]))
+            i++;
+    } else if (i < p->len && isdigit((unsigned char)s[i])) {
+        while (i < p->len && isdigit((unsigned char)s[i]))
+            i++;
+    } else if (i < p->len && s[i] && strchr("?#@*$!-", s[i])) {
+        i++;
+    }
+    if (i > name && i < p->len && s[i] == '[') {
+        for (sub = ++i; i < p->len; i++) {
+            if (s[i] == '[')
+                depth++;
+            else if (s[i] == ']' && depth-- == 0)
+                break;
+        }
+        sub_end = i++;
+    }
+    if (i >= p->len)
+        return need_more(p);
+
+    if (i == name || (s[i] != '}' && flags) || (flags == PARAM_KEYS && !(sub_end == sub + 1 &&
+        (s[sub] == '@' || s[sub] == '*')))) {
+        /* Not one of those, its text is the name */
+        if (!(end = memchr(s + p->pos, '}', p->len - p->pos)))
+            return need_more(p);
+        add_part(p, w, WP_PARAM, s + p->pos, end - s - p->pos, quoted);
+        p->pos = end - s + 1;
+        return true;
+    }
+
+    add_part(p, w, WP_PARAM, s + name, (sub ? sub - 1 : i) - name, quoted);
+    p->pos = i;
+    wp = last_part(w);
+    wp->flags = flags;
+    if (sub_end == sub + 1 && s[sub] == '@') {
+        wp->flags |= PARAM_ALL;
+    } else if (sub_end == sub + 1 && s[sub] == '*') {
+        wp->flags |= PARAM_JOIN;
+    } else if (sub) {
+        wp->subscript = arena_zalloc(p->arena, sizeof(word_t));
+        if (!lex_expanding(p, wp->subscript, s + sub, sub_end - sub))
+            return false;
+    }
+    if (s[i] != '}')
+        return lex_operator(p, wp, quoted);
+    p->pos++;
+    return true;
+}
+
+/*
+ * The operator of ${name op word} and its word, pos is at the operator.
+ * /pattern/string has two words, and so has :offset:length.
+ */
+static bool
+lex_operator(parser_t *p, word_part_t *wp, bool quoted)
+{
+    static const char ops[] = "-=?+#%/^,:";
+    static const int codes[] = {
+        PO_DEFAULT, PO_ASSIGN, PO_ERROR, PO_ALTERNATE, PO_PREFIX,
+        PO_SUFFIX, PO_REPLACE, PO_UPPER, PO_LOWER, PO_SUBSTRING,
+    };
+    const char *s = p->src, *op;
+    size_t i = p->pos, end;
+    bool pattern;
+
+    if (s[i] == ':' && i + 1 < p->len && strchr("-=?+", s[i + 1]) && s[i + 1]) {
+        wp->flags |= PARAM_COLON;
+        i++;
+    }
+    if (!s[i] || !(op = strchr(ops, s[i]))) {
+        if (!p->quiet)
+            fprintf(stderr, "shush: syntax error: bad substitution\n");
+        p->error = true;
+        return false;
+    }
+    wp->op = codes[op - ops];
+    pattern = wp->op >= PO_PREFIX && wp->op <= PO_LOWER && wp->op != PO_SUBSTRING;
+    i++;
+    if (i < p->len && s[i] == s[i - 1] && strchr("#%/^,", s[i])) {
+        wp->flags |= PARAM_DOUBLE;
+        i++;
+    } else if (i < p->len && wp->op == PO_REPLACE && (s[i] == '#' || s[i] == '%')) {
+        wp->flags |= s[i] == '#' ? PARAM_START : PARAM_END;
+        i++;
+    }
+
+    /* Quotes inside double quotes only count in a pattern */
+    quoted = quoted && !pattern;
+    if (wp->op == PO_REPLACE || wp->op == PO_SUBSTRING) {
+        end = operand_end(p, i, wp->op == PO_REPLACE ? "/}" : ":}", !quoted);
+        if (end >= p->len)
+            return need_more(p);
+        if (!lex_operand(p, &wp->word, i, end, quoted))
+            return false;
+        if (s[end] == '}') {
+            p->pos = end + 1;
+            return true;
+        }
+        i = end + 1;
+        quoted = wp->quoted;
+        if ((end = operand_end(p, i, "}", !quoted)) >= p->len)
+            return need_more(p);
+        if (!lex_operand(p, &wp->word2, i, end, quoted))
+            return false;
+    } else {
+        if ((end = operand_end(p, i, "}", !quoted)) >= p->len)
+            return need_more(p);
+        if (!lex_operand(p, &wp->word, i, end, quoted))
+            return false;
+    }
+    p->pos = end + 1;
+    return true;
+}
+
+/*
+ * Where the word of ${name op word} that starts at i ends: at the first
+ * byte of stops outside quotes, substitutions and nested ${ }. When
+ * squote is false ' is an ordinary byte. p->len if input ends first.
+ */
+static size_t
+operand_end(const parser_t *p, size_t i, const char *stops, bool squote)
+{
+    const char *s = p->src, *q;
+    int depth = 0;
+
+    for (; i < p->len; i++) {
+        if (depth == 0 && s[i] && strchr(stops, s[i]))
+            return i;
+        switch (s[i]) {
+        case '\\':
+            i++;
+            break;
+        case '\'':
+            if (!squote)
+                break;
+            if (!(q = memchr(s + i + 1, '\'', p->len - i - 1)))
+                return p->len;
+            i = q - s;
+            break;
+        case '"':
+        case '`':
+            for (q = s + i++; i < p->len && s[i] != *q; i++)
+                if (s[i] == '\\')
+                    i++;
+            break;
+        case '{':
+            if (i > 0 && s[i - 1] == '$')
+                depth++;
+            break;
+        case '(':
+            depth++;
+            break;
+        case ')':
+        case '}':
+            depth--;
+            break;
+        }
+    }
+    return p->len;
+}
+
+/*
+ * Lex the bytes from start to end into a new word at *w, like a word
+ * outside quotes, or all quoted if the ${ } is in double quotes.
+ */
+static bool
+lex_operand(parser_t *p, word_t **w, size_t start, size_t end, bool quoted)
+{
+    size_t len = p->len, pos = p->pos;
+    int operand = p->operand;
+    bool eof = p->eof, ok;
+
+    *w = arena_zalloc(p->arena, sizeof(word_t));
+    p->len = end;
+    p->pos = start;
+    p->eof = true;
+    p->operand = quoted ? OPERAND_QUOTED : OPERAND_WORD;
+    ok = lex_word(p, *w);
+    if (quoted)
+        for (word_part_t *wp = (*w)->parts; wp; wp = wp->next)
+            wp->quoted = true;
+    p->len = len;
+    p->pos = pos;
+    p->eof = eof;
+    p->operand = operand;
+    return ok;
+}
+
+/* Scan one word starting at pos, false when input ended inside it */
+static bool
+lex_word(parser_t *p, word_t *w)
+{
+    const char *s = p->src;
+    size_t run;
+
+    /* A lone ~ or ~/... at the start of a word is the home directory */
+    if (s[p->pos] == '~' && (p->pos + 1 >= p->len || s[p->pos + 1] == '/' ||
+        is_meta(s[p->pos + 1]))) {
+        add_part(p, w, WP_TILDE, "~", 1, false);
+        p->pos++;
+    }
+
+    while (p->pos < p->len && !ends_word(p, s[p->pos])) {
+        switch (s[p->pos]) {
+        case '\\':
+            if (p->pos + 1 >= p->len) {
+                if (!p->eof)
+                    return need_more(p);
+                add_part(p, w, WP_LITERAL, "\\", 1, false);
+                p->pos++;
+            } else if (s[p->pos + 1] == '\n') {
+                p->pos += 2;
+            } else {
+                add_part(p, w, WP_LITERAL, s + p->pos + 1, 1, true);
+                p->pos += 2;
+            }
+            break;
+        case '\'': {
+            const char *end = memchr(s + p->pos + 1, '\'', p->len - p->pos - 1);
+
+            if (p->operand == OPERAND_QUOTED) {
+                add_part(p, w, WP_LITERAL, "'", 1, false);
+                p->pos++;
+                break;
+            }
+            if (!end)
+                return need_more(p);
+            add_part(p, w, WP_LITERAL, s + p->pos + 1, end - s - p->pos - 1, true);
+            p->pos = end - s + 1;
+            break;
+        }
+        case '"':
+            p->pos++;
+            /* An empty "" still makes a (quoted, empty) word */
+            if (p->pos < p->len && s[p->pos] == '"')
+                add_part(p, w, WP_LITERAL, "", 0, true);
+            for (;;) {
+                if (p->pos >= p->len)
+                    return need_more(p);
+                if ((run = span(p, C_DQUOTE)))
+                    add_part(p, w, WP_LITERAL, s + p->pos, run, true);
+                p->pos += run;
+                if (p->pos >= p->len)
+                    return need_more(p);
+                if (s[p->pos] == '"') {
+                    p->pos++;
+                    break;
+                } else if (s[p->pos] == '$') {
+                    p->pos++;
+                    if (!lex_param(p, w, true))
+                        return false;
+                } else if (s[p->pos] == '`') {
+                    p->pos++;
+                    if (!lex_backquote(p, w, true))
+                        return false;
+                } else if (p->pos + 1 >= p->len) {
+                    return need_more(p);
+                } else if (s[p->pos + 1] == '\n') {
+                    p->pos += 2;
+                } else {
+                    /* Inside quotes \ only escapes $ ` " \ */
+                    if (s[p->pos + 1] && strchr("$`\"\\", s[p->pos + 1]))
+                        p->pos++;
+                    add_part(p, w, WP_LITERAL, s + p->pos, 1, true);
+                    p->pos++;
+                }
+            }
+            break;
+        case '$':
+            p->pos++;
+            if (!lex_param(p, w, false))
+                return false;
+            break;
+        case '`':
+            p->pos++;
+            if (!lex_backquote(p, w, false))
+                return false;
+            break;
+        default:
+            run = span(p, p->operand ? C_OPERAND : p->regex ? C_RWORD : C_WORD);
+            add_part(p, w, WP_LITERAL, s + p->pos, run, false);
+            p->pos += run;
+            break;
+        }
+    }
+
+    /* More input could still extend a word that touches the end */
+    if (p->pos >= p->len && !p->eof)
+        return need_more(p);
+    return true;
+}
+
+/* Consume c if it is next */
+static bool
+next_is(parser_t *p, char c)
+{
+    if (p->pos < p->len && p->src[p->pos] == c) {
+        p->pos++;
+        return true;
+    }
+    return false;
+}
+
+/* The redirection operator at pos, fd is the number written before it or -1 */
+static int
+lex_redir(parser_t *p, int fd)
+{
+    char c = p->src[p->pos++];
+
+    if (c == '<') {
+        if (next_is(p, '<'))
+            p->redir = next_is(p, '<') ? R_HERESTR : next_is(p, '-') ? R_HEREDOCTAB : R_HEREDOC;
+        else
+            p->redir = next_is(p, '&') ? R_DUPIN : next_is(p, '>') ? R_RDWR : R_IN;
+    } else if (c == '>') {
+        p->redir = next_is(p, '>') ? R_APPEND : next_is(p, '&') ? R_DUPOUT : R_OUT;
+        if (p->redir == R_OUT)
+            next_is(p, '|');
+    } else {
+        /* &> and &>> */
+        p->pos++;
+        p->redir = next_is(p, '>') ? R_BOTHAPPEND : R_BOTH;
+    }
+    p->redir_fd = fd;
+    return T_REDIR;
+}
+
+/*
+ * Read the bodies of the here-documents of the line that just ended,
+ * pos is at the start of the next line. Each body runs up to a line
+ * that is only its delimiter.
+ */
+static bool
+read_heredocs(parser_t *p)
+{
+    const char *s = p->src, *nl;
+    size_t start, line, text, end;
+    redir_t *r;
+    int i;
+
+    for (i = 0; i < p->nheredocs; i++) {
+        r = p->heredocs[i];
+        start = p->pos;
+        for (;;) {
+            if (p->pos >= p->len && !p->eof)
+                return need_more(p);
+            if (p->pos >= p->len) {
+                if (!p->quiet)
+                    fprintf(stderr, "shush: warning: here-document delimited by "
+                            "end-of-file (wanted `%s')\n", r->delim);
+                line = p->len;
+                break;
+            }
+            if (!(nl = memchr(s + p->pos, '\n', p->len - p->pos)) && !p->eof)
+                return need_more(p);
+            line = text = p->pos;
+            end = nl ? (size_t)(nl - s) : p->len;
+            p->pos = nl ? end + 1 : end;
+            if (r->type == R_HEREDOCTAB)
+                while (text < end && s[text] == '\t')
+                    text++;
+            if (end - text == strlen(r->delim) && !memcmp(s + text, r->delim, end - text))
+                break;
+        }
+        if (!heredoc_body(p, r, start, line))
+            return false;
+    }
+    p->nheredocs = 0;
+    return true;
+}
+
+/*
+ * Turn the body between start and end into the word of r, which
+ * expands unless the delimiter was quoted.
+ */
+static bool
+heredoc_body(parser_t *p, redir_t *r, size_t start, size_t end)
+{
+    const char *src = p->src, *text = src + start;
+    size_t n = end - start, i;
+    bool bol = true;
+    char *copy;
+
+    /* <<- strips the tabs that start each line */
+    if (r->type == R_HEREDOCTAB) {
+        copy = arena_alloc(p->arena, n + 1);
+        for (n = 0, i = start; i < end; i++) {
+            if (bol && src[i] == '\t')
+                continue;
+            bol = src[i] == '\n';
+            copy[n++] = src[i];
+        }
+        text = copy;
+    }
+
+    r->word = arena_zalloc(p->arena, sizeof(word_t));
+    add_part(p, r->word, WP_LITERAL, "", 0, true);
+    if (r->quoted) {
+        add_part(p, r->word, WP_LITERAL, text, n, true);
+        return true;
+    }
+
+    return lex_expanding(p, r->word, text, n);
+}
+
+/*
+ * Lex the n bytes at text into w the way a here-document body expands:
+ * like inside double quotes, except that " is an ordinary character.
+ */
+static bool
+lex_expanding(parser_t *p, word_t *w, const char *text, size_t n)
+{
+    const char *src = p->src;
+    size_t len = p->len, pos = p->pos, run;
+    bool eof = p->eof, ok = true;
+
+    p->src = text;
+    p->len = n;
+    p->pos = 0;
+    p->eof = true;
+    while (ok && p->pos < p->len) {
+        if ((run = span(p, C_HEREDOC)))
+            add_part(p, w, WP_LITERAL, text + p->pos, run, true);
+        p->pos += run;
+        if (p->pos >= p->len)
+            break;
+        if (text[p->pos] == '$') {
+            p->pos++;
+            ok = lex_param(p, w, true);
+        } else if (text[p->pos] == '`') {
+            p->pos++;
+            ok = lex_backquote(p, w, true);
+        } else if (p->pos + 1 < p->len && text[p->pos + 1] == '\n') {
+            p->pos += 2;
+        } else {
+            /* \ only escapes $ ` \ */
+            if (p->pos + 1 < p->len && strchr("$`\\", text[p->pos + 1]))
+                p->pos++;
+            add_part(p, w, WP_LITERAL, text + p->pos, 1, true);
+            p->pos++;
+        }
+    }
+    p->src = src;
+    p->len = len;
+    p->pos = pos;
+    p->eof = eof;
+    return ok;
 }
 
 static int
-exec_cmd(char *cmd)
+lex(parser_t *p)
 {
-	char *args[MAX_LINE / 2 + 1];
-	int i = 0;
+    const char *s = p->src;
 
-	while (*cmd) {
-		cmd = trim(cmd);
-		if (!*cmd)
-			break;
+    for (;;) {
+        while (p->pos < p->len && is_blank(s[p->pos]))
+            p->pos++;
+        if (p->pos + 1 < p->len && s[p->pos] == '\\' && s[p->pos + 1] == '\n') {
+            p->pos += 2;
+            continue;
+        }
+        if (p->pos < p->len && s[p->pos] == '#') {
+            while (p->pos < p->len && s[p->pos] != '\n')
+                p->pos++;
+            continue;
+        }
+        break;
+    }
 
-		args[i++] = parse_arg(&cmd);
-		if (!args[i - 1]) {
-			fprintf(stderr, "Failed to parse argument\n");
-			return -1;
-		}
-	}
-	args[i] = NULL;
+    p->tok_start = p->pos;
+    if (p->pos >= p->len) {
+        /* Here-documents cut short by the end of input are empty */
+        if (p->nheredocs && p->eof)
+            read_heredocs(p);
+        return T_EOF;
+    }
 
-	if (!args[0])
-		return 0;
+    /* A number right before < or > is the descriptor to redirect */
+    if (isdigit((unsigned char)s[p->pos]) && !p->regex) {
+        size_t i = p->pos;
 
-	if (debug) {
-		printf("Executing: %s\n", args[0]);
-		for (int j = 0; j < i; j++)
-			printf("arg[%d]: %s\n", j, args[j]);
-	}
+        while (i < p->len && isdigit((unsigned char)s[i]))
+            i++;
+        if (i < p->len && (s[i] == '<' || s[i] == '>') && i - p->pos < 4) {
+            int fd = atoi(s + p->pos);
 
-	if (!strcmp(args[0], "exit"))
-		exit(0);
+            p->pos = i;
+            return lex_redir(p, fd);
+        }
+    }
 
-	add_to_history(args[0]); /* Reverting to original name */
+    char c = s[p->pos++];
+    bool twice = p->pos < p->len && s[p->pos] == c;
 
-	if (is_builtin(args[0])) {
-		run_builtin(args);
-		return last_exit_status;
-	}
+    switch (p->regex && !ends_word(p, c) ? 0 : c) {
+    case '\n':
+        if (p->nheredocs && !read_heredocs(p))
+            return T_EOF;
+        return T_NEWLINE;
+    case ';':
+        if (twice) {
+            p->pos++;
+            return T_DSEMI;
+        }
+        return T_SEMI;
+    case '(':
+        return T_LPAREN;
+    case ')':
+        return T_RPAREN;
+    case '<':
+    case '>':
+        p->pos--;
+        return lex_redir(p, -1);
+    case '&':
+        if (p->pos < p->len && s[p->pos] == '>') {
+            p->pos--;
+            return lex_redir(p, -1);
+        }
+        if (twice) {
+            p->pos++;
+            return T_AND;
+        }
+        return T_AMP;
+    case '|':
+        if (twice) {
+            p->pos++;
+            return T_OR;
+        }
+        return T_PIPE;
+    }
 
-	return exec_external(args); /* Ensure this function matches the declaration */
+    p->pos--;
+    p->word = arena_zalloc(p->arena, sizeof(word_t));
+    if (!lex_word(p, p->word))
+        return T_EOF;
+    return T_WORD;
 }
 
 static int
-exec_external(char *args[])
-{
-	pid_t pid = fork();
-
-	if (pid == 0) {
-		execvp(args[0], args);
-		perror("shush");
-		exit(1);
-	} else if (pid < 0) {
-		perror("shush: fork failed");
-		return -1;
-	} else {
-		int status;
-		waitpid(pid, &status, 0);
-		return WIFEXITED(status) ? WEXITSTATUS(status) : 1;
-	}
-}
-
-static char *
-trim(char *str)
-{
-	while (isspace((unsigned char)*str))
-		str++;
-	if (*str == 0)
-		return str;
-
-	char *end = str + strlen(str) - 1;
-	while (end > str && isspace((unsigned char)*end))
-		end--;
-
-	end[1] = '\0';
-	return str;
-}
-
-static char *
-parse_arg(char **cmd)
-{
-	char *str = *cmd, *start = str;
-	bool quoted = false;
-
-	while (*str && (quoted || !isspace((unsigned char)*str))) {
-		if (*str == '"')
-			quoted = !quoted;
-		else if (*str == '\\' && *(str + 1))
-			str++;
-		str++;
-	}
-
-	char *tok = strndup(start, str - start);
-	if (!tok) {
-		perror("strndup");
-		exit(1);
-	}
-
-	*cmd = *str ? str + 1 : str;
-	return tok;
-}
-
-char *
-expand_variables(const char *input) /* Reverting to original name */
-{
-	if (!home_directory) {
-		fprintf(stderr, "Error: HOME not set\n");
-		exit(1);
-	}
-
-	size_t len = strlen(input);
-	char *res = malloc(len + 1);
-	if (!res) {
-		perror("malloc");
-		exit(1);
-	}
-
-	size_t res_len = 0;
-	for (size_t i = 0; i < len; i++) {
-		if (input[i] == '~') {
-			size_t home_len = strlen(home_directory);
-			res = realloc(res, res_len + home_len + 1);
-			if (!res) {
-				perror("realloc");
-				exit(1);
-			}
-			strcpy(res + res_len, home_directory);
-			res_len += home_len;
-		} else if (input[i] == '$' && i + 1 < len) {
-			i += append_env_var(&res, &res_len, input + i + 1);
-		} else {
-			res[res_len++] = input[i];
-		}
-	}
-
-	res[res_len] = '\0';
-	return res;
+peek(parser_t *p)
+{
+    if (!p->have_tok) {
+        p->tok = lex(p);
+        p->have_tok = true;
+        /* '&', '|' or a word at the end could still grow */
+        if (p->tok != T_EOF && p->tok != T_NEWLINE && p->pos >= p->len && !p->eof)
+            p->incomplete = true;
+    }
+    return p->tok;
 }
 
-static size_t
-append_env_var(char **res, size_t *res_len, const char *env_name)
-{
-	const char *end = env_name;
-
-	while (*end && (isalnum(*end) || *end == '_'))
-		end++;
-
-	size_t name_len = end - env_name;
-	if (name_len) {
-		char var[name_len + 1];
-		strncpy(var, env_name, name_len);
-		var[name_len] = '\0';
-
-		char *val = getenv(var);
-		if (val) {
-			size_t val_len = strlen(val);
-			*res = realloc(*res, *res_len + val_len + 1);
-			if (!*res) {
-				perror("realloc");
-				exit(1);
-			}
-			strcpy(*res + *res_len, val);
-			*res_len += val_len;
-		}
-	}
-	return name_len;
+static void
+consume(parser_t *p)
+{
+    p->have_tok = false;
+}
+
+static void
+syntax_error(parser_t *p)
+{
+    if (p->tok == T_EOF) {
+        need_more(p);
+        return;
+    }
+    if (!p->quiet) {
+        if (p->tok == T_WORD || p->tok == T_REDIR)
+            fprintf(stderr, "shush: syntax error near unexpected token `%.*s'\n",
+                    (int)(p->pos - p->tok_start), p->src + p->tok_start);
+        else
+            fprintf(stderr, "shush: syntax error near unexpected token `%s'\n",
+                    token_names[p->tok]);
+    }
+    p->error = true;
+}
+
+/* Is the next token the unquoted reserved word kw? */
+static bool
+is_word(parser_t *p, const char *kw)
+{
+    const char *lit;
+
+    return peek(p) == T_WORD && (lit = word_literal(p->word)) && !strcmp(lit, kw);
+}
+
+static bool
+expect(parser_t *p, const char *kw)
+{
+    if (!is_word(p, kw)) {
+        syntax_error(p);
+        return false;
+    }
+    consume(p);
+    return true;
+}
+
+static void
+skip_newlines(parser_t *p)
+{
+    while (peek(p) == T_NEWLINE)
+        consume(p);
+}
+
+/* Does the token in command position close the current list? */
+static bool
+is_list_end(parser_t *p)
+{
+    static const char *const closers[] = {
+        "then", "elif", "else", "fi", "do", "done", "esac", "}", NULL
+    };
+    const char *lit;
+    int i;
+
+    switch (peek(p)) {
+    case T_NEWLINE:
+    case T_EOF:
+    case T_RPAREN:
+    case T_DSEMI:
+        return true;
+    case T_WORD:
+        if (!(lit = word_literal(p->word)))
+            return false;
+        for (i = 0; closers[i]; i++)
+            if (!strcmp(lit, closers[i]))
+                return true;
+        return false;
+    default:
+        return false;
+    }
+}
+
+static node_t *
+new_node(parser_t *p, int type)
+{
+    node_t *n = arena_zalloc(p->arena, sizeof(*n));
+
+    n->type = type;
+    n->arena = p->arena;
+    return n;
+}
+
+static word_t *
+copy_words(arena_t *a, const word_t *w)
+{
+    word_t *head = NULL, **tail = &head;
+    const word_part_t *wp;
+    word_part_t **ptail;
+
+    for (; w; w = w->next) {
+        *tail = arena_zalloc(a, sizeof(word_t));
+        ptail = &(*tail)->parts;
+        for (wp = w->parts; wp; wp = wp->next) {
+            *ptail = arena_alloc(a, sizeof(word_part_t));
+            **ptail = *wp;
+            (*ptail)->text = arena_strndup(a, wp->text, wp->len);
+            (*ptail)->subscript = copy_words(a, wp->subscript);
+            (*ptail)->word = copy_words(a, wp->word);
+            (*ptail)->word2 = copy_words(a, wp->word2);
+            (*ptail)->pattern = NULL;
+            (*ptail)->arith = NULL;
+            (*ptail)->node = wp->node ? node_copy(a, wp->node) : NULL;
+            ptail = &(*ptail)->next;
+        }
+        *ptail = NULL;
+        (*tail)->assign = w->assign ? copy_assignment(a, w->assign) : NULL;
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+static assignment_t *
+copy_assignment(arena_t *a, const assignment_t *as)
+{
+    assignment_t *c = arena_alloc(a, sizeof(*c));
+
+    *c = *as;
+    c->name = arena_strndup(a, as->name, strlen(as->name));
+    c->subscript = copy_words(a, as->subscript);
+    c->value = copy_words(a, as->value);
+    c->array = copy_words(a, as->array);
+    return c;
+}
+
+static redir_t *
+copy_redirs(arena_t *a, const redir_t *r)
+{
+    redir_t *head = NULL, **tail = &head;
+
+    for (; r; r = r->next) {
+        *tail = arena_alloc(a, sizeof(redir_t));
+        **tail = *r;
+        (*tail)->word = copy_words(a, r->word);
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+static node_t *
+copy_chain(arena_t *a, const node_t *n)
+{
+    node_t *head = NULL, **tail = &head;
+
+    for (; n; n = n->next) {
+        *tail = node_copy(a, n);
+        tail = &(*tail)->next;
+    }
+    return head;
+}
+
+/*
+ * Deep copy of n and everything below it, but not its siblings, into a.
+ * Function definitions outlive the arena of the line that made them.
+ */
+node_t *
+node_copy(arena_t *a, const node_t *n)
+{
+    node_t *c = arena_alloc(a, sizeof(*c));
+
+    *c = *n;
+    c->words = copy_words(a, n->words);
+    c->redirs = copy_redirs(a, n->redirs);
+    c->name = n->name ? arena_strndup(a, n->name, strlen(n->name)) : NULL;
+    c->body = copy_chain(a, n->body);
+    c->left = n->left ? node_copy(a, n->left) : NULL;
+    c->right = n->right ? node_copy(a, n->right) : NULL;
+    c->alt = n->alt ? node_copy(a, n->alt) : NULL;
+    c->next = NULL;
+    c->arena = a;
+    c->code = NULL;
+    return c;
+}
+
+/*
+ * Parse the next complete command, up to and including its newline.
+ * Returns NULL at the end of input, on a syntax error (p->error) or
+ * when the input stops in the middle of a command (p->incomplete).
+ */
+node_t *
+parse_next(parser_t *p)
+{
+    node_t *n;
+
+    while (peek(p) == T_NEWLINE)
+        consume(p);
+    if (p->incomplete)
+        return NULL;
+
+    p->start = p->tok_start;
+    if (p->tok == T_EOF)
+        return NULL;
+
+    if (!(n = parse_list(p, false)))
+        return NULL;
+
+    if (p->tok == T_NEWLINE) {
+        consume(p);
+    } else if (p->tok != T_EOF) {
+        syntax_error(p);
+        return NULL;
+    } else if (!p->eof) {
+        /* Only a newline proves the command is complete */
+        p->incomplete = true;
+        return NULL;
+    }
+    return p->incomplete || p->error ? NULL : n;
+}
+
+/* Does src stop in the middle of a command that needs more lines? */
+bool
+parse_incomplete(const char *src, size_t len)
+{
+    arena_t arena = { 0 };
+    parser_t p;
+
+    parser_init(&p, &arena, src, len, false);
+    p.quiet = true;
+    while (parse_next(&p))
+        ;
+    arena_free(&arena);
+    return p.incomplete && !p.error;
+}
+
+/*
+ * and_or ((';' | '&') and_or)*
+ * Inside compound commands newlines separate commands like ';' does
+ * and the list runs until a closing reserved word.
+ */
+static node_t *
+parse_list(parser_t *p, bool compound)
+{
+    node_t *head = NULL, **tail = &head, *n;
+    int count = 0;
+    bool bg = false;
+
+    if (compound) {
+        skip_newlines(p);
+        if (is_list_end(p)) {
+            syntax_error(p);
+            return NULL;
+        }
+    }
+
+    for (;;) {
+        if (!(n = parse_and_or(p)))
+            return NULL;
+        *tail = n;
+        tail = &n->next;
+        count++;
+
+        if (peek(p) == T_SEMI || p->tok == T_AMP) {
+            if (p->tok == T_AMP) {
+                n->flags |= NODE_BG;
+                bg = true;
+            }
+            consume(p);
+        } else if (!compound || p->tok != T_NEWLINE) {
+            break;
+        }
+        if (compound)
+            skip_newlines(p);
+        if (is_list_end(p))
+            break;
+    }
+
+    if (count == 1 && !bg)
+        return head;
+
+    n = new_node(p, N_LIST);
+    n->body = head;
+    n->n = count;
+    return n;
+}
+
+/* pipeline (('&&' | '||') linebreak pipeline)* */
+static node_t *
+parse_and_or(parser_t *p)
+{
+    node_t *left, *right, *n;
+    int type;
+
+    if (!(left = parse_pipeline(p)))
+        return NULL;
+
+    while (peek(p) == T_AND || p->tok == T_OR) {
+        type = p->tok == T_AND ? N_AND : N_OR;
+        consume(p);
+        while (peek(p) == T_NEWLINE)
+            consume(p);
+        if (!(right = parse_pipeline(p)))
+            return NULL;
+
+        n = new_node(p, type);
+        n->left = left;
+        n->right = right;
+        left = n;
+    }
+    return left;
+}
+
+/* ['!'] command ('|' linebreak command)* */
+static node_t *
+parse_pipeline(parser_t *p)
+{
+    node_t *head, **tail, *n;
+    const char *lit;
+    int count = 1, flags = 0;
+
+    if (peek(p) == T_WORD && (lit = word_literal(p->word)) && !strcmp(lit, "!")) {
+        flags |= NODE_NEGATE;
+        consume(p);
+    }
+
+    if (!(head = parse_command(p)))
+        return NULL;
+    tail = &head->next;
+
+    while (peek(p) == T_PIPE) {
+        consume(p);
+        while (peek(p) == T_NEWLINE)
+            consume(p);
+        if (!(n = parse_command(p)))
+            return NULL;
+        *tail = n;
+        tail = &n->next;
+        count++;
+    }
+
+    if (count == 1 && !flags)
+        return head;
+
+    n = new_node(p, N_PIPE);
+    n->flags = flags;
+    n->body = head;
+    n->n = count;
+    return n;
+}
+
+/*
+ * A copy of the parts from offset start in from up to offset end in to,
+ * to all that follow with a NULL to. Only literals are cut.
+ */
+static word_t *
+slice_word(parser_t *p, word_part_t *from, size_t start, word_part_t *to, size_t end)
+{
+    word_t *w = arena_zalloc(p->arena, sizeof(*w));
+    word_part_t *c;
+    size_t i, j;
+
+    for (word_part_t *wp = from; wp; wp = wp->next) {
+        i = wp == from ? start : 0;
+        j = wp == to ? end : wp->len;
+        if (j > i || (wp != from && wp != to)) {
+            add_part(p, w, wp->type, wp->text + i, j - i, wp->quoted);
+            c = last_part(w);
+            c->flags = wp->flags;
+            c->subscript = wp->subscript;
+            c->op = wp->op;
+            c->word = wp->word;
+            c->word2 = wp->word2;
+            c->node = wp->node;
+        }
+        if (wp == to)
+            break;
+    }
+    return w;
+}
+
+/*
+ * Take NAME=value, NAME+=value or NAME[subscript]=value apart, or with
+ * element the [subscript]=value of a word inside NAME=( ). NULL when w
+ * is not one, the name, '[' and '=' have to be unquoted.
+ */
+static assignment_t *
+split_assignment(parser_t *p, word_t *w, bool element)
+{
+    word_part_t *wp = w->parts, *eq = w->parts;
+    size_t i = 0, name_len, open = 0, close = 0;
+    assignment_t *a;
+
+    if (!wp || wp->type != WP_LITERAL || wp->quoted)
+        return NULL;
+    if (!element) {
+        if (!(isalpha((unsigned char)wp->text[0]) || wp->text[0] == '_'))
+            return NULL;
+        while (i < wp->len && is_name(wp->text[i]))
+            i++;
+    }
+    name_len = i;
+
+    if (i < wp->len && wp->text[i] == '[') {
+        /* The subscript ends at the "]=" or "]+=", maybe in a later part */
+        open = ++i;
+        for (; eq; eq = eq->next, i = 0) {
+            if (eq->type != WP_LITERAL || eq->quoted)
+                continue;
+            for (; i < eq->len; i++)
+                if (eq->text[i] == ']' && (eq->text[i + 1] == '=' ||
+                    (eq->text[i + 1] == '+' && eq->text[i + 2] == '=')))
+                    break;
+            if (i < eq->len)
+                break;
+        }
+        if (!eq)
+            return NULL;
+        close = i++;
+    } else if (element) {
+        return NULL;
+    }
+
+    a = arena_zalloc(p->arena, sizeof(*a));
+    if (i < eq->len && eq->text[i] == '+') {
+        a->append = true;
+        i++;
+    }
+    if (i >= eq->len || eq->text[i] != '=')
+        return NULL;
+    a->name = arena_strndup(p->arena, wp->text, name_len);
+    if (open)
+        a->subscript = slice_word(p, wp, open, eq, close);
+    a->value = slice_word(p, eq, i + 1, NULL, 0);
+    return a;
+}
+
+/* Is w, with a '(' after it, NAME=( rather than the name of a function? */
+static bool
+is_compound(parser_t *p, word_t *w)
+{
+    if (!w->assign)
+        w->assign = split_assignment(p, w, false);
+    return w->assign && !w->assign->compound && !w->assign->subscript &&
+           !w->assign->value->parts;
+}
+
+/*
+ * May a '(' after last, a word of n, start the words of NAME=( )? Only
+ * in the assignments in front of a command, or in the arguments of
+ * declare, export and readonly.
+ */
+static bool
+compound_allowed(parser_t *p, node_t *n, word_t *last)
+{
+    const char *lit = word_literal(n->words);
+    word_t *w;
+
+    if (!lit || (strcmp(lit, "declare") && strcmp(lit, "export") && strcmp(lit, "readonly")))
+        for (w = n->words; w != last; w = w->next)
+            if (!w->assign && !(w->assign = split_assignment(p, w, false)))
+                return false;
+    return is_compound(p, last);
+}
+
+/*
+ * The words of NAME=( ) after w, the next token is the '('. As an
+ * argument w is just the name, the built-in assigns the words.
+ */
+static bool
+parse_array(parser_t *p, word_t *w)
+{
+    assignment_t *a = w->assign;
+    word_t **tail = &a->array;
+
+    consume(p);
+    a->compound = true;
+    w->parts = NULL;
+    add_part(p, w, WP_LITERAL, a->name, strlen(a->name), false);
+    for (;;) {
+        skip_newlines(p);
+        if (peek(p) == T_RPAREN) {
+            consume(p);
+            return true;
+        }
+        if (p->tok != T_WORD) {
+            syntax_error(p);
+            return false;
+        }
+        *tail = p->word;
+        p->word->assign = split_assignment(p, p->word, true);
+        tail = &p->word->next;
+        consume(p);
+    }
+}
+
+/* compound_command redirect* | function_definition | (WORD | redirect)+ */
+static node_t *
+parse_command(parser_t *p)
+{
+    node_t *n;
+    word_t *first, *last = NULL, **tail;
+
+    /* Redirections may come before the command name */
+    if (peek(p) == T_REDIR) {
+        n = new_node(p, N_CMD);
+        tail = &n->words;
+        goto words;
+    }
+
+    if (peek(p) == T_LPAREN || is_word(p, "if") || is_word(p, "while") ||
+        is_word(p, "until") || is_word(p, "for") || is_word(p, "case") ||
+        is_word(p, "{"))
+        return parse_compound(p);
+    if (is_word(p, "function")) {
+        consume(p);
+        if (peek(p) != T_WORD) {
+            syntax_error(p);
+            return NULL;
+        }
+        first = p->word;
+        consume(p);
+        return parse_function(p, first);
+    }
+    if (peek(p) != T_WORD || is_list_end(p)) {
+        syntax_error(p);
+        return NULL;
+    }
+
+    first = p->word;
+    consume(p);
+    if (word_literal(first) && !strcmp(word_literal(first), "[["))
+        return parse_cond(p, first);
+    if (peek(p) == T_LPAREN && !is_compound(p, first))
+        return parse_function(p, first);
+
+    n = new_node(p, N_CMD);
+    n->words = first;
+    n->n = 1;
+    last = first;
+    tail = &first->next;
+words:
+    for (;;) {
+        if (peek(p) == T_WORD) {
+            *tail = last = p->word;
+            tail = &p->word->next;
+            n->n++;
+            consume(p);
+        } else if (p->tok == T_REDIR) {
+            if (!parse_redir(p, n))
+                return NULL;
+            last = NULL;
+        } else if (p->tok == T_LPAREN && last && compound_allowed(p, n, last)) {
+            if (!parse_array(p, last))
+                return NULL;
+        } else {
+            for (word_t *w = n->words; w && (w->assign ||
+                 (w->assign = split_assignment(p, w, false))); w = w->next)
+                n->assigns++;
+            return n;
+        }
+    }
+}
+
+/* A redirection operator and its word, appended to the redirections of n */
+static bool
+parse_redir(parser_t *p, node_t *n)
+{
+    redir_t *r = arena_zalloc(p->arena, sizeof(*r)), **tail;
+    const char *s;
+    char *delim;
+    size_t i, len = 0;
+
+    r->type = p->redir;
+    if (p->redir_fd >= 0)
+        r->fd = p->redir_fd;
+    else
+        r->fd = r->type == R_IN || r->type == R_RDWR || r->type == R_DUPIN ||
+                r->type >= R_HEREDOC ? 0 : 1;
+    consume(p);
+    if (peek(p) != T_WORD) {
+        syntax_error(p);
+        return false;
+    }
+    r->word = p->word;
+
+    /* The delimiter is the word with its quotes removed, its body is read later */
+    if (r->type == R_HEREDOC || r->type == R_HEREDOCTAB) {
+        if (p->nheredocs == MAX_HEREDOCS) {
+            if (!p->quiet)
+                fprintf(stderr, "shush: too many here-documents\n");
+            p->error = true;
+            return false;
+        }
+        s = p->src + p->tok_start;
+        delim = arena_alloc(p->arena, p->pos - p->tok_start + 1);
+        for (i = 0; i < p->pos - p->tok_start; i++) {
+            if (s[i] == '\'' || s[i] == '"' || s[i] == '\\') {
+                r->quoted = true;
+                if (s[i] != '\\' || ++i >= p->pos - p->tok_start)
+                    continue;
+            }
+            delim[len++] = s[i];
+        }
+        delim[len] = '\0';
+        r->delim = delim;
+        p->heredocs[p->nheredocs++] = r;
+    }
+    consume(p);
+
+    for (tail = &n->redirs; *tail; tail = &(*tail)->next)
+        ;
+    *tail = r;
+    return true;
+}
+
+static node_t *
+parse_compound(parser_t *p)
+{
+    node_t *n = parse_compound_command(p);
+
+    while (n && peek(p) == T_REDIR)
+        if (!parse_redir(p, n))
+            return NULL;
+    return n;
+}
+
+static node_t *
+parse_compound_command(parser_t *p)
+{
+    node_t *n;
+
+    /* (( expression )) */
+    if (peek(p) == T_LPAREN && p->pos < p->len && p->src[p->pos] == '(') {
+        consume(p);
+        p->pos++;
+        n = new_node(p, N_ARITH);
+        n->words = arena_zalloc(p->arena, sizeof(word_t));
+        n->n = 1;
+        return lex_arith(p, n->words, false) ? n : NULL;
+    }
+    if (peek(p) == T_LPAREN) {
+        consume(p);
+        n = new_node(p, N_SUBSHELL);
+        if (!(n->body = parse_list(p, true)))
+            return NULL;
+        if (peek(p) != T_RPAREN) {
+            syntax_error(p);
+            return NULL;
+        }
+        consume(p);
+        return n;
+    }
+    if (is_word(p, "{")) {
+        consume(p);
+        n = new_node(p, N_GROUP);
+        if (!(n->body = parse_list(p, true)) || !expect(p, "}"))
+            return NULL;
+        return n;
+    }
+    if (is_word(p, "if")) {
+        consume(p);
+        return parse_if(p);
+    }
+    if (is_word(p, "while"))
+        return parse_loop(p, N_WHILE);
+    if (is_word(p, "until"))
+        return parse_loop(p, N_UNTIL);
+    if (is_word(p, "for"))
+        return parse_for(p);
+    if (is_word(p, "case"))
+        return parse_case(p);
+    syntax_error(p);
+    return NULL;
+}
+
+/* list 'then' list ('elif' ... | 'else' list)? 'fi', after 'if' or 'elif' */
+static node_t *
+parse_if(parser_t *p)
+{
+    node_t *n = new_node(p, N_IF);
+
+    if (!(n->left = parse_list(p, true)) || !expect(p, "then") ||
+        !(n->right = parse_list(p, true)))
+        return NULL;
+    if (is_word(p, "elif")) {
+        consume(p);
+        return (n->alt = parse_if(p)) ? n : NULL;
+    }
+    if (is_word(p, "else")) {
+        consume(p);
+        if (!(n->alt = parse_list(p, true)))
+            return NULL;
+    }
+    return expect(p, "fi") ? n : NULL;
+}
+
+/* ('while' | 'until') list 'do' list 'done' */
+static node_t *
+parse_loop(parser_t *p, int type)
+{
+    node_t *n = new_node(p, type);
+
+    consume(p);
+    if (!(n->left = parse_list(p, true)) || !expect(p, "do") ||
+        !(n->right = parse_list(p, true)) || !expect(p, "done"))
+        return NULL;
+    return n;
+}
+
+/* 'for' NAME [linebreak 'in' WORD* (';' | newline)] linebreak 'do' list 'done' */
+static node_t *
+parse_for(parser_t *p)
+{
+    node_t *n = new_node(p, N_FOR);
+    word_t **tail = &n->words;
+
+    consume(p);
+    if (peek(p) != T_WORD || !(n->name = word_literal(p->word))) {
+        syntax_error(p);
+        return NULL;
+    }
+    consume(p);
+
+    skip_newlines(p);
+    if (is_word(p, "in")) {
+        consume(p);
+        while (peek(p) == T_WORD) {
+            *tail = p->word;
+            tail = &p->word->next;
+            n->n++;
+            consume(p);
+        }
+        if (p->tok != T_SEMI && p->tok != T_NEWLINE) {
+            syntax_error(p);
+            return NULL;
+        }
+        consume(p);
+    } else {
+        /* No word list loops over "$@" */
+        n->words = arena_zalloc(p->arena, sizeof(word_t));
+        add_part(p, n->words, WP_PARAM, "@", 1, true);
+        n->n = 1;
+        if (p->tok == T_SEMI)
+            consume(p);
+    }
+    skip_newlines(p);
+
+    if (!expect(p, "do") || !(n->right = parse_list(p, true)) || !expect(p, "done"))
+        return NULL;
+    return n;
+}
+
+/* 'case' WORD linebreak 'in' linebreak (['('] WORD ('|' WORD)* ')' [list] [';;'])* 'esac' */
+static node_t *
+parse_case(parser_t *p)
+{
+    node_t *n = new_node(p, N_CASE), *item, **items = &n->body;
+    word_t **tail;
+
+    consume(p);
+    if (peek(p) != T_WORD) {
+        syntax_error(p);
+        return NULL;
+    }
+    n->words = p->word;
+    n->n = 1;
+    consume(p);
+    skip_newlines(p);
+    if (!expect(p, "in"))
+        return NULL;
+    skip_newlines(p);
+
+    while (!is_word(p, "esac")) {
+        item = new_node(p, N_CASEITEM);
+        tail = &item->words;
+        if (peek(p) == T_LPAREN)
+            consume(p);
+        for (;;) {
+            if (peek(p) != T_WORD) {
+                syntax_error(p);
+                return NULL;
+            }
+            *tail = p->word;
+            tail = &p->word->next;
+            item->n++;
+            consume(p);
+            if (peek(p) != T_PIPE)
+                break;
+            consume(p);
+        }
+        if (p->tok != T_RPAREN) {
+            syntax_error(p);
+            return NULL;
+        }
+        consume(p);
+
+        skip_newlines(p);
+        if (peek(p) != T_DSEMI && !is_word(p, "esac") &&
+            !(item->right = parse_list(p, true)))
+            return NULL;
+        *items = item;
+        items = &item->next;
+
+        if (peek(p) == T_DSEMI) {
+            consume(p);
+            skip_newlines(p);
+        } else if (!is_word(p, "esac")) {
+            syntax_error(p);
+            return NULL;
+        }
+    }
+    consume(p);
+    return n;
+}
+
+/*
+ * '[[' ... ']]', already past the '[['. Operators inside are words for
+ * the [[ built-in, and the right side of =~ is one word up to a blank,
+ * so a regex may use ( ) | without quoting.
+ */
+static node_t *
+parse_cond(parser_t *p, word_t *first)
+{
+    node_t *n = new_node(p, N_CMD);
+    word_t *w, **tail = &first->next;
+    const char *lit;
+    bool regex = false;
+
+    n->flags = NODE_COND;
+    n->words = first;
+    n->n = 1;
+    for (;;) {
+        p->regex = regex;
+        peek(p);
+        p->regex = false;
+
+        switch (p->tok) {
+        case T_EOF:
+        case T_SEMI:
+        case T_AMP:
+        case T_DSEMI:
+            syntax_error(p);
+            return NULL;
+        case T_NEWLINE:
+            consume(p);
+            continue;
+        case T_WORD:
+            w = p->word;
+            break;
+        default:
+            w = arena_zalloc(p->arena, sizeof(word_t));
+            add_part(p, w, WP_LITERAL, p->src + p->tok_start,
+                     p->pos - p->tok_start, false);
+            break;
+        }
+        consume(p);
+        *tail = w;
+        tail = &w->next;
+        n->n++;
+
+        lit = word_literal(w);
+        regex = lit && !strcmp(lit, "=~");
+        if (lit && !strcmp(lit, "]]") && p->tok == T_WORD)
+            break;
+    }
+    return n;
+}
+
+/* NAME '(' ')' linebreak compound_command, NAME already consumed */
+static node_t *
+parse_function(parser_t *p, word_t *name)
+{
+    node_t *n = new_node(p, N_FUNC);
+
+    if (!(n->name = word_literal(name))) {
+        syntax_error(p);
+        return NULL;
+    }
+    if (peek(p) == T_LPAREN) {
+        consume(p);
+        if (peek(p) != T_RPAREN) {
+            syntax_error(p);
+            return NULL;
+        }
+        consume(p);
+    }
+    skip_newlines(p);
+    if (!(n->body = parse_compound(p)))
+        return NULL;
+    return n;
 }
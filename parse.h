@@ -6,8 +6,178 @@
 #define PARSE_H
 
 #include <stdbool.h>
+#include <stddef.h>
 
-void parse_and_execute(char *line);
-char *expand_variables(const char *input);
+#include "arena.h"
+
+/* Word parts */
+enum {
+    WP_LITERAL,     /* text */
+    WP_PARAM,       /* $name, ${name}, $1, $?, text is the name */
+    WP_TILDE,       /* leading ~ */
+    WP_ARITH,       /* $(( )), text is the expression */
+    WP_CMDSUB,      /* $( ) or ` `, text is the source, node the command */
+};
+
+/* Parameter flags, of WP_PARAM parts */
+#define PARAM_LENGTH 1  /* ${#name} */
+#define PARAM_KEYS   2  /* ${!name[@]} */
+#define PARAM_ALL    4  /* ${name[@]}, every element */
+#define PARAM_JOIN   8  /* ${name[*]}, every element, one field in quotes */
+#define PARAM_COLON  16 /* ${name:-word} and the like, empty counts as unset */
+#define PARAM_DOUBLE 32 /* ## %% longest match, // ^^ ,, every match */
+#define PARAM_START  64 /* ${name/#pattern/string}, anchored at the start */
+#define PARAM_END    128        /* ${name/%pattern/string}, anchored at the end */
+
+/* Operators of ${name op word} */
+enum {
+    PO_NONE,
+    PO_DEFAULT,     /* - */
+    PO_ASSIGN,      /* = */
+    PO_ERROR,       /* ? */
+    PO_ALTERNATE,   /* + */
+    PO_PREFIX,      /* # and ##, remove a prefix */
+    PO_SUFFIX,      /* % and %%, remove a suffix */
+    PO_REPLACE,     /* /pattern/string */
+    PO_SUBSTRING,   /* :offset:length */
+    PO_UPPER,       /* ^ and ^^ */
+    PO_LOWER,       /* , and ,, */
+};
+
+struct arith;
+struct node;
+struct pattern;
+struct word;
+struct assignment;
+
+typedef struct word_part {
+    int type;
+    bool quoted;            /* inside quotes, never split */
+    const char *text;
+    size_t len;
+    int flags;              /* WP_PARAM: PARAM_ flags */
+    struct word *subscript; /* WP_PARAM: the [ ] of ${name[...]}, NULL if none */
+    int op;                 /* WP_PARAM: PO_ operator of ${name op word} */
+    struct word *word;      /* WP_PARAM: the word after the operator, WP_ARITH: the
+                           expression when it has expansions, else NULL */
+    struct word *word2;     /* WP_PARAM: the string of /, the length of :offset:length */
+    struct pattern *pattern;        /* of a constant pattern word, compiled on first use */
+    struct arith *arith;    /* WP_ARITH or a constant offset: parsed on first use */
+    struct node *node;      /* WP_CMDSUB: parsed with the word, NULL if empty */
+    struct word_part *next;
+} word_part_t;
+
+typedef struct word {
+    word_part_t *parts;
+    struct assignment *assign;      /* NAME=value words, taken apart */
+    struct word *next;
+} word_t;
+
+/* A NAME=value word, taken apart when it is parsed */
+typedef struct assignment {
+    const char *name;       /* "" for a [key]=value inside NAME=( ) */
+    word_t *subscript;      /* NAME[subscript]=value, or NULL */
+    word_t *value;          /* the word after the '=' */
+    word_t *array;          /* NAME=( words ), the words */
+    bool compound;          /* NAME=( words ) */
+    bool append;            /* += */
+} assignment_t;
+
+/* Node types */
+enum {
+    N_CMD,          /* simple command */
+    N_PIPE,         /* pipeline, stages linked from body */
+    N_AND,          /* left && right */
+    N_OR,           /* left || right */
+    N_LIST,         /* items linked from body, run in sequence */
+    N_IF,           /* if left then right else alt */
+    N_WHILE,        /* while left do right */
+    N_UNTIL,        /* until left do right */
+    N_FOR,          /* for name in words do right */
+    N_CASE,         /* case words in body (N_CASEITEM list) */
+    N_CASEITEM,     /* words) right ;; */
+    N_GROUP,        /* { body; } */
+    N_SUBSHELL,     /* ( body ) */
+    N_FUNC,         /* name() body */
+    N_ARITH,        /* (( words )), one WP_ARITH part */
+};
+
+/* Redirection types */
+enum {
+    R_IN,           /* <file */
+    R_OUT,          /* >file, >|file */
+    R_APPEND,       /* >>file */
+    R_RDWR,         /* <>file */
+    R_DUPIN,        /* <&n, <&- */
+    R_DUPOUT,       /* >&n, >&- */
+    R_BOTH,         /* &>file, stdout and stderr */
+    R_BOTHAPPEND,   /* &>>file */
+    R_HEREDOC,      /* <<word, word is the body once it has been read */
+    R_HEREDOCTAB,   /* <<-word, leading tabs stripped */
+    R_HERESTR,      /* <<<word */
+};
+
+typedef struct redir {
+    int type;
+    int fd;                 /* descriptor it applies to */
+    word_t *word;           /* file name, descriptor, or here-document body */
+    const char *delim;      /* here-document delimiter, while the body is unread */
+    bool quoted;            /* quoted delimiter, the body is taken literally */
+    struct redir *next;
+} redir_t;
+
+/* Node flags */
+#define NODE_BG      1  /* terminated by '&' */
+#define NODE_NEGATE  2  /* pipeline prefixed with '!' */
+#define NODE_COND    4  /* [[ ]], words are not split */
+
+struct code;
+
+typedef struct node {
+    int type;
+    int flags;
+    int n;                  /* number of words or stages */
+    int assigns;            /* N_CMD: leading NAME=value words */
+    word_t *words;
+    redir_t *redirs;        /* in the order they are applied */
+    const char *name;       /* N_FOR variable, N_FUNC name */
+    struct node *body;
+    struct node *left;
+    struct node *right;
+    struct node *alt;
+    struct node *next;      /* next stage, list item or case item */
+    arena_t *arena;         /* where the node and its code live */
+    struct code *code;      /* bytecode, compiled on first run */
+} node_t;
+
+#define MAX_HEREDOCS 16
+
+typedef struct {
+    arena_t *arena;
+    const char *src;
+    size_t len;
+    size_t pos;
+    size_t start;           /* offset where the last command began */
+    bool eof;               /* the end of src is the end of input */
+    bool quiet;             /* do not report syntax errors */
+    bool error;
+    bool incomplete;        /* src ended in the middle of a command */
+    int tok;                /* lookahead token */
+    size_t tok_start;
+    word_t *word;
+    bool have_tok;
+    bool regex;             /* lex the right side of [[ =~ ]] */
+    int operand;            /* lex the word of ${name op word}, OPERAND_ mode */
+    int redir;              /* type of the redirection token */
+    int redir_fd;           /* its explicit descriptor, or -1 */
+    redir_t *heredocs[MAX_HEREDOCS];        /* bodies to read after the next newline */
+    int nheredocs;
+} parser_t;
+
+void parser_init(parser_t *p, arena_t *a, const char *src, size_t len, bool eof);
+node_t *parse_next(parser_t *p);
+bool parse_incomplete(const char *src, size_t len);
+const char *word_literal(const word_t *w);
+node_t *node_copy(arena_t *a, const node_t *n);
 
 #endif /* PARSE_H */
@@ -0,0 +1,336 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Glob patterns for Simple Humane Shell (shush).
+ *
+ * A pattern is compiled once into steps: runs of literal bytes, ?, *,
+ * and bracket expressions as a bit per byte value. Matching walks the
+ * steps without recursion or allocation, going back only to the last *
+ * seen, which is all a glob needs. Quoted characters come escaped with a
+ * backslash, the way expand_pattern writes them. Patterns that are only
+ * known once expanded are kept in a small cache, the least recently used
+ * one is replaced.
+ */
+
+#include <ctype.h>
+#include <string.h>
+#include <stdbool.h>
+
+#include "pattern.h"
+
+#define PATTERN_CACHE 32
+
+/* Step types */
+enum {
+    P_END,
+    P_LITERAL,      /* len bytes of text */
+    P_ANY,          /* ? */
+    P_SET,          /* [...] */
+    P_STAR,         /* * */
+};
+
+typedef struct {
+    int type;
+    size_t len;
+    const char *text;
+    const unsigned char *set;       /* 32 bytes, a bit for each byte value */
+} step_t;
+
+struct pattern {
+    step_t *steps;          /* ending in P_END */
+    size_t min;             /* bytes the shortest match takes */
+    bool fixed;             /* no *, every match takes min bytes */
+    int first;              /* the byte every match starts with, or -1 */
+};
+
+typedef struct {
+    const char *src;        /* NULL for a free entry */
+    pattern_t *pattern;
+    arena_t arena;          /* of both */
+    unsigned long used;
+} cache_entry_t;
+
+static const struct {
+    const char *name;
+    int (*is)(int);
+} classes[] = {
+    { "alnum", isalnum }, { "alpha", isalpha }, { "blank", isblank },
+    { "cntrl", iscntrl }, { "digit", isdigit }, { "graph", isgraph },
+    { "lower", islower }, { "print", isprint }, { "punct", ispunct },
+    { "space", isspace }, { "upper", isupper }, { "xdigit", isxdigit },
+    { NULL, NULL },
+};
+
+static cache_entry_t cache[PATTERN_CACHE];
+static unsigned long cache_clock = 0;
+
+/* Function Prototypes */
+static const char *compile_class(const char *s, unsigned char *set);
+static const char *compile_set(arena_t *a, const char *s, step_t *step);
+static bool match_steps(const step_t *st, const char *s, const char *end);
+
+/* [:name:] at s into set, returning where it ends, NULL if it is not one */
+static const char *
+compile_class(const char *s, unsigned char *set)
+{
+    const char *end = strstr(s + 2, ":]");
+    size_t n;
+
+    if (!end)
+        return NULL;
+    n = end - s - 2;
+    for (int i = 0; classes[i].name; i++) {
+        if (strlen(classes[i].name) != n || strncmp(classes[i].name, s + 2, n))
+            continue;
+        for (int c = 0; c < 256; c++)
+            if (classes[i].is(c))
+                set[c >> 3] |= 1 << (c & 7);
+        return end + 2;
+    }
+    return NULL;
+}
+
+/*
+ * The bracket expression after a '[' into step. Returns where it ends,
+ * NULL when there is no closing ']' and the '[' is an ordinary byte.
+ */
+static const char *
+compile_set(arena_t *a, const char *s, step_t *step)
+{
+    unsigned char *set = arena_zalloc(a, 32);
+    const char *start, *next;
+    bool negate = false;
+    int c, last;
+
+    if (*s == '!' || *s == '^') {
+        negate = true;
+        s++;
+    }
+    /* A ']' first is one of the set */
+    for (start = s; *s && (*s != ']' || s == start);) {
+        if (*s == '[' && s[1] == ':' && (next = compile_class(s, set))) {
+            s = next;
+            continue;
+        }
+        if (*s == '\\' && s[1])
+            s++;
+        c = last = (unsigned char)*s++;
+        if (*s == '-' && s[1] && s[1] != ']') {
+            if (*++s == '\\' && s[1])
+                s++;
+            last = (unsigned char)*s++;
+        }
+        for (; c <= last; c++)
+            set[c >> 3] |= 1 << (c & 7);
+    }
+    if (!*s)
+        return NULL;
+
+    if (negate)
+        for (int i = 0; i < 32; i++)
+            set[i] = ~set[i];
+    step->type = P_SET;
+    step->len = 0;
+    step->text = NULL;
+    step->set = set;
+    return s + 1;
+}
+
+/* Compile src into a, which holds the pattern from then on */
+pattern_t *
+pattern_compile(arena_t *a, const char *src)
+{
+    size_t n = strlen(src), count = 0, nlit = 0;
+    pattern_t *p = arena_alloc(a, sizeof(*p));
+    step_t *st = arena_alloc(a, (n + 1) * sizeof(*st));
+    char *lit = arena_alloc(a, n + 1);      /* the literal runs point into it */
+    const char *s = src, *next;
+
+    p->min = 0;
+    p->fixed = true;
+    while (*s) {
+        if (*s == '*') {
+            p->fixed = false;
+            if (!count || st[count - 1].type != P_STAR)
+                st[count++] = (step_t){ .type = P_STAR };
+            s++;
+        } else if (*s == '?') {
+            st[count++] = (step_t){ .type = P_ANY };
+            p->min++;
+            s++;
+        } else if (*s == '[' && (next = compile_set(a, s + 1, &st[count]))) {
+            count++;
+            p->min++;
+            s = next;
+        } else {
+            if (*s == '\\' && s[1])
+                s++;
+            if (!count || st[count - 1].type != P_LITERAL)
+                st[count++] = (step_t){ .type = P_LITERAL, .text = lit + nlit };
+            lit[nlit++] = *s++;
+            st[count - 1].len++;
+            p->min++;
+        }
+    }
+    st[count] = (step_t){ .type = P_END };
+    p->steps = st;
+    p->first = st[0].type == P_LITERAL ? (unsigned char)st[0].text[0] : -1;
+    return p;
+}
+
+/* The compiled pattern of src, from the cache when it was used lately */
+pattern_t *
+pattern_get(const char *src)
+{
+    cache_entry_t *e, *victim = &cache[0];
+
+    for (e = cache; e < cache + PATTERN_CACHE; e++) {
+        if (e->src && !strcmp(e->src, src)) {
+            e->used = ++cache_clock;
+            return e->pattern;
+        }
+        if (!e->src || (victim->src && e->used < victim->used))
+            victim = e;
+    }
+
+    arena_reset(&victim->arena);
+    victim->src = arena_strndup(&victim->arena, src, strlen(src));
+    victim->pattern = pattern_compile(&victim->arena, src);
+    victim->used = ++cache_clock;
+    return victim->pattern;
+}
+
+/* Whether the steps match all of s up to end */
+static bool
+match_steps(const step_t *st, const char *s, const char *end)
+{
+    const step_t *star = NULL;      /* the step after the last * */
+    const char *retry = NULL;       /* where that * stops for now */
+    unsigned char c;
+
+    for (;;) {
+        switch (st->type) {
+        case P_STAR:
+            if ((++st)->type == P_END)
+                return true;
+            star = st;
+            retry = s;
+            /* Literal text after a * can only start at its first byte */
+            if (st->type == P_LITERAL && !(s = retry = memchr(s, st->text[0], end - s)))
+                return false;
+            continue;
+        case P_END:
+            if (s == end)
+                return true;
+            break;
+        case P_LITERAL:
+            if ((size_t)(end - s) >= st->len && !memcmp(s, st->text, st->len)) {
+                s += st->len;
+                st++;
+                continue;
+            }
+            break;
+        case P_ANY:
+            if (s < end) {
+                s++;
+                st++;
+                continue;
+            }
+            break;
+        case P_SET:
+            if (s < end && (c = *s, st->set[c >> 3] & 1 << (c & 7))) {
+                s++;
+                st++;
+                continue;
+            }
+            break;
+        }
+
+        /* No match this way, the last * takes one more byte */
+        if (!star || retry >= end)
+            return false;
+        s = ++retry;
+        st = star;
+        if (st->type == P_LITERAL && !(s = retry = memchr(s, st->text[0], end - s)))
+            return false;
+    }
+}
+
+/* Whether p matches all of the len bytes at s */
+bool
+pattern_match(const pattern_t *p, const char *s, size_t len)
+{
+    if (len < p->min || (p->fixed && len != p->min))
+        return false;
+    return match_steps(p->steps, s, s + len);
+}
+
+/* Length of the shortest or the longest prefix of s that p matches */
+size_t
+pattern_prefix(const pattern_t *p, const char *s, size_t len, bool longest)
+{
+    size_t i;
+
+    if (len < p->min)
+        return PATTERN_NONE;
+    if (p->fixed)
+        return match_steps(p->steps, s, s + p->min) ? p->min : PATTERN_NONE;
+    if (longest) {
+        for (i = len + 1; i-- > p->min;)
+            if (match_steps(p->steps, s, s + i))
+                return i;
+    } else {
+        for (i = p->min; i <= len; i++)
+            if (match_steps(p->steps, s, s + i))
+                return i;
+    }
+    return PATTERN_NONE;
+}
+
+/* Where the shortest or the longest suffix of s that p matches starts */
+size_t
+pattern_suffix(const pattern_t *p, const char *s, size_t len, bool longest)
+{
+    size_t i;
+
+    if (len < p->min)
+        return PATTERN_NONE;
+    if (p->fixed)
+        return match_steps(p->steps, s + len - p->min, s + len) ? len - p->min : PATTERN_NONE;
+    if (longest) {
+        for (i = 0; i <= len - p->min; i++)
+            if (match_steps(p->steps, s + i, s + len))
+                return i;
+    } else {
+        for (i = len - p->min + 1; i-- > 0;)
+            if (match_steps(p->steps, s + i, s + len))
+                return i;
+    }
+    return PATTERN_NONE;
+}
+
+/*
+ * The leftmost match of p in s, as long as it can be: returns its length
+ * and sets start, or returns PATTERN_NONE.
+ */
+size_t
+pattern_find(const pattern_t *p, const char *s, size_t len, size_t *start)
+{
+    const char *at;
+    size_t n;
+
+    for (size_t i = 0; i + p->min <= len; i++) {
+        if (p->first >= 0) {
+            if (!(at = memchr(s + i, p->first, len - i)))
+                break;
+            if ((i = at - s) + p->min > len)
+                break;
+        }
+        if ((n = pattern_prefix(p, s + i, len - i, true)) != PATTERN_NONE) {
+            *start = i;
+            return n;
+        }
+    }
+    return PATTERN_NONE;
+}
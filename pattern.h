@@ -0,0 +1,27 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Glob patterns for Simple Humane Shell (shush).
+ */
+
+#ifndef PATTERN_H
+#define PATTERN_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "arena.h"
+
+#define PATTERN_NONE ((size_t)-1)       /* no part of the string matches */
+
+typedef struct pattern pattern_t;
+
+pattern_t *pattern_compile(arena_t *a, const char *src);
+pattern_t *pattern_get(const char *src);
+bool pattern_match(const pattern_t *p, const char *s, size_t len);
+size_t pattern_prefix(const pattern_t *p, const char *s, size_t len, bool longest);
+size_t pattern_suffix(const pattern_t *p, const char *s, size_t len, bool longest);
+size_t pattern_find(const pattern_t *p, const char *s, size_t len, size_t *start);
+
+#endif /* PATTERN_H */
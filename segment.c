@@ -0,0 +1,303 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Asynchronous prompt segments for Simple Humane Shell (shush).
+ *
+ * A segment is a command in PS1, written \(command), whose first line of
+ * output is shown in the prompt. Commands such as git status can take
+ * long, so the prompt never waits for one: it is drawn at once with what
+ * the segment showed last in this directory, or with nothing, while a
+ * forked shell runs the command. Output pipes and the deadline timer sit
+ * in one epoll set, which the interactive loop waits on with its other
+ * events. The prompt is drawn again when a value arrives that differs.
+ *
+ * Values are kept per directory and command, and only go stale when a
+ * command runs, so pressing Enter on an empty line starts nothing.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/wait.h>
+#include <stdbool.h>
+#include "builtins.h"
+#include "exec.h"
+#include "jobs.h"
+#include "out.h"
+#include "segment.h"
+
+#define MAX_SEGMENTS    64
+#define SEGMENT_SIZE    256     /* of the output kept */
+#define SEGMENT_TIMEOUT 2000    /* milliseconds a command may run */
+#define MAX_EVENTS      8
+
+typedef struct {
+    char *cwd;              /* NULL for a free slot */
+    char *command;
+    size_t command_len;
+    char value[SEGMENT_SIZE];       /* what the prompt shows */
+    char out[SEGMENT_SIZE];         /* output of the running command */
+    size_t out_len;
+    bool stale;
+    pid_t pid;              /* of the running command, 0 when none */
+    int fd;
+    uint64_t deadline;
+    unsigned long used;     /* when last shown, the oldest goes first */
+} segment_t;
+
+static segment_t segments[MAX_SEGMENTS];
+static unsigned long clock_tick = 0;
+static int epfd = -1, timer_fd = -1;
+
+/* Function Prototypes */
+static uint64_t now(void);
+static void arm(void);
+static segment_t *slot(const char *command, size_t len, const char *cwd);
+static void start(segment_t *s);
+static bool finish(segment_t *s, bool done);
+static bool take_output(segment_t *s);
+
+/* Milliseconds on the monotonic clock */
+static uint64_t
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* Set the timer for the first deadline of those running, or stop it */
+static void
+arm(void)
+{
+    struct itimerspec it = { 0 };
+    uint64_t first = 0;
+
+    for (int i = 0; i < MAX_SEGMENTS; i++)
+        if (segments[i].pid && (!first || segments[i].deadline < first))
+            first = segments[i].deadline;
+    it.it_value.tv_sec = first / 1000;
+    it.it_value.tv_nsec = first % 1000 * 1000000;
+    timerfd_settime(timer_fd, TFD_TIMER_ABSTIME, &it, NULL);
+}
+
+/* The segment for command in cwd, taking a new one if there is none */
+static segment_t *
+slot(const char *command, size_t len, const char *cwd)
+{
+    segment_t *s, *oldest = NULL;
+
+    for (int i = 0; i < MAX_SEGMENTS; i++) {
+        s = &segments[i];
+        if (s->cwd && s->command_len == len && !memcmp(s->command, command, len) &&
+            !strcmp(s->cwd, cwd))
+            return s;
+        if (!s->pid && (!oldest || !s->cwd || (oldest->cwd && s->used < oldest->used)))
+            oldest = s;
+    }
+    if (!(s = oldest))
+        return NULL;
+
+    free(s->cwd);
+    free(s->command);
+    s->cwd = strdup(cwd);
+    s->command = strndup(command, len);
+    if (!s->cwd || !s->command) {
+        perror("strdup");
+        exit(1);
+    }
+    s->command_len = len;
+    s->value[0] = '\0';
+    s->stale = true;
+    return s;
+}
+
+/*
+ * Run the command of s in a forked shell with its output in a pipe. It
+ * has a process group of its own, so keys typed at the prompt never
+ * signal it, and no terminal to read from or write errors to.
+ */
+static void
+start(segment_t *s)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = s };
+    int pipefd[2], fd;
+    sigset_t none;
+    pid_t pid;
+
+    s->stale = false;
+    if (segments_fd() < 0 || pipe(pipefd) < 0)
+        return;
+    fcntl(pipefd[0], F_SETFD, FD_CLOEXEC);
+    fcntl(pipefd[0], F_SETFL, O_NONBLOCK);
+
+    out_flush();
+    fflush(stderr);
+    if ((pid = fork()) == 0) {
+        setpgid(0, 0);
+        sigemptyset(&none);
+        sigprocmask(SIG_SETMASK, &none, NULL);
+        signal(SIGINT, SIG_DFL);
+        if ((fd = open("/dev/null", O_RDWR)) >= 0) {
+            dup2(fd, STDIN_FILENO);
+            dup2(fd, STDERR_FILENO);
+            if (fd > STDERR_FILENO)
+                close(fd);
+        }
+        dup2(pipefd[1], STDOUT_FILENO);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        job_child();
+        job_control = false;
+        interactive = false;
+        parse_and_execute(s->command);
+        out_flush();
+        _exit(last_exit_status);
+    }
+    close(pipefd[1]);
+    if (pid < 0) {
+        perror("shush: fork failed");
+        close(pipefd[0]);
+        return;
+    }
+
+    setpgid(pid, pid);
+    s->pid = pid;
+    s->fd = pipefd[0];
+    s->out_len = 0;
+    s->deadline = now() + SEGMENT_TIMEOUT;
+    epoll_ctl(epfd, EPOLL_CTL_ADD, s->fd, &ev);
+    arm();
+}
+
+/*
+ * Collect the command of s, killing what is left of it. Its first line
+ * is the new value when it finished in time, a command past its
+ * deadline leaves the old one. Returns whether the value changed.
+ */
+static bool
+finish(segment_t *s, bool done)
+{
+    size_t n;
+
+    epoll_ctl(epfd, EPOLL_CTL_DEL, s->fd, NULL);
+    close(s->fd);
+    if (!done || waitpid(s->pid, NULL, WNOHANG) == 0) {
+        kill(-s->pid, SIGKILL);
+        waitpid(s->pid, NULL, 0);
+    }
+    s->pid = 0;
+    arm();
+    if (!done)
+        return false;
+
+    n = strcspn(s->out, "\n");
+    s->out[n] = '\0';
+    if (!strcmp(s->value, s->out))
+        return false;
+    memcpy(s->value, s->out, n + 1);
+    return true;
+}
+
+/* Read what the command of s wrote, true when its value changed */
+static bool
+take_output(segment_t *s)
+{
+    ssize_t n;
+
+    while ((n = read(s->fd, s->out + s->out_len, sizeof(s->out) - 1 - s->out_len)) > 0) {
+        s->out_len += n;
+        s->out[s->out_len] = '\0';
+        /* The first line is all that is shown */
+        if (memchr(s->out, '\n', s->out_len) || s->out_len == sizeof(s->out) - 1)
+            return finish(s, true);
+    }
+    if (n == 0 || errno != EAGAIN) {
+        s->out[s->out_len] = '\0';
+        return finish(s, true);
+    }
+    return false;
+}
+
+/*
+ * What to show for command in cwd now: its last value, or nothing the
+ * first time. A stale value is shown while the command runs again.
+ */
+const char *
+segment_value(const char *command, size_t len, const char *cwd)
+{
+    segment_t *s = slot(command, len, cwd);
+
+    if (!s)
+        return "";
+    s->used = ++clock_tick;
+    if (s->stale && !s->pid)
+        start(s);
+    return s->value;
+}
+
+/* A command ran, what every segment shows may be out of date */
+void
+segments_stale(void)
+{
+    for (int i = 0; i < MAX_SEGMENTS; i++)
+        segments[i].stale = true;
+}
+
+/* The epoll set of the running commands and their deadline timer */
+int
+segments_fd(void)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+
+    if (epfd >= 0)
+        return epfd;
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0 ||
+        epoll_ctl(epfd, EPOLL_CTL_ADD, timer_fd, &ev) < 0) {
+        perror("shush: prompt segments");
+        if (epfd >= 0)
+            close(epfd);
+        epfd = -1;
+    }
+    return epfd;
+}
+
+/* Take the output and deadlines that are due, true if a value changed */
+bool
+segments_poll(void)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    segment_t *s;
+    uint64_t expired, t;
+    bool changed = false;
+    int n;
+
+    if (epfd < 0 || (n = epoll_wait(epfd, ev, MAX_EVENTS, 0)) <= 0)
+        return false;
+    for (int i = 0; i < n; i++) {
+        if ((s = ev[i].data.ptr)) {
+            if (s->pid)
+                changed |= take_output(s);
+            continue;
+        }
+        /* The timer: give up on the commands past their deadline */
+        while (read(timer_fd, &expired, sizeof(expired)) > 0)
+            ;
+        t = now();
+        for (int j = 0; j < MAX_SEGMENTS; j++)
+            if (segments[j].pid && segments[j].deadline <= t)
+                finish(&segments[j], false);
+    }
+    return changed;
+}
@@ -0,0 +1,19 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Asynchronous prompt segments for Simple Humane Shell (shush).
+ */
+
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+const char *segment_value(const char *command, size_t len, const char *cwd);
+void segments_stale(void);
+int segments_fd(void);
+bool segments_poll(void);
+
+#endif /* SEGMENT_H */
@@ -6,107 +6,400 @@
  */
 
 #include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdbool.h>
+#include <sys/epoll.h>
+#include <sys/mman.h>
+#include <sys/signalfd.h>
+#include <sys/stat.h>
+#include <sys/timerfd.h>
 #include <sys/types.h>
-#include <sys/wait.h>
 #include <unistd.h>
 
 #include "builtins.h"
+#include "complete.h"
+#include "exec.h"
+#include "history.h"
 #include "init.h"
+#include "jobs.h"
+#include "out.h"
+#include "libtline/readline.h"
 #include "parse.h"
+#include "segment.h"
 #include "terminal.h"
+#include "var.h"
 
 #define MAX_PROMPT_LENGTH  1024
-#define MAX_INPUT_LENGTH   8192
+#define READ_CHUNK         (64 * 1024)
+#define INPUT_CHUNK        4096
+#define MAX_EVENTS         8
 
-static pid_t child_pid = -1;
 int last_exit_status;
 
+/* Event sources of the interactive loop */
+enum {
+    EV_INPUT,
+    EV_SIGNAL,
+    EV_JOBS,
+    EV_TIMEOUT,
+    EV_SEGMENTS,
+};
+
+/* The interactive loop: its descriptors, the command being typed, and input read ahead */
+static int epfd = -1, signal_fd = -1, timer_fd = -1;
+static char *command = NULL;
+static size_t command_size = 0, command_len = 0;
+static char input[INPUT_CHUNK];
+static size_t input_len = 0, input_pos = 0;
+
+/*
+ * ^C while a command runs. At the prompt SIGINT is blocked and read from
+ * the signalfd instead, so this is all a handler has to do.
+ */
 static void
 handle_sigint(int sig)
 {
-    if (child_pid > 0) {
-        kill(child_pid, SIGTERM);
-        waitpid(child_pid, NULL, 0);
-        child_pid = -1;
-    } else {
-        putchar('\n');
-        fflush(stdout);
+    (void)sig;
+    interrupted = 1;
+}
 
-        char prompt[MAX_PROMPT_LENGTH];
-        update_prompt(prompt, sizeof(prompt));
-        printf("%s", prompt);
-        fflush(stdout);
+/* Grow a buffer to hold at least size bytes */
+static void
+reserve(char **buf, size_t *buf_size, size_t size)
+{
+    if (size <= *buf_size)
+        return;
+
+    while (*buf_size < size)
+        *buf_size = *buf_size ? *buf_size * 2 : 256;
+    *buf = realloc(*buf, *buf_size);
+    if (!*buf) {
+        perror("realloc");
+        exit(1);
     }
 }
 
-static char *
-read_multiline_input(void)
+/*
+ * Execute a non-seekable stream such as a pipe, in large chunks. Each
+ * chunk runs as far as it holds complete commands, the rest waits for
+ * the next read.
+ */
+static void
+run_stream(int fd)
 {
-    char buffer[MAX_INPUT_LENGTH];
-    size_t buffer_size = 0;
-    char *line = NULL;
+    char *buf = NULL;
+    size_t buf_size = 0, len = 0, done;
+    ssize_t n;
 
-    while (1) {
-        char prompt[MAX_PROMPT_LENGTH];
-        update_prompt(prompt, sizeof(prompt));
-        line = terminal_readline(prompt);
-
-        if (!line) {
-            if (buffer_size == 0)
-                return NULL;
+    for (;;) {
+        reserve(&buf, &buf_size, len + READ_CHUNK);
+        n = read(fd, buf + len, buf_size - len);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n <= 0)
             break;
-        }
+        len += n;
 
-        size_t line_length = strlen(line);
-        if (buffer_size + line_length >= MAX_INPUT_LENGTH) {
-            fputs("Input exceeds maximum length.\n", stderr);
-            free(line);
-            return NULL;
+        if ((done = execute_buffer(buf, len, false, -1, 0))) {
+            memmove(buf, buf + done, len - done);
+            len -= done;
         }
+    }
+    if (n < 0)
+        perror("shush: read");
 
-        memcpy(buffer + buffer_size, line, line_length);
-        buffer_size += line_length;
-        free(line);
+    execute_buffer(buf, len, true, -1, 0);
+    free(buf);
+}
 
-        if (buffer_size > 0 && buffer[buffer_size - 1] == '\\') {
-            buffer_size--;
-            prompt[0] = '\0'; // Continuation prompt
-        } else {
+/*
+ * Execute a script from fd. Regular files are mapped into memory in one
+ * go and never touch stdio, anything else is read in chunks. sync_fd is
+ * fd itself when the script is our stdin.
+ */
+static void
+run_fd(int fd, int sync_fd)
+{
+    struct stat st;
+    off_t start = 0;
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode)) {
+        run_stream(fd);
+        return;
+    }
+    if (sync_fd >= 0 && (start = lseek(fd, 0, SEEK_CUR)) < 0)
+        start = 0;
+    if (st.st_size <= start)
+        return;
+
+    char *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map == MAP_FAILED) {
+        run_stream(fd);
+        return;
+    }
+    /* The script runs from the mapping, the descriptor is not needed */
+    if (sync_fd < 0)
+        close(fd);
+
+    execute_buffer(map + start, st.st_size - start, true, sync_fd, start);
+    munmap(map, st.st_size);
+}
+
+static void
+watch(int fd, int key)
+{
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = key };
+
+    if (fd >= 0 && epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) < 0)
+        perror("shush: epoll_ctl");
+}
+
+/* Log out after TMOUT seconds at the primary prompt, if it is set */
+static void
+arm_timeout(bool on)
+{
+    struct itimerspec it = { 0 };
+    const char *tmout = var_get("TMOUT");
+
+    if (on && tmout)
+        it.it_value.tv_sec = strtol(tmout, NULL, 10);
+    if (it.it_value.tv_sec < 0)
+        it.it_value.tv_sec = 0;
+    timerfd_settime(timer_fd, 0, &it, NULL);
+}
+
+/* Start reading a line: the prompt, or "> " in the middle of a command */
+static void
+prompt(void)
+{
+    char text[MAX_PROMPT_LENGTH];
+
+    if (command_len == 0) {
+        jobs_notify();
+        history_sync();
+        update_prompt(text, sizeof(text));
+        arm_timeout(true);
+        readline_begin(text);
+    } else {
+        readline_begin("> ");
+    }
+}
+
+/* Run the command typed, with signals delivered as usual while it runs */
+static void
+run_line(sigset_t *blocked)
+{
+    arm_timeout(false);
+    command[command_len] = '\0';
+
+    /* History keeps what was typed, not what scripts run */
+    if (command[strspn(command, " \t\n")]) {
+        history_add(command);
+        prompt_command_ran();
+    }
+
+    interrupted = 0;
+    sigprocmask(SIG_UNBLOCK, blocked, NULL);
+    parse_and_execute(command);
+    sigprocmask(SIG_BLOCK, blocked, NULL);
+    if (interrupted) {
+        last_exit_status = 128 + SIGINT;
+        out_char('\n');
+    }
+    out_flush();
+    command_len = 0;
+}
+
+/* Draw the prompt again when a segment of it has something new */
+static void
+take_segments(void)
+{
+    char text[MAX_PROMPT_LENGTH];
+
+    if (!segments_poll())
+        return;
+    prompt_invalidate();
+    if (command_len == 0) {
+        update_prompt(text, sizeof(text));
+        readline_set_prompt(text);
+    }
+}
+
+/* Act on the signals waiting in the signalfd */
+static void
+take_signals(void)
+{
+    struct signalfd_siginfo si;
+
+    while (read(signal_fd, &si, sizeof(si)) == sizeof(si)) {
+        switch (si.ssi_signo) {
+        case SIGINT:
+            /* Drop the line and anything typed before it */
+            free(readline_end());
+            out_char('\n');
+            command_len = 0;
+            input_pos = input_len = 0;
+            last_exit_status = 128 + SIGINT;
+            prompt();
+            break;
+        case SIGWINCH:
+            readline_redraw();
+            break;
+        case SIGCHLD:
+            jobs_poll();
             break;
         }
     }
+}
 
-    buffer[buffer_size] = '\0';
+/*
+ * Wait for input, signals, jobs and the TMOUT timer all in one epoll set.
+ * Nothing happens in signal handlers: the shell sees each event here and
+ * deals with it between keystrokes, and jobs are reaped while the prompt
+ * waits for the next one. Returns when input ends or TMOUT runs out.
+ */
+static void
+run_interactive(void)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    struct sigaction sa = { .sa_handler = handle_sigint };
+    sigset_t blocked;
+    size_t used;
+    ssize_t n;
+    char *line;
+    bool ended = false;
+    int i, count;
+
+    interactive = true;
+    sigemptyset(&blocked);
+    sigaddset(&blocked, SIGINT);
+    sigaddset(&blocked, SIGCHLD);
+    sigaddset(&blocked, SIGWINCH);
+    sigprocmask(SIG_BLOCK, &blocked, NULL);
+    sigaction(SIGINT, &sa, NULL);
+    jobs_init(true);
+    history_init();
+    complete_init();
 
-    if (buffer_size > 0) {
-        fflush(stdout);
+    if ((epfd = epoll_create1(EPOLL_CLOEXEC)) < 0 ||
+        (signal_fd = signalfd(-1, &blocked, SFD_NONBLOCK | SFD_CLOEXEC)) < 0 ||
+        (timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC)) < 0) {
+        perror("shush");
+        exit(1);
     }
+    watch(STDIN_FILENO, EV_INPUT);
+    watch(signal_fd, EV_SIGNAL);
+    watch(jobs_fd(), EV_JOBS);
+    watch(timer_fd, EV_TIMEOUT);
+    watch(segments_fd(), EV_SEGMENTS);
 
-    return strdup(buffer);
+    prompt();
+    while (!ended) {
+        /* Input read ahead while the last command ran goes first */
+        if (input_pos == input_len) {
+            if ((count = epoll_wait(epfd, ev, MAX_EVENTS, -1)) < 0) {
+                if (errno == EINTR)
+                    continue;
+                perror("shush: epoll_wait");
+                break;
+            }
+            for (i = 0; i < count; i++) {
+                switch (ev[i].data.u32) {
+                case EV_SIGNAL:
+                    take_signals();
+                    break;
+                case EV_JOBS:
+                    jobs_poll();
+                    break;
+                case EV_SEGMENTS:
+                    take_segments();
+                    break;
+                case EV_TIMEOUT:
+                    free(readline_end());
+                    fputs("\ntimed out waiting for input: auto-logout\n", stderr);
+                    return;
+                case EV_INPUT:
+                    if (input_pos < input_len)
+                        break;
+                    while ((n = read(STDIN_FILENO, input, sizeof(input))) < 0 && errno == EINTR)
+                        ;
+                    input_pos = 0;
+                    input_len = n > 0 ? n : 0;
+                    /* Input ended, or the terminal went away */
+                    if (n <= 0)
+                        ended = true;
+                    break;
+                }
+            }
+            if (!ended && input_pos == input_len)
+                continue;
+        }
+
+        if (!ended) {
+            used = 0;
+            n = readline_feed(input + input_pos, input_len - input_pos, &used);
+            input_pos += used;
+            if (n == READLINE_MORE)
+                continue;
+        }
+
+        /* ^D on an empty line ends the shell, or just the command started */
+        line = readline_end();
+        if (!line) {
+            if (command_len == 0 || ended)
+                break;
+            out_char('\n');
+        } else {
+            reserve(&command, &command_size, command_len + strlen(line) + 2);
+            command_len += sprintf(command + command_len, "%s\n", line);
+            free(line);
+            if (!ended && parse_incomplete(command, command_len)) {
+                prompt();
+                continue;
+            }
+        }
+        run_line(&blocked);
+        if (!ended)
+            prompt();
+    }
+    out_char('\n');
 }
 
 int
 main(int argc, char *argv[])
 {
-    signal(SIGINT, handle_sigint);
     initialize_shell();
 
-    while (1) {
-        char *line = read_multiline_input();
-        if (!line) {
-            if (feof(stdin))
-                break;
-            continue;
+    if (argc > 2 && !strcmp(argv[1], "-c")) {
+        /* shush -c 'cmds' [name [args...]] */
+        if (argc > 3)
+            set_positional_params(argc - 3, argv + 3);
+        else
+            set_positional_params(1, argv);
+        execute_buffer(argv[2], strlen(argv[2]), true, -1, 0);
+    } else if (argc == 2 && !strcmp(argv[1], "-c")) {
+        fprintf(stderr, "shush: -c: option requires an argument\n");
+        return 2;
+    } else if (argc > 1) {
+        /* shush script [args...] */
+        int fd = open(argv[1], O_RDONLY | O_CLOEXEC);
+        if (fd < 0) {
+            fprintf(stderr, "shush: %s: %s\n", argv[1], strerror(errno));
+            return 127;
         }
-
-        parse_and_execute(line);
-        free(line);
-
+        set_positional_params(argc - 1, argv + 1);
+        run_fd(fd, -1);
+    } else if (!isatty(STDIN_FILENO)) {
+        set_positional_params(1, argv);
+        run_fd(STDIN_FILENO, STDIN_FILENO);
+    } else {
+        set_positional_params(1, argv);
+        run_interactive();
     }
 
-    return 0;
+    return last_exit_status;
 }
@@ -1,46 +1,212 @@
 #include "terminal.h"
-#include "libtline/readline.h"
+#include "segment.h"
+#include "var.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
+#include <sys/stat.h>
 
 #define MAX_INPUT_LENGTH  8192
+#define MAX_PROMPT_LENGTH 1024
+#define MAX_PIECES        64
 
-// Update the prompt using existing code
-void update_prompt(char *prompt, size_t size)
+// What PS1 is when it is not set
+#define DEFAULT_PS1 "[\\u@\\H \\w]\\$ "
+
+// One part of PS1, either text or an escape filled in when drawn
+typedef struct {
+    char kind;          // 0 for text, the escape letter otherwise
+    const char *text;
+    size_t len;
+} piece_t;
+
+/*
+ * PS1 is compiled into pieces when it changes and the prompt they make
+ * is kept until something it shows might have changed: cd, a variable
+ * it uses, or the current directory turning out to be another one. With
+ * \(command) segments in it, also a command that ran, or a segment that
+ * came back with something new.
+ */
+static char *ps1 = NULL;
+static piece_t pieces[MAX_PIECES];
+static int piece_count = 0;
+static char rendered[MAX_PROMPT_LENGTH];
+static bool valid = false;
+static bool has_segments = false;
+static dev_t cwd_dev;
+static ino_t cwd_ino;
+
+// Split PS1 into text and escapes, which stay pointing into ps1
+static void
+compile(const char *source)
+{
+    const char *p;
+
+    free(ps1);
+    if (!(ps1 = strdup(source))) {
+        perror("strdup");
+        exit(EXIT_FAILURE);
+    }
+    piece_count = 0;
+    has_segments = false;
+    for (p = ps1; *p && piece_count < MAX_PIECES; ) {
+        piece_t *piece = &pieces[piece_count++];
+
+        if (*p == '\\' && p[1] == '(') {
+            // A segment runs to the parenthesis that closes it
+            int depth = 1;
+
+            piece->kind = '(';
+            piece->text = p += 2;
+            for (; *p && (depth -= (*p == ')') - (*p == '(')) > 0; p++)
+                ;
+            piece->len = p - piece->text;
+            if (*p)
+                p++;
+            has_segments = true;
+        } else if (*p == '\\' && p[1] && strchr("uhHwW$sv", p[1])) {
+            piece->kind = p[1];
+            p += 2;
+        } else if (*p == '\\' && p[1]) {
+            // \n, \e and the like are text, \[ and \] become the \001 and \002
+            // that tell readline what takes no columns
+            piece->kind = 0;
+            piece->text = p[1] == 'n' ? "\n" : p[1] == 'e' ? "\033" : p[1] == 'a' ? "\a" :
+                          p[1] == '[' ? "\001" : p[1] == ']' ? "\002" : p + 1;
+            piece->len = 1;
+            p += 2;
+        } else {
+            piece->kind = 0;
+            piece->text = p;
+            piece->len = strcspn(p, "\\");
+            if (piece->len == 0)
+                piece->len = 1;
+            p += piece->len;
+        }
+    }
+}
+
+// Append n bytes of s to the prompt at *at, as far as they fit
+static void
+append(size_t *at, const char *s, size_t n)
+{
+    if (n > sizeof(rendered) - 1 - *at) {
+        fprintf(stderr, "Warning: Prompt string truncated.\n");
+        n = sizeof(rendered) - 1 - *at;
+    }
+    memcpy(rendered + *at, s, n);
+    *at += n;
+}
+
+static void
+render(void)
 {
     char cwd[1024];
-    char temp[1024];
-    const char *home = getenv("HOME");
-    const char *user = getenv("USER") ? getenv("USER") : "user";
-    const char *hostname = getenv("HOSTNAME") ? getenv("HOSTNAME") : "localhost";
+    const char *home = var_get("HOME");
+    const char *user = var_get("USER") ? var_get("USER") : "user";
+    const char *hostname = var_get("HOSTNAME") ? var_get("HOSTNAME") : "localhost";
+    const char *source = var_get("PS1") ? var_get("PS1") : DEFAULT_PS1;
+    const char *s;
+    size_t at = 0, home_len = home ? strlen(home) : 0;
+    struct stat st;
+
+    if (!ps1 || strcmp(ps1, source))
+        compile(source);
 
     if (!getcwd(cwd, sizeof(cwd))) {
         perror("getcwd");
         snprintf(cwd, sizeof(cwd), "[unknown]");
-    } else if (home && strncmp(cwd, home, strlen(home)) == 0) {
-        snprintf(temp, sizeof(temp), "~%s", cwd + strlen(home));
-        strncpy(cwd, temp, sizeof(cwd));
+    }
+    if (stat(".", &st) == 0) {
+        cwd_dev = st.st_dev;
+        cwd_ino = st.st_ino;
     }
 
-    if (geteuid() == 0)
-        snprintf(prompt, size, "[%s@%s %s]# ", user, hostname, cwd);
-    else
-        snprintf(prompt, size, "[%s@%s %s]$ ", user, hostname, cwd);
-
-    if (strlen(prompt) >= size) {
-        fprintf(stderr, "Warning: Prompt string truncated.\n");
-        prompt[size - 1] = '\0';
+    for (int i = 0; i < piece_count; i++) {
+        switch (pieces[i].kind) {
+        case 0:
+            append(&at, pieces[i].text, pieces[i].len);
+            break;
+        case 'u':
+            append(&at, user, strlen(user));
+            break;
+        case 'h':
+            append(&at, hostname, strcspn(hostname, "."));
+            break;
+        case 'H':
+            append(&at, hostname, strlen(hostname));
+            break;
+        case 'w':
+            if (home_len && !strncmp(cwd, home, home_len) && (cwd[home_len] == '/' || !cwd[home_len])) {
+                append(&at, "~", 1);
+                append(&at, cwd + home_len, strlen(cwd + home_len));
+            } else {
+                append(&at, cwd, strlen(cwd));
+            }
+            break;
+        case 'W':
+            s = strrchr(cwd, '/');
+            s = s && s[1] ? s + 1 : cwd;
+            append(&at, s, strlen(s));
+            break;
+        case '$':
+            append(&at, geteuid() == 0 ? "#" : "$", 1);
+            break;
+        case 's':
+            append(&at, "shush", 5);
+            break;
+        case 'v':
+            append(&at, "1.0", 3);
+            break;
+        case '(':
+            s = segment_value(pieces[i].text, pieces[i].len, cwd);
+            append(&at, s, strlen(s));
+            break;
+        }
     }
+    rendered[at] = '\0';
+    valid = true;
 }
 
-/*
- * Use the readline function from libtline for input handling.
- */
-char *terminal_readline(const char *prompt)
+// The prompt for the next command, drawn again only when it may differ
+void update_prompt(char *prompt, size_t size)
 {
-    // Use readline from libtline instead of custom implementation
-    return readline(prompt);
+    struct stat st;
+
+    // Something else moved us, or our directory was replaced
+    if (valid && (stat(".", &st) < 0 || st.st_dev != cwd_dev || st.st_ino != cwd_ino))
+        valid = false;
+    if (!valid)
+        render();
+
+    snprintf(prompt, size, "%s", rendered);
 }
 
+void prompt_invalidate(void)
+{
+    valid = false;
+}
+
+// A command ran, so what the segments show may be out of date
+void prompt_command_ran(void)
+{
+    if (has_segments) {
+        segments_stale();
+        valid = false;
+    }
+}
+
+// Called when a variable is set or unset, for those the prompt shows
+void prompt_variable_changed(const char *name)
+{
+    static const char *const used[] = { "PS1", "HOME", "USER", "HOSTNAME", NULL };
+
+    for (int i = 0; used[i]; i++) {
+        if (!strcmp(name, used[i])) {
+            valid = false;
+            return;
+        }
+    }
+}
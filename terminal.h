@@ -11,5 +11,8 @@
 #include <stddef.h>  // Include this header for size_t
 
 void update_prompt(char *prompt, size_t size);
-char *terminal_readline(const char *prompt);
+void prompt_invalidate(void);
+void prompt_command_ran(void);
+void prompt_variable_changed(const char *name);
+
 #endif /* TERMINAL_H */
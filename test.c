@@ -0,0 +1,470 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * test, [ and [[ built-ins for Simple Humane Shell (shush).
+ *
+ * Conditions are evaluated in the shell instead of running /usr/bin/[.
+ * A file test costs a single stat (lstat for -h and -L), and -r, -w and
+ * -x are answered from the same stat buffer. Regular expressions used
+ * with [[ =~ ]] are compiled once and kept for the next match.
+ *
+ * The words of [[ arrive expanded as patterns, with quoted glob and
+ * regex characters escaped by a backslash, so the right side of == and
+ * =~ can tell quoted text from pattern text. Everything else has the
+ * escapes removed before use.
+ */
+
+#include <regex.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <stdbool.h>
+#include "builtins.h"
+#include "pattern.h"
+
+#define REGEX_CACHE 16
+#define MAX_GROUPS 64
+
+typedef struct {
+    const char *name;       /* test, [ or [[ */
+    char **argv;
+    int argc;
+    int pos;
+    bool cond;              /* [[ rules rather than test rules */
+    bool error;
+} test_t;
+
+/* Compiled regular expressions, the least recently used one is replaced */
+typedef struct {
+    char *src;
+    regex_t re;
+    unsigned long used;
+} regex_entry_t;
+
+static regex_entry_t regex_cache[REGEX_CACHE];
+static unsigned long regex_clock = 0;
+
+/* Function Prototypes */
+static int run_test(test_t *t);
+static bool test_eval(test_t *t);
+static bool test_or(test_t *t);
+static bool test_and(test_t *t);
+static bool test_not(test_t *t);
+static bool test_primary(test_t *t);
+static bool is_unary(const char *op);
+static bool is_binary(test_t *t, const char *op);
+static bool unary_test(test_t *t, const char *op, char *arg);
+static bool binary_test(test_t *t, char *a, const char *op, char *b);
+static bool can_access(const struct stat *st, int mode);
+static bool in_group(gid_t gid);
+static bool get_number(test_t *t, const char *s, long long *v);
+static regex_t *regex_get(test_t *t, const char *src);
+static char *operand(test_t *t, char *s);
+static void test_error(test_t *t, const char *msg, const char *arg);
+
+static void
+test_error(test_t *t, const char *msg, const char *arg)
+{
+    if (!t->error) {
+        if (arg)
+            fprintf(stderr, "%s: %s: %s\n", t->name, arg, msg);
+        else
+            fprintf(stderr, "%s: %s\n", t->name, msg);
+    }
+    t->error = true;
+}
+
+/* An operand as plain text, with the escapes of [[ removed in place */
+static char *
+operand(test_t *t, char *s)
+{
+    char *r, *w;
+
+    if (!t->cond)
+        return s;
+    for (r = w = s; *r; r++) {
+        if (*r == '\\' && r[1])
+            r++;
+        *w++ = *r;
+    }
+    *w = '\0';
+    return s;
+}
+
+static bool
+is_unary(const char *op)
+{
+    return op[0] == '-' && op[1] && !op[2] && strchr("bcdefghkprstuwxGLNOSnz", op[1]);
+}
+
+static bool
+is_binary(test_t *t, const char *op)
+{
+    static const char *const ops[] = {
+        "=", "==", "!=", "<", ">", "-eq", "-ne", "-lt", "-le", "-gt", "-ge",
+        "-nt", "-ot", "-ef", NULL
+    };
+
+    if (t->cond && !strcmp(op, "=~"))
+        return true;
+    for (int i = 0; ops[i]; i++)
+        if (!strcmp(op, ops[i]))
+            return true;
+    return false;
+}
+
+static bool
+in_group(gid_t gid)
+{
+    static gid_t groups[MAX_GROUPS];
+    static int count = -1;
+
+    if (gid == getegid())
+        return true;
+    if (count < 0 && (count = getgroups(MAX_GROUPS, groups)) < 0)
+        count = 0;
+    for (int i = 0; i < count; i++)
+        if (groups[i] == gid)
+            return true;
+    return false;
+}
+
+/* access(2) worked out from a stat buffer, mode is R_OK, W_OK or X_OK */
+static bool
+can_access(const struct stat *st, int mode)
+{
+    uid_t uid = geteuid();
+
+    if (uid == 0) {
+        /* root may read and write anything, execute what anyone may */
+        return mode != X_OK || (st->st_mode & (S_IXUSR | S_IXGRP | S_IXOTH)) ||
+               S_ISDIR(st->st_mode);
+    }
+    if (st->st_uid == uid)
+        return st->st_mode & (mode << 6);
+    if (in_group(st->st_gid))
+        return st->st_mode & (mode << 3);
+    return st->st_mode & mode;
+}
+
+static bool
+unary_test(test_t *t, const char *op, char *arg)
+{
+    struct stat st;
+    long long fd;
+
+    arg = operand(t, arg);
+    switch (op[1]) {
+    case 'n':
+        return arg[0] != '\0';
+    case 'z':
+        return arg[0] == '\0';
+    case 't':
+        return get_number(t, arg, &fd) && isatty(fd);
+    case 'h':
+    case 'L':
+        return lstat(arg, &st) == 0 && S_ISLNK(st.st_mode);
+    }
+
+    if (stat(arg, &st) < 0)
+        return false;
+    switch (op[1]) {
+    case 'e': return true;
+    case 'f': return S_ISREG(st.st_mode);
+    case 'd': return S_ISDIR(st.st_mode);
+    case 'b': return S_ISBLK(st.st_mode);
+    case 'c': return S_ISCHR(st.st_mode);
+    case 'p': return S_ISFIFO(st.st_mode);
+    case 'S': return S_ISSOCK(st.st_mode);
+    case 's': return st.st_size > 0;
+    case 'g': return st.st_mode & S_ISGID;
+    case 'u': return st.st_mode & S_ISUID;
+    case 'k': return st.st_mode & S_ISVTX;
+    case 'r': return can_access(&st, R_OK);
+    case 'w': return can_access(&st, W_OK);
+    case 'x': return can_access(&st, X_OK);
+    case 'O': return st.st_uid == geteuid();
+    case 'G': return st.st_gid == getegid();
+    case 'N': return st.st_mtime > st.st_atime;
+    }
+    return false;
+}
+
+static bool
+get_number(test_t *t, const char *s, long long *v)
+{
+    char *end;
+
+    while (*s == ' ' || *s == '\t')
+        s++;
+    *v = strtoll(s, &end, 10);
+    while (*end == ' ' || *end == '\t')
+        end++;
+    if (end == s || *end) {
+        test_error(t, "integer expression expected", s);
+        return false;
+    }
+    return true;
+}
+
+static regex_t *
+regex_get(test_t *t, const char *src)
+{
+    regex_entry_t *e, *victim = &regex_cache[0];
+    char msg[128];
+    int err;
+
+    for (e = regex_cache; e < regex_cache + REGEX_CACHE; e++) {
+        if (e->src && !strcmp(e->src, src)) {
+            e->used = ++regex_clock;
+            return &e->re;
+        }
+        if (!e->src || (victim->src && e->used < victim->used))
+            victim = e;
+    }
+
+    if (victim->src) {
+        regfree(&victim->re);
+        free(victim->src);
+        victim->src = NULL;
+    }
+    if ((err = regcomp(&victim->re, src, REG_EXTENDED | REG_NOSUB)) != 0) {
+        regerror(err, &victim->re, msg, sizeof(msg));
+        test_error(t, msg, src);
+        return NULL;
+    }
+    if (!(victim->src = strdup(src))) {
+        perror("strdup");
+        exit(1);
+    }
+    victim->used = ++regex_clock;
+    return &victim->re;
+}
+
+static bool
+binary_test(test_t *t, char *a, const char *op, char *b)
+{
+    struct stat sa, sb;
+    long long x, y;
+    regex_t *re;
+    bool have_a, have_b;
+
+    if (op[0] != '-') {
+        /* The right side of [[ == and =~ is a pattern */
+        if (t->cond && !strcmp(op, "=~"))
+            return (re = regex_get(t, b)) && regexec(re, operand(t, a), 0, NULL, 0) == 0;
+        if (t->cond && strcmp(op, "<") && strcmp(op, ">")) {
+            a = operand(t, a);
+            return pattern_match(pattern_get(b), a, strlen(a)) == (op[0] != '!');
+        }
+
+        a = operand(t, a);
+        b = operand(t, b);
+        switch (op[0]) {
+        case '=': return strcmp(a, b) == 0;
+        case '!': return strcmp(a, b) != 0;
+        case '<': return strcmp(a, b) < 0;
+        case '>': return strcmp(a, b) > 0;
+        }
+    }
+
+    a = operand(t, a);
+    b = operand(t, b);
+    if (!strcmp(op, "-nt") || !strcmp(op, "-ot") || !strcmp(op, "-ef")) {
+        have_a = stat(a, &sa) == 0;
+        have_b = stat(b, &sb) == 0;
+        if (op[1] == 'e')
+            return have_a && have_b && sa.st_dev == sb.st_dev && sa.st_ino == sb.st_ino;
+        if (op[1] == 'o') {
+            struct stat tmp = sa;
+            bool have = have_a;
+
+            sa = sb;
+            sb = tmp;
+            have_a = have_b;
+            have_b = have;
+        }
+        /* A missing file is older than any existing one */
+        return have_a && (!have_b || sa.st_mtime > sb.st_mtime);
+    }
+
+    if (!get_number(t, a, &x) || !get_number(t, b, &y))
+        return false;
+    if (!strcmp(op, "-eq")) return x == y;
+    if (!strcmp(op, "-ne")) return x != y;
+    if (!strcmp(op, "-lt")) return x < y;
+    if (!strcmp(op, "-le")) return x <= y;
+    if (!strcmp(op, "-gt")) return x > y;
+    return x >= y;
+}
+
+/* '(' or_expr ')' | unary_op WORD | WORD binary_op WORD | WORD */
+static bool
+test_primary(test_t *t)
+{
+    char **a = t->argv + t->pos;
+    int left = t->argc - t->pos;
+    bool v;
+
+    if (left <= 0) {
+        test_error(t, "argument expected", NULL);
+        return false;
+    }
+    if (left >= 3 && is_binary(t, a[1])) {
+        t->pos += 3;
+        return binary_test(t, a[0], a[1], a[2]);
+    }
+    if (!strcmp(a[0], "(") && left > 1) {
+        t->pos++;
+        v = test_or(t);
+        if (t->pos >= t->argc || strcmp(t->argv[t->pos], ")")) {
+            test_error(t, "`)' expected", NULL);
+            return false;
+        }
+        t->pos++;
+        return v;
+    }
+    if (left >= 2 && is_unary(a[0])) {
+        t->pos += 2;
+        return unary_test(t, a[0], a[1]);
+    }
+    t->pos++;
+    return operand(t, a[0])[0] != '\0';
+}
+
+static bool
+test_not(test_t *t)
+{
+    if (t->pos + 1 < t->argc && !strcmp(t->argv[t->pos], "!")) {
+        t->pos++;
+        return !test_not(t);
+    }
+    return test_primary(t);
+}
+
+static bool
+test_and(test_t *t)
+{
+    const char *op = t->cond ? "&&" : "-a";
+    bool v = test_not(t);
+
+    while (!t->error && t->pos < t->argc && !strcmp(t->argv[t->pos], op)) {
+        t->pos++;
+        v = test_not(t) && v;
+    }
+    return v;
+}
+
+static bool
+test_or(test_t *t)
+{
+    const char *op = t->cond ? "||" : "-o";
+    bool v = test_and(t);
+
+    while (!t->error && t->pos < t->argc && !strcmp(t->argv[t->pos], op)) {
+        t->pos++;
+        v = test_and(t) || v;
+    }
+    return v;
+}
+
+/*
+ * POSIX decides what up to four arguments mean by their count, so that
+ * [ "$a" = "$b" ] works whatever $a holds. Longer tests are parsed.
+ */
+static bool
+test_eval(test_t *t)
+{
+    char **a = t->argv;
+    bool v;
+
+    if (!t->cond) {
+        switch (t->argc) {
+        case 0:
+            return false;
+        case 1:
+            return a[0][0] != '\0';
+        case 2:
+            if (!strcmp(a[0], "!"))
+                return a[1][0] == '\0';
+            if (is_unary(a[0]))
+                return unary_test(t, a[0], a[1]);
+            test_error(t, "unary operator expected", a[0]);
+            return false;
+        case 3:
+            if (is_binary(t, a[1]))
+                return binary_test(t, a[0], a[1], a[2]);
+            /* fall through */
+        case 4:
+            if (!strcmp(a[0], "!")) {
+                t->argv++;
+                t->argc--;
+                return !test_eval(t);
+            }
+            if (!strcmp(a[0], "(") && !strcmp(a[t->argc - 1], ")")) {
+                t->argv++;
+                t->argc -= 2;
+                return test_eval(t);
+            }
+            break;
+        }
+    }
+
+    v = test_or(t);
+    if (!t->error && t->pos < t->argc)
+        test_error(t, "unexpected argument", t->argv[t->pos]);
+    return v;
+}
+
+static int
+run_test(test_t *t)
+{
+    bool v = test_eval(t);
+
+    return t->error ? 2 : !v;
+}
+
+/* Built-in test and [ commands */
+void
+builtin_test(char *args[])
+{
+    test_t t = { .name = args[0], .argv = args + 1 };
+
+    while (t.argv[t.argc])
+        t.argc++;
+    if (!strcmp(args[0], "[")) {
+        if (!t.argc || strcmp(t.argv[t.argc - 1], "]")) {
+            fprintf(stderr, "[: missing `]'\n");
+            last_exit_status = 2;
+            return;
+        }
+        t.argc--;
+    }
+    last_exit_status = run_test(&t);
+}
+
+/* Built-in [[ command, the parser hands it words up to ]] unsplit */
+void
+builtin_cond(char *args[])
+{
+    test_t t = { .name = args[0], .argv = args + 1, .cond = true };
+
+    while (t.argv[t.argc])
+        t.argc++;
+    if (!t.argc || strcmp(t.argv[t.argc - 1], "]]")) {
+        fprintf(stderr, "[[: missing `]]'\n");
+        last_exit_status = 2;
+        return;
+    }
+    t.argc--;
+    if (!t.argc) {
+        fprintf(stderr, "[[: expression expected\n");
+        last_exit_status = 2;
+        return;
+    }
+    last_exit_status = run_test(&t);
+}
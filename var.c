@@ -0,0 +1,837 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Shell variables for Simple Humane Shell (shush).
+ *
+ * Variables live in an open addressing hash table, so a lookup is one
+ * probe or a few however many there are. Each keeps its name and value
+ * in one "NAME=value" string, which is just what the environment of a
+ * command needs: envp is an array of pointers to those of the exported
+ * variables, built again only when one of them changed since the last
+ * command was started.
+ *
+ * An array hangs its elements off its variable. An indexed one keeps
+ * them in a vector by index, an associative one in the order they were
+ * added, with a hash table of positions into that order, so walking
+ * them is a walk down a vector either way.
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "arith.h"
+#include "hash.h"
+#include "out.h"
+#include "terminal.h"
+#include "var.h"
+
+#define MIN_SLOTS 256
+#define MIN_INDEX 16            /* slots in the index of an associative array */
+#define MAX_INDEX (1 << 24)     /* past the last element of an indexed array */
+#define NONE SIZE_MAX
+
+typedef struct {
+    char **values;          /* NULL where no element is set */
+    char **keys;            /* associative: NULL for a removed element */
+    size_t len;             /* indexed: last index + 1, associative: ever added */
+    size_t size;
+    size_t count;           /* elements that are set */
+    size_t *index;          /* associative: position + 1, 0 for an empty slot */
+    size_t index_size;
+    bool assoc;
+} array_t;
+
+typedef struct {
+    char *text;             /* "NAME=value", NULL for an empty slot */
+    size_t name_len;
+    unsigned hash;
+    int flags;
+    array_t *array;         /* VAR_ARRAY or VAR_ASSOC, the text has no value */
+} var_t;
+
+/* A value a command's assignment replaced, for as long as it runs */
+typedef struct {
+    char *name;
+    char *text;             /* NULL when it was unset */
+    int flags;
+} saved_t;
+
+/* Marks the slot of a removed variable, so probing goes on past it */
+static char tombstone[] = "";
+
+static var_t *slots = NULL;
+static size_t slot_count = 0;
+static size_t used = 0;         /* slots that are not empty, tombstones too */
+static char **envp = NULL;
+static size_t envp_size = 0;
+static bool envp_stale = true;
+static saved_t *saved = NULL;
+static size_t saved_count = 0, saved_size = 0;
+
+/* Function Prototypes */
+static var_t *find(const char *name, size_t len, unsigned h, bool add);
+static void grow(void);
+static char *make_text(const char *name, size_t len, const char *value);
+static void changed(var_t *v);
+static var_t *add(const char *name, size_t len, unsigned h);
+static bool index_of(const char *key, long long *i);
+static void reserve(array_t *a, size_t n);
+static size_t assoc_find(const array_t *a, const char *key, size_t *slot);
+static void assoc_rehash(array_t *a);
+static void array_empty(array_t *a);
+static bool make_array(var_t *v, bool assoc);
+static const char *element(const var_t *v, const char *key);
+static bool store(var_t *v, const char *key, const char *value, size_t len);
+static int compare_vars(const void *a, const void *b);
+static void print_array(const var_t *v);
+static void print_var(const var_t *v, const char *prefix);
+
+/*
+ * The slot of the variable name, or NULL when there is none. With add,
+ * the slot it goes in instead, which the caller fills.
+ */
+static var_t *
+find(const char *name, size_t len, unsigned h, bool add)
+{
+    var_t *v, *free_slot = NULL;
+    size_t mask = slot_count - 1, i;
+
+    if (!slots)
+        return NULL;
+    for (i = h & mask;; i = (i + 1) & mask) {
+        v = &slots[i];
+        if (!v->text)
+            return add ? (free_slot ? free_slot : v) : NULL;
+        if (v->text == tombstone) {
+            if (!free_slot)
+                free_slot = v;
+        } else if (v->hash == h && v->name_len == len && !memcmp(v->text, name, len)) {
+            return v;
+        }
+    }
+}
+
+/* Make room for one more, rehashing into a larger table past 3/4 full */
+static void
+grow(void)
+{
+    var_t *old = slots, *v;
+    size_t old_count = slot_count;
+
+    if (slots && (used + 1) * 4 < slot_count * 3)
+        return;
+    slot_count = slot_count ? slot_count * 2 : MIN_SLOTS;
+    if (!(slots = calloc(slot_count, sizeof(*slots)))) {
+        perror("calloc");
+        exit(1);
+    }
+    used = 0;
+    for (size_t i = 0; i < old_count; i++) {
+        if (!old[i].text || old[i].text == tombstone)
+            continue;
+        v = find(old[i].text, old[i].name_len, old[i].hash, true);
+        *v = old[i];
+        used++;
+    }
+    free(old);
+}
+
+static char *
+make_text(const char *name, size_t len, const char *value)
+{
+    size_t value_len = strlen(value);
+    char *text = malloc(len + value_len + 2);
+
+    if (!text) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(text, name, len);
+    text[len] = '=';
+    memcpy(text + len + 1, value, value_len + 1);
+    return text;
+}
+
+/* What depends on a variable hears that it changed */
+static void
+changed(var_t *v)
+{
+    char name[64];
+
+    if (v->flags & VAR_EXPORT)
+        envp_stale = true;
+    if (v->name_len >= sizeof(name))
+        return;
+    memcpy(name, v->text, v->name_len);
+    name[v->name_len] = '\0';
+    if (!strcmp(name, "PATH"))
+        hash_clear();
+    prompt_variable_changed(name);
+}
+
+/* Take in the environment the shell started with, all of it exported */
+void
+vars_init(char **env)
+{
+    const char *eq;
+
+    for (; *env; env++)
+        if ((eq = strchr(*env, '=')) && var_valid_name(*env, eq - *env)) {
+            char name[eq - *env + 1];
+
+            memcpy(name, *env, eq - *env);
+            name[eq - *env] = '\0';
+            var_set(name, eq + 1, VAR_EXPORT);
+        }
+}
+
+bool
+var_valid_name(const char *s, size_t len)
+{
+    if (!len || !(s[0] == '_' || (s[0] >= 'a' && s[0] <= 'z') || (s[0] >= 'A' && s[0] <= 'Z')))
+        return false;
+    for (size_t i = 1; i < len; i++)
+        if (!(s[i] == '_' || (s[i] >= 'a' && s[i] <= 'z') || (s[i] >= 'A' && s[i] <= 'Z') ||
+              (s[i] >= '0' && s[i] <= '9')))
+            return false;
+    return true;
+}
+
+/* A new variable in the slot for name, set to nothing */
+static var_t *
+add(const char *name, size_t len, unsigned h)
+{
+    var_t *v;
+
+    grow();
+    v = find(name, len, h, true);
+    if (!v->text)
+        used++;
+    v->text = make_text(name, len, "");
+    v->name_len = len;
+    v->hash = h;
+    v->flags = 0;
+    v->array = NULL;
+    return v;
+}
+
+/* The index key stands for, a number or an arithmetic expression */
+static bool
+index_of(const char *key, long long *i)
+{
+    char *end;
+
+    *i = strtoll(key, &end, 10);
+    return (*key && !*end) || arith_eval_string(key, i);
+}
+
+/* Room for n elements in a */
+static void
+reserve(array_t *a, size_t n)
+{
+    size_t size = a->size ? a->size : 8;
+
+    if (n <= a->size)
+        return;
+    while (size < n)
+        size *= 2;
+    if (!(a->values = realloc(a->values, size * sizeof(*a->values))) ||
+        (a->assoc && !(a->keys = realloc(a->keys, size * sizeof(*a->keys))))) {
+        perror("realloc");
+        exit(1);
+    }
+    memset(a->values + a->size, 0, (size - a->size) * sizeof(*a->values));
+    a->size = size;
+}
+
+/*
+ * Position of key in the associative array a, NONE when it has none.
+ * *slot is where in the index it is, or where it goes.
+ */
+static size_t
+assoc_find(const array_t *a, const char *key, size_t *slot)
+{
+    size_t mask = a->index_size - 1, removed = NONE, i, pos;
+
+    for (i = hash_bytes(key, strlen(key)) & mask;; i = (i + 1) & mask) {
+        if (!a->index[i]) {
+            *slot = removed != NONE ? removed : i;
+            return NONE;
+        }
+        pos = a->index[i] - 1;
+        if (!a->keys[pos]) {
+            /* A removed element, its slot can be taken again */
+            if (removed == NONE)
+                removed = i;
+        } else if (!strcmp(a->keys[pos], key)) {
+            *slot = i;
+            return pos;
+        }
+    }
+}
+
+/* Close the gaps removed elements left, and index the rest again */
+static void
+assoc_rehash(array_t *a)
+{
+    size_t n = 0, slot;
+
+    for (size_t i = 0; i < a->len; i++) {
+        if (!a->keys[i])
+            continue;
+        a->keys[n] = a->keys[i];
+        a->values[n++] = a->values[i];
+    }
+    a->len = n;
+    for (a->index_size = MIN_INDEX; a->index_size * 3 <= (n + 1) * 4 * 2; a->index_size *= 2)
+        ;
+    free(a->index);
+    if (!(a->index = calloc(a->index_size, sizeof(*a->index)))) {
+        perror("calloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < n; i++) {
+        assoc_find(a, a->keys[i], &slot);
+        a->index[slot] = i + 1;
+    }
+}
+
+/* Remove every element of a */
+static void
+array_empty(array_t *a)
+{
+    for (size_t i = 0; i < a->len; i++) {
+        free(a->values[i]);
+        a->values[i] = NULL;
+        if (a->assoc)
+            free(a->keys[i]);
+    }
+    a->len = a->count = 0;
+    if (a->assoc)
+        memset(a->index, 0, a->index_size * sizeof(*a->index));
+}
+
+/* Make v an array, a value it had becomes element 0 */
+static bool
+make_array(var_t *v, bool assoc)
+{
+    const char *value = v->text + v->name_len + 1;
+    array_t *a;
+
+    if (v->array) {
+        if (v->array->assoc == assoc)
+            return true;
+        fprintf(stderr, "shush: %.*s: cannot convert %s array\n", (int)v->name_len, v->text,
+                assoc ? "indexed to associative" : "associative to indexed");
+        return false;
+    }
+    if (!(a = v->array = calloc(1, sizeof(*a)))) {
+        perror("calloc");
+        exit(1);
+    }
+    a->assoc = assoc;
+    if (assoc)
+        assoc_rehash(a);
+    if (*value)
+        store(v, "0", value, strlen(value));
+    v->text[v->name_len + 1] = '\0';
+    v->flags |= assoc ? VAR_ASSOC : VAR_ARRAY;
+    /* Arrays are not in the environment */
+    if (v->flags & VAR_EXPORT)
+        envp_stale = true;
+    return true;
+}
+
+/* The element of v at key, NULL when it is not set */
+static const char *
+element(const var_t *v, const char *key)
+{
+    const array_t *a = v->array;
+    long long i;
+    size_t pos, slot;
+
+    if (a && a->assoc)
+        return (pos = assoc_find(a, key, &slot)) != NONE ? a->values[pos] : NULL;
+    if (!index_of(key, &i))
+        return NULL;
+    if (!a)
+        return i == 0 ? v->text + v->name_len + 1 : NULL;
+    if (i < 0)
+        i += a->len;
+    return i >= 0 && (size_t)i < a->len ? a->values[i] : NULL;
+}
+
+/*
+ * Set the element of the array v at key to the len bytes of value. A
+ * NULL key appends to an indexed array.
+ */
+static bool
+store(var_t *v, const char *key, const char *value, size_t len)
+{
+    array_t *a = v->array;
+    char *copy;
+    long long i;
+    size_t pos = NONE, slot;
+
+    if (a->assoc && !key) {
+        fprintf(stderr, "shush: %.*s: must use subscript when assigning associative array\n",
+                (int)v->name_len, v->text);
+        return false;
+    }
+    if (a->assoc) {
+        pos = assoc_find(a, key, &slot);
+    } else if (!key) {
+        i = a->len;
+    } else if (!index_of(key, &i)) {
+        return false;
+    } else if ((i < 0 && (i += a->len) < 0) || i >= MAX_INDEX) {
+        fprintf(stderr, "shush: %.*s[%s]: bad array subscript\n", (int)v->name_len, v->text, key);
+        return false;
+    }
+
+    if (!(copy = malloc(len + 1))) {
+        perror("malloc");
+        exit(1);
+    }
+    memcpy(copy, value, len);
+    copy[len] = '\0';
+
+    if (a->assoc && pos != NONE) {
+        free(a->values[pos]);
+        a->values[pos] = copy;
+    } else if (a->assoc) {
+        if ((a->len + 1) * 4 >= a->index_size * 3) {
+            assoc_rehash(a);
+            assoc_find(a, key, &slot);
+        }
+        reserve(a, a->len + 1);
+        if (!(a->keys[a->len] = strdup(key))) {
+            perror("strdup");
+            exit(1);
+        }
+        a->values[a->len++] = copy;
+        a->index[slot] = a->len;
+        a->count++;
+    } else {
+        reserve(a, i + 1);
+        if (a->values[i])
+            free(a->values[i]);
+        else
+            a->count++;
+        a->values[i] = copy;
+        if ((size_t)i >= a->len)
+            a->len = i + 1;
+    }
+    return true;
+}
+
+/* Value of a variable, NULL when it is unset. An array gives element 0 */
+const char *
+var_get(const char *name)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    if (v && v->array)
+        return element(v, "0");
+    return v ? v->text + len + 1 : NULL;
+}
+
+int
+var_flags(const char *name)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    return v ? v->flags : 0;
+}
+
+/*
+ * Set a variable and add flags to those it has. A NULL value only adds
+ * the flags, to an empty variable if it was unset. VAR_ARRAY or
+ * VAR_ASSOC make it an array, and the value of an array is element 0.
+ * False for a read-only variable, which is left as it is.
+ */
+bool
+var_set(const char *name, const char *value, int flags)
+{
+    size_t len = strlen(name);
+    unsigned h = hash_bytes(name, len);
+    var_t *v = find(name, len, h, false);
+    bool created = !v;
+
+    if (v && (v->flags & VAR_READONLY) && value) {
+        fprintf(stderr, "shush: %s: readonly variable\n", name);
+        return false;
+    }
+    if (!v)
+        v = add(name, len, h);
+    if ((flags & (VAR_ARRAY | VAR_ASSOC)) && !make_array(v, flags & VAR_ASSOC))
+        return false;
+    if (!value) {
+        if (created || (v->flags | flags) != v->flags)
+            envp_stale = true;
+        v->flags |= flags;
+        return true;
+    }
+
+    if (v->array) {
+        if (!store(v, "0", value, strlen(value)))
+            return false;
+    } else {
+        free(v->text);
+        v->text = make_text(name, len, value);
+    }
+    v->flags |= flags;
+    changed(v);
+    return true;
+}
+
+bool
+var_unset(const char *name)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    if (!v)
+        return true;
+    if (v->flags & VAR_READONLY) {
+        fprintf(stderr, "shush: %s: readonly variable\n", name);
+        return false;
+    }
+    changed(v);
+    if (v->array) {
+        array_empty(v->array);
+        free(v->array->values);
+        free(v->array->keys);
+        free(v->array->index);
+        free(v->array);
+        v->array = NULL;
+    }
+    free(v->text);
+    v->text = tombstone;
+    v->flags = 0;
+    return true;
+}
+
+/* Value of name[key], NULL when it is not set. A key of an indexed array is arithmetic */
+const char *
+var_element(const char *name, const char *key)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    return v ? element(v, key) : NULL;
+}
+
+/*
+ * Set name[key] to the len bytes of value, a NULL key appends. A
+ * variable that is no array becomes an indexed one.
+ */
+bool
+var_set_element(const char *name, const char *key, const char *value, size_t len)
+{
+    size_t name_len = strlen(name);
+    unsigned h = hash_bytes(name, name_len);
+    var_t *v = find(name, name_len, h, false);
+
+    if (v && (v->flags & VAR_READONLY)) {
+        fprintf(stderr, "shush: %s: readonly variable\n", name);
+        return false;
+    }
+    if (!v)
+        v = add(name, name_len, h);
+    if (!v->array)
+        make_array(v, false);
+    return store(v, key, value, len);
+}
+
+bool
+var_unset_element(const char *name, const char *key)
+{
+    size_t len = strlen(name), pos, slot;
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+    array_t *a;
+    long long i;
+
+    if (!v)
+        return true;
+    if (v->flags & VAR_READONLY) {
+        fprintf(stderr, "shush: %s: readonly variable\n", name);
+        return false;
+    }
+    if (!(a = v->array)) {
+        if (!index_of(key, &i))
+            return false;
+        return i != 0 || var_unset(name);
+    }
+    if (a->assoc) {
+        /* The slot keeps the position, as a mark for probing to go on past */
+        if ((pos = assoc_find(a, key, &slot)) == NONE)
+            return true;
+        free(a->keys[pos]);
+        a->keys[pos] = NULL;
+    } else {
+        if (!index_of(key, &i))
+            return false;
+        if (i < 0)
+            i += a->len;
+        if (i < 0 || (size_t)i >= a->len || !a->values[i])
+            return true;
+        pos = i;
+    }
+    free(a->values[pos]);
+    a->values[pos] = NULL;
+    a->count--;
+    /* The end of an indexed array is its last element */
+    while (!a->assoc && a->len && !a->values[a->len - 1])
+        a->len--;
+    return true;
+}
+
+/*
+ * Make name an empty array, of the type in flags (VAR_ARRAY or
+ * VAR_ASSOC) unless it is an array already.
+ */
+bool
+var_clear(const char *name, int flags)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    if (v && (v->flags & VAR_READONLY)) {
+        fprintf(stderr, "shush: %s: readonly variable\n", name);
+        return false;
+    }
+    if (!v || !v->array)
+        return var_set(name, "", 0) && var_set(name, NULL, flags);
+    array_empty(v->array);
+    return true;
+}
+
+/* Elements of name that are set, 1 for a variable that is no array */
+size_t
+var_count(const char *name)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    if (!v)
+        return 0;
+    return v->array ? v->array->count : 1;
+}
+
+/*
+ * The element of name at or after *pos, in order, and its key in *key,
+ * or NULL past the last. *pos starts at 0 and is moved past the element.
+ * A variable that is no array is one element at 0.
+ */
+const char *
+var_next(const char *name, size_t *pos, const char **key)
+{
+    static char num[24];
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+    array_t *a;
+
+    if (!v)
+        return NULL;
+    if (!(a = v->array)) {
+        *key = "0";
+        return (*pos)++ ? NULL : v->text + len + 1;
+    }
+    for (; *pos < a->len; (*pos)++) {
+        if (!a->values[*pos])
+            continue;
+        if (a->assoc) {
+            *key = a->keys[*pos];
+        } else {
+            snprintf(num, sizeof(num), "%zu", *pos);
+            *key = num;
+        }
+        return a->values[(*pos)++];
+    }
+    return NULL;
+}
+
+/*
+ * An assignment in front of a command: the variable is exported with
+ * the new value until var_pop puts the old one back.
+ */
+void
+var_push(const char *name, const char *value)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+    saved_t *s;
+
+    if (saved_count == saved_size) {
+        saved_size = saved_size ? saved_size * 2 : 16;
+        if (!(saved = realloc(saved, saved_size * sizeof(*saved)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    s = &saved[saved_count++];
+    if (!(s->name = strdup(name))) {
+        perror("strdup");
+        exit(1);
+    }
+    s->text = v ? strdup(v->text) : NULL;
+    s->flags = v ? v->flags : 0;
+    var_set(name, value, VAR_EXPORT);
+}
+
+void
+var_pop(void)
+{
+    saved_t *s;
+    var_t *v;
+
+    if (!saved_count)
+        return;
+    s = &saved[--saved_count];
+    if (!s->text) {
+        var_unset(s->name);
+    } else if ((v = find(s->name, strlen(s->name), hash_bytes(s->name, strlen(s->name)), false))) {
+        envp_stale = true;
+        free(v->text);
+        v->text = s->text;
+        v->flags = s->flags;
+        changed(v);
+    } else {
+        var_set(s->name, s->text + strlen(s->name) + 1, s->flags);
+        free(s->text);
+    }
+    free(s->name);
+}
+
+/* Arrays stay in the shell even when they are exported */
+#define exported(v) (((v)->flags & (VAR_EXPORT | VAR_ARRAY | VAR_ASSOC)) == VAR_EXPORT)
+
+/* The environment for a command, built again only if it changed */
+char **
+var_environ(void)
+{
+    size_t n = 0;
+
+    if (!envp_stale && envp)
+        return envp;
+    for (size_t i = 0; i < slot_count; i++)
+        if (slots[i].text && slots[i].text != tombstone && exported(&slots[i]))
+            n++;
+    if (n + 1 > envp_size) {
+        envp_size = n + 1;
+        if (!(envp = realloc(envp, envp_size * sizeof(*envp)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    n = 0;
+    for (size_t i = 0; i < slot_count; i++)
+        if (slots[i].text && slots[i].text != tombstone && exported(&slots[i]))
+            envp[n++] = slots[i].text;
+    envp[n] = NULL;
+    envp_stale = false;
+    return envp;
+}
+
+/* By name, which ends at the '=' of each */
+static int
+compare_vars(const void *a, const void *b)
+{
+    const var_t *x = *(var_t *const *)a, *y = *(var_t *const *)b;
+    int d = memcmp(x->text, y->text, x->name_len < y->name_len ? x->name_len : y->name_len);
+
+    return d ? d : (x->name_len > y->name_len) - (x->name_len < y->name_len);
+}
+
+/* The elements of the array v as NAME=([key]="value" ...) */
+static void
+print_array(const var_t *v)
+{
+    const array_t *a = v->array;
+    const char *sep = "";
+
+    out_printf("%.*s=(", (int)v->name_len, v->text);
+    for (size_t i = 0; i < a->len; i++) {
+        if (!a->values[i])
+            continue;
+        if (a->assoc)
+            out_printf("%s[%s]=\"%s\"", sep, a->keys[i], a->values[i]);
+        else
+            out_printf("%s[%zu]=\"%s\"", sep, i, a->values[i]);
+        sep = " ";
+    }
+    out_str(")\n");
+}
+
+/* Print v after prefix, a NULL prefix is declare with the flags of v */
+static void
+print_var(const var_t *v, const char *prefix)
+{
+    char letters[8];
+    size_t k = 0;
+
+    if (!prefix) {
+        letters[k++] = '-';
+        if (v->flags & VAR_ARRAY)
+            letters[k++] = 'a';
+        if (v->flags & VAR_ASSOC)
+            letters[k++] = 'A';
+        if (v->flags & VAR_READONLY)
+            letters[k++] = 'r';
+        if (v->flags & VAR_EXPORT)
+            letters[k++] = 'x';
+        if (k == 1)
+            letters[k++] = '-';
+        letters[k] = '\0';
+        out_printf("declare %s ", letters);
+    } else {
+        out_str(prefix);
+    }
+    if (v->array)
+        print_array(v);
+    else if (!prefix || *prefix)
+        out_printf("%.*s=\"%s\"\n", (int)v->name_len, v->text, v->text + v->name_len + 1);
+    else
+        out_printf("%s\n", v->text);
+}
+
+/*
+ * Print the variables that have all of flags, sorted, each after prefix.
+ * A NULL prefix is declare with the flags of each.
+ */
+void
+var_print(int flags, const char *prefix)
+{
+    var_t **list;
+    size_t n = 0;
+
+    if (!(list = malloc((slot_count + 1) * sizeof(*list)))) {
+        perror("malloc");
+        exit(1);
+    }
+    for (size_t i = 0; i < slot_count; i++)
+        if (slots[i].text && slots[i].text != tombstone && (slots[i].flags & flags) == flags)
+            list[n++] = &slots[i];
+    qsort(list, n, sizeof(*list), compare_vars);
+    for (size_t i = 0; i < n; i++)
+        print_var(list[i], prefix);
+    free(list);
+}
+
+/* Print name as declare would set it, false when it is unset */
+bool
+var_print_name(const char *name)
+{
+    size_t len = strlen(name);
+    var_t *v = find(name, len, hash_bytes(name, len), false);
+
+    if (v)
+        print_var(v, NULL);
+    return v != NULL;
+}
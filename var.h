@@ -0,0 +1,38 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Shell variables for Simple Humane Shell (shush).
+ */
+
+#ifndef VAR_H
+#define VAR_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+/* Variable flags */
+#define VAR_EXPORT   1  /* in the environment of commands */
+#define VAR_READONLY 2  /* cannot be set or unset again */
+#define VAR_ARRAY    4  /* indexed array */
+#define VAR_ASSOC    8  /* associative array */
+
+void vars_init(char **envp);
+const char *var_get(const char *name);
+int var_flags(const char *name);
+bool var_set(const char *name, const char *value, int flags);
+bool var_unset(const char *name);
+bool var_valid_name(const char *s, size_t len);
+const char *var_element(const char *name, const char *key);
+bool var_set_element(const char *name, const char *key, const char *value, size_t len);
+bool var_unset_element(const char *name, const char *key);
+bool var_clear(const char *name, int flags);
+size_t var_count(const char *name);
+const char *var_next(const char *name, size_t *pos, const char **key);
+void var_push(const char *name, const char *value);
+void var_pop(void);
+char **var_environ(void);
+void var_print(int flags, const char *prefix);
+bool var_print_name(const char *name);
+
+#endif /* VAR_H */
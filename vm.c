@@ -0,0 +1,395 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Bytecode for compound commands in Simple Humane Shell (shush).
+ *
+ * if, while, until, for and case are compiled the first time they run
+ * into a flat array of instructions, kept next to the AST in its arena.
+ * Conditions and loops become jumps, and only the simple commands and
+ * pipelines at the leaves go back to execute(), so running a loop body
+ * again costs no parsing and no walking of the tree above the leaves.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include "arena.h"
+#include "builtins.h"
+#include "exec.h"
+#include "parse.h"
+#include "var.h"
+#include "vm.h"
+
+/* Opcodes */
+enum {
+    OP_RUN,         /* execute(node) */
+    OP_JMP,         /* jump to arg */
+    OP_JZ,          /* jump to arg when the status is 0 */
+    OP_JNZ,         /* jump to arg when the status is not 0 */
+    OP_TRUE,        /* status 0 */
+    OP_LOOP,        /* enter a while or until loop that exits at arg */
+    OP_FOR,         /* expand the word list of node, enter a loop that exits at arg */
+    OP_NEXT,        /* set the variable to the next word, jump to arg when done */
+    OP_AGAIN,       /* end of a loop body, jump back to arg */
+    OP_POOL,        /* leave the innermost loop */
+    OP_CASE,        /* expand the subject of node */
+    OP_MATCH,       /* jump to arg unless a pattern of case item node matches */
+    OP_ESAC,        /* done with the innermost case */
+};
+
+static const char *op_names[] = {
+    [OP_RUN] = "run",
+    [OP_JMP] = "jmp",
+    [OP_JZ] = "jz",
+    [OP_JNZ] = "jnz",
+    [OP_TRUE] = "true",
+    [OP_LOOP] = "loop",
+    [OP_FOR] = "for",
+    [OP_NEXT] = "next",
+    [OP_AGAIN] = "again",
+    [OP_POOL] = "pool",
+    [OP_CASE] = "case",
+    [OP_MATCH] = "match",
+    [OP_ESAC] = "esac",
+};
+
+typedef struct {
+    int op;
+    int arg;
+    node_t *node;
+} insn_t;
+
+struct code {
+    int len;
+    int loops;              /* deepest loop nesting */
+    int cases;              /* deepest case nesting */
+    insn_t insns[];
+};
+
+/* A loop that is running */
+typedef struct {
+    int exit;               /* pc of its OP_POOL */
+    int cont;               /* pc that continue jumps to */
+    int status;             /* status of the last body run */
+    int cases;              /* cases open when the loop started */
+    char **items;           /* for: expanded word list */
+    int count;
+    int i;
+    const char *name;
+    arena_mark_t mark;      /* scratch before the loop */
+    arena_mark_t body;      /* scratch before its body */
+} frame_t;
+
+typedef struct {
+    const char *subject;
+    arena_mark_t mark;
+} case_t;
+
+/* Instructions of the code being compiled, copied to the arena at the end */
+static insn_t *buf = NULL;
+static int buf_len = 0, buf_size = 0;
+static node_t *compiling;       /* the node at the top of the code */
+
+/* Function Prototypes */
+static struct code *compile(node_t *n);
+static void compile_node(node_t *n, int loops, int cases, int *max_loops, int *max_cases);
+static int emit(int op, int arg, node_t *node);
+static void patch(int at);
+static bool case_match(const char *subject, node_t *item);
+
+static int
+emit(int op, int arg, node_t *node)
+{
+    if (buf_len == buf_size) {
+        buf_size = buf_size ? buf_size * 2 : 64;
+        if (!(buf = realloc(buf, buf_size * sizeof(*buf)))) {
+            perror("realloc");
+            exit(1);
+        }
+    }
+    buf[buf_len].op = op;
+    buf[buf_len].arg = arg;
+    buf[buf_len].node = node;
+    return buf_len++;
+}
+
+/* Point the jump at the next instruction */
+static void
+patch(int at)
+{
+    buf[at].arg = buf_len;
+}
+
+static void
+compile_node(node_t *n, int loops, int cases, int *max_loops, int *max_cases)
+{
+    node_t *c;
+    int top, jump, ends;
+
+    if (loops > *max_loops)
+        *max_loops = loops;
+    if (cases > *max_cases)
+        *max_cases = cases;
+
+    /* Redirections hold around a whole command, execute() sets them up */
+    if (n->redirs && n != compiling) {
+        emit(OP_RUN, 0, n);
+        return;
+    }
+
+    switch (n->type) {
+    case N_LIST:
+        for (c = n->body; c; c = c->next) {
+            if (c->flags & NODE_BG)
+                emit(OP_RUN, 0, c);
+            else
+                compile_node(c, loops, cases, max_loops, max_cases);
+        }
+        break;
+    case N_GROUP:
+        compile_node(n->body, loops, cases, max_loops, max_cases);
+        break;
+    case N_AND:
+    case N_OR:
+        compile_node(n->left, loops, cases, max_loops, max_cases);
+        jump = emit(n->type == N_AND ? OP_JNZ : OP_JZ, 0, NULL);
+        compile_node(n->right, loops, cases, max_loops, max_cases);
+        patch(jump);
+        break;
+    case N_IF:
+        compile_node(n->left, loops, cases, max_loops, max_cases);
+        jump = emit(OP_JNZ, 0, NULL);
+        compile_node(n->right, loops, cases, max_loops, max_cases);
+        top = emit(OP_JMP, 0, NULL);
+        patch(jump);
+        /* With no branch taken the status is 0 */
+        if (n->alt)
+            compile_node(n->alt, loops, cases, max_loops, max_cases);
+        else
+            emit(OP_TRUE, 0, NULL);
+        patch(top);
+        break;
+    case N_WHILE:
+    case N_UNTIL:
+        top = emit(OP_LOOP, 0, n);
+        compile_node(n->left, loops + 1, cases, max_loops, max_cases);
+        jump = emit(n->type == N_WHILE ? OP_JNZ : OP_JZ, 0, NULL);
+        compile_node(n->right, loops + 1, cases, max_loops, max_cases);
+        emit(OP_AGAIN, top + 1, NULL);
+        patch(top);
+        patch(jump);
+        emit(OP_POOL, 0, NULL);
+        break;
+    case N_FOR:
+        top = emit(OP_FOR, 0, n);
+        jump = emit(OP_NEXT, 0, n);
+        compile_node(n->right, loops + 1, cases, max_loops, max_cases);
+        emit(OP_AGAIN, jump, NULL);
+        patch(top);
+        patch(jump);
+        emit(OP_POOL, 0, NULL);
+        break;
+    case N_CASE:
+        emit(OP_CASE, 0, n);
+        /* The jumps out of each item are chained through arg until patched */
+        ends = -1;
+        for (c = n->body; c; c = c->next) {
+            jump = emit(OP_MATCH, 0, c);
+            if (c->right)
+                compile_node(c->right, loops, cases + 1, max_loops, max_cases);
+            ends = emit(OP_JMP, ends, NULL);
+            patch(jump);
+        }
+        while (ends >= 0) {
+            top = buf[ends].arg;
+            patch(ends);
+            ends = top;
+        }
+        emit(OP_ESAC, 0, NULL);
+        break;
+    default:
+        emit(OP_RUN, 0, n);
+        break;
+    }
+}
+
+/* Compile n into its own arena */
+static struct code *
+compile(node_t *n)
+{
+    struct code *c;
+    int loops = 0, cases = 0;
+
+    buf_len = 0;
+    compiling = n;
+    compile_node(n, 0, 0, &loops, &cases);
+
+    c = arena_alloc(n->arena, sizeof(*c) + buf_len * sizeof(insn_t));
+    c->len = buf_len;
+    c->loops = loops;
+    c->cases = cases;
+    memcpy(c->insns, buf, buf_len * sizeof(insn_t));
+    return c;
+}
+
+static bool
+case_match(const char *subject, node_t *item)
+{
+    pattern_t *pattern;
+    size_t len;
+
+    if (!subject)
+        return false;
+    len = strlen(subject);
+    for (word_t *w = item->words; w; w = w->next)
+        if ((pattern = compile_pattern(item->arena, w)) && pattern_match(pattern, subject, len))
+            return true;
+    return false;
+}
+
+/*
+ * Run a compound command, compiling it first if this is its first run.
+ * break and continue only ever unwind loops of this code: loops nest
+ * lexically, so the loops they name are all in the same instructions,
+ * unless they were run by a sourced file, whose caller then takes over.
+ */
+int
+vm_execute(node_t *n)
+{
+    struct code *c = n->code ? n->code : (n->code = compile(n));
+    frame_t frames[c->loops + 1], *f;
+    case_t cases[c->cases + 1];
+    arena_mark_t entry = arena_mark(&scratch);
+    int pc = 0, depth = 0, ncases = 0, status = 0, levels;
+    insn_t *in;
+
+    while (pc < c->len) {
+        in = &c->insns[pc++];
+        switch (in->op) {
+        case OP_RUN:
+            status = execute(in->node);
+            if (!breaking && !continuing && !returning && !interrupted)
+                break;
+
+            levels = breaking ? breaking : continuing;
+            if (returning || interrupted || levels > depth) {
+                /* Leave all of this code, whoever ran it goes on unwinding */
+                if (breaking)
+                    breaking -= depth;
+                else if (continuing)
+                    continuing -= depth;
+                pc = c->len;
+                break;
+            }
+            depth -= levels - 1;
+            loop_depth -= levels - 1;
+            f = &frames[depth - 1];
+            ncases = f->cases;
+            f->status = status;
+            arena_release(&scratch, f->body);
+            if (breaking) {
+                breaking = 0;
+                pc = f->exit;
+            } else {
+                continuing = 0;
+                pc = f->cont;
+            }
+            break;
+        case OP_JMP:
+            pc = in->arg;
+            break;
+        case OP_JZ:
+            if (status == 0)
+                pc = in->arg;
+            break;
+        case OP_JNZ:
+            if (status != 0)
+                pc = in->arg;
+            break;
+        case OP_TRUE:
+            status = 0;
+            break;
+        case OP_LOOP:
+        case OP_FOR:
+            f = &frames[depth++];
+            loop_depth++;
+            f->exit = in->arg;
+            f->cont = pc;
+            f->status = 0;
+            f->cases = ncases;
+            f->mark = arena_mark(&scratch);
+            if (in->op == OP_FOR) {
+                f->items = expand_words(in->node->arena, in->node->words, &f->count);
+                f->i = 0;
+                /* A failed expansion runs the loop zero times */
+                if (!f->items) {
+                    f->count = 0;
+                    f->status = 1;
+                }
+                f->name = in->node->name;
+            }
+            f->body = arena_mark(&scratch);
+            break;
+        case OP_NEXT:
+            f = &frames[depth - 1];
+            if (f->i >= f->count) {
+                pc = in->arg;
+                break;
+            }
+            var_set(f->name, f->items[f->i++], 0);
+            break;
+        case OP_AGAIN:
+            f = &frames[depth - 1];
+            f->status = status;
+            pc = in->arg;
+            break;
+        case OP_POOL:
+            f = &frames[--depth];
+            loop_depth--;
+            status = f->status;
+            arena_release(&scratch, f->mark);
+            break;
+        case OP_CASE:
+            cases[ncases].mark = arena_mark(&scratch);
+            cases[ncases].subject = expand_string(in->node->arena, in->node->words);
+            status = cases[ncases].subject ? 0 : 1;
+            ncases++;
+            break;
+        case OP_MATCH:
+            if (!case_match(cases[ncases - 1].subject, in->node))
+                pc = in->arg;
+            break;
+        case OP_ESAC:
+            arena_release(&scratch, cases[--ncases].mark);
+            break;
+        }
+    }
+
+    loop_depth -= depth;
+    arena_release(&scratch, entry);
+    last_exit_status = status;
+    return status;
+}
+
+/* Print the bytecode of n, for debug mode */
+void
+vm_dump(node_t *n)
+{
+    struct code *c = n->code ? n->code : (n->code = compile(n));
+
+    for (int pc = 0; pc < c->len; pc++) {
+        insn_t *in = &c->insns[pc];
+
+        fprintf(stderr, "%4d  %-6s", pc, op_names[in->op]);
+        if (in->op != OP_RUN && in->op != OP_TRUE && in->op != OP_POOL &&
+            in->op != OP_CASE && in->op != OP_ESAC)
+            fprintf(stderr, " %d", in->arg);
+        if (in->node && in->node->name)
+            fprintf(stderr, " %s", in->node->name);
+        else if (in->node && in->node->words && word_literal(in->node->words))
+            fprintf(stderr, " %s", word_literal(in->node->words));
+        fputc('\n', stderr);
+    }
+}
@@ -0,0 +1,16 @@
+/*
+ * MIT/X Consortium License
+ * Copyright © 2024 Milán Atanáz Major
+ *
+ * Bytecode for compound commands in Simple Humane Shell (shush).
+ */
+
+#ifndef VM_H
+#define VM_H
+
+#include "parse.h"
+
+int vm_execute(node_t *n);
+void vm_dump(node_t *n);
+
+#endif /* VM_H */